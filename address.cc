@@ -1,5 +1,6 @@
 #include "address.h"
 #include "Endian.h"
+#include "log.h"
 
 #include <ifaddrs.h>
 #include <netdb.h>
@@ -8,6 +9,8 @@
 namespace Global
 {
 
+static Logger::ptr g_logger = GLOBAL_LOG_NAME("system");
+
 template<class T>
 static T CreateMask(uint32_t bits)
 {
@@ -97,9 +100,9 @@ bool Address::Lookup(std::vector<Address::ptr>& result, const std::string& host,
     int errno = getaddrinfo(node.c_str(), service, &hints, &results);
     if(errno)
     {
-        std::cout << "Address::Lookup getaddress(" << host << ","
+        GLOBAL_LOG_ERROR(g_logger) << "Address::Lookup getaddress(" << host << ","
         << family << "," << type << ") err=" << errno << "errstr = "
-        << gai_strerror(errno) << std::endl;
+        << gai_strerror(errno);
 
         return false;
     }
@@ -122,7 +125,7 @@ bool Address::GetInterfaceAddresses(std::multimap<std::string
     struct ifaddrs *next, *results;
     if(getifaddrs(&results) != 0)
     {
-        std::cerr << "Address::GetInterfaceAddresses getifaddrs "
+        GLOBAL_LOG_ERROR(g_logger) << "Address::GetInterfaceAddresses getifaddrs "
             << " err=" << errno << " errstr=" << strerror(errno);
         return false;
     }
@@ -168,7 +171,7 @@ bool Address::GetInterfaceAddresses(std::multimap<std::string
     }
     catch(...)
     {
-        std::cerr << "Address::GetInterfaceAddresses exception" << '\n';
+        GLOBAL_LOG_ERROR(g_logger) << "Address::GetInterfaceAddresses exception";
         freeaddrinfo(results);
         return false;
     }
@@ -272,7 +275,7 @@ IPAddress::ptr IPAddress::Create(const char* address, uint16_t port)
     int errno = getaddrinfo(address, NULL, &hints, &results);
     if(errno)
     {
-        std::cerr << "IPAddress::Create(" << address
+        GLOBAL_LOG_WARN(g_logger) << "IPAddress::Create(" << address
             << ", " << port << ") error=" << error
             << " errno=" << errno << " errstr=" << strerror(errno);
             return nullptr;
@@ -303,7 +306,7 @@ IPv4Address::ptr IPv4Address::Create(const char* address, uint16_t port)
     int result = inet_pton(AF_INET, address, &rt->m_addr.sin_addr);
     if(result <= 0)
     {
-        std::cerr << "IPv4Address::Create(" << address << ", "
+        GLOBAL_LOG_WARN(g_logger) << "IPv4Address::Create(" << address << ", "
                 << port << ") rt=" << result << " errno=" << errno
                 << " errstr=" << strerror(errno);
         return nullptr;
@@ -387,7 +390,7 @@ IPv6Address::ptr IPv6Address::Create(const char* address, uint16_t port) {
     rt->m_addr.sin6_port = byteswapOnLittleEndian(port);
     int result = inet_pton(AF_INET6, address, &rt->m_addr.sin6_addr);
     if(result <= 0) {
-        SYLAR_LOG_DEBUG(g_logger) << "IPv6Address::Create(" << address << ", "
+        GLOBAL_LOG_WARN(g_logger) << "IPv6Address::Create(" << address << ", "
                 << port << ") rt=" << result << " errno=" << errno
                 << " errstr=" << strerror(errno);
         return nullptr;
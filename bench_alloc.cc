@@ -0,0 +1,126 @@
+#include "iomanager.h"
+#include "fd_manager.h"
+#include "hook.h"
+
+#include <atomic>
+#include <iostream>
+#include <new>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+// 统计全局operator new次数
+static std::atomic<uint64_t> s_allocs{0};
+
+void* operator new(size_t size)
+{
+    ++s_allocs;
+    void* p = malloc(size ? size : 1);
+    if(!p) throw std::bad_alloc();
+    return p;
+}
+
+void operator delete(void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+
+static uint64_t GetCurrentUs()
+{
+    struct timeval t;
+    gettimeofday(&t, NULL);
+    return t.tv_sec * 1000000ul + t.tv_usec;
+}
+
+static const size_t MSG_SIZE = 64;
+static const int WARMUP = 1000;
+
+static void set_recv_timeout(int fd, int ms)
+{
+    struct timeval tv;
+    tv.tv_sec = ms / 1000;
+    tv.tv_usec = ms % 1000 * 1000;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+}
+
+static bool recv_all(int fd, char* buf)
+{
+    size_t n = 0;
+    while(n < MSG_SIZE)
+    {
+        ssize_t rt = recv(fd, buf + n, MSG_SIZE - n, 0);
+        if(rt <= 0) return false;
+        n += rt;
+    }
+    return true;
+}
+
+// 每次往返客户端和服务端各阻塞在recv上一次
+static void bench(size_t threads, int timeout_ms, int round_trips)
+{
+    uint64_t allocs = 0;
+    uint64_t used = 0;
+    {
+        Global::IOManager iom(threads, false, "alloc");
+        int sv[2];
+        if(socketpair(AF_UNIX, SOCK_STREAM, 0, sv))
+        {
+            perror("socketpair");
+            return;
+        }
+        // socketpair没有hook, 手动登记使其走协程IO
+        Global::FdMgr::GetInstance()->get(sv[0], true);
+        Global::FdMgr::GetInstance()->get(sv[1], true);
+        iom.schedule([sv, timeout_ms](){
+            char buf[MSG_SIZE];
+            if(timeout_ms >= 0)
+            {
+                set_recv_timeout(sv[1], timeout_ms);
+            }
+            while(recv_all(sv[1], buf))
+            {
+                send(sv[1], buf, MSG_SIZE, 0);
+            }
+            close(sv[1]);
+        });
+        iom.schedule([sv, timeout_ms, round_trips, &allocs, &used](){
+            char buf[MSG_SIZE];
+            memset(buf, 'x', sizeof(buf));
+            if(timeout_ms >= 0)
+            {
+                set_recv_timeout(sv[0], timeout_ms);
+            }
+            uint64_t begin = 0;
+            for(int i = 0; i < WARMUP + round_trips; i++)
+            {
+                if(i == WARMUP)
+                {
+                    allocs = s_allocs;
+                    begin = GetCurrentUs();
+                }
+                send(sv[0], buf, MSG_SIZE, 0);
+                if(!recv_all(sv[0], buf)) break;
+            }
+            allocs = s_allocs - allocs;
+            used = GetCurrentUs() - begin;
+            close(sv[0]);
+        });
+    }
+    uint64_t waits = (uint64_t)round_trips * 2;
+    std::cout << "[bench] threads=" << threads
+              << " timeout=" << (timeout_ms >= 0 ? "on" : "off")
+              << " round_trips/s=" << (uint64_t)(round_trips * 1000000.0 / used)
+              << " allocs/wait=" << ((double)allocs / waits) << std::endl;
+}
+
+int main(int argc, char** argv)
+{
+    size_t max_threads = argc > 1 ? atoi(argv[1]) : 2;
+    int round_trips = argc > 2 ? atoi(argv[2]) : 100000;
+    for(size_t t = 1; t <= max_threads; t++)
+    {
+        bench(t, -1, round_trips);
+        bench(t, 5000, round_trips);
+    }
+    return 0;
+}
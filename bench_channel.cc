@@ -0,0 +1,74 @@
+#include "channel.h"
+#include "iomanager.h"
+
+#include <iostream>
+#include <stdlib.h>
+#include <sys/time.h>
+
+static uint64_t GetCurrentUs()
+{
+    struct timeval t;
+    gettimeofday(&t, NULL);
+    return t.tv_sec * 1000000ul + t.tv_usec;
+}
+
+// producers个协程各发送items个数, consumers个协程接收到通道关闭, 校验总和
+static void bench_channel(const char* name, size_t threads, size_t producers
+                        , size_t consumers, size_t capacity, uint64_t items)
+{
+    Global::Channel<uint64_t> channel(capacity);
+    std::atomic<uint64_t> sum{0};
+    std::atomic<size_t> running{producers};
+    uint64_t begin = GetCurrentUs();
+    {
+        Global::IOManager iom(threads, false, "channel");
+        for(size_t c = 0; c < consumers; c++)
+        {
+            iom.schedule([&channel, &sum](){
+                uint64_t local = 0;
+                uint64_t v;
+                while(channel.recv(v))
+                {
+                    local += v;
+                }
+                sum += local;
+            });
+        }
+        for(size_t p = 0; p < producers; p++)
+        {
+            iom.schedule([&channel, &running, items](){
+                for(uint64_t i = 1; i <= items; i++)
+                {
+                    channel.send(i);
+                }
+                if(--running == 0)
+                {
+                    channel.close();
+                }
+            });
+        }
+    }
+    uint64_t used = GetCurrentUs() - begin;
+    uint64_t total = producers * items;
+    bool ok = sum == producers * (items * (items + 1) / 2);
+    std::cout << "[bench] " << name << " threads=" << threads
+              << " producers=" << producers << " consumers=" << consumers
+              << " capacity=" << capacity
+              << " msgs/s=" << (uint64_t)(total * 1000000.0 / used)
+              << (ok ? "" : " CHECKSUM MISMATCH") << std::endl;
+}
+
+int main(int argc, char** argv)
+{
+    uint64_t items = argc > 1 ? atoi(argv[1]) : 1000000;
+    size_t capacity = argc > 2 ? atoi(argv[2]) : 1024;
+    for(size_t threads = 1; threads <= 8; threads *= 2)
+    {
+        bench_channel("spsc", threads, 1, 1, capacity, items);
+        bench_channel("mpsc", threads, 4, 1, capacity, items / 4);
+        bench_channel("mpmc", threads, 4, 4, capacity, items / 4);
+    }
+    // 容量很小时收发双方频繁让出, 主要测量挂起和恢复的开销
+    bench_channel("mpmc", 2, 4, 4, 1, items / 10);
+    return 0;
+}
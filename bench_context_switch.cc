@@ -0,0 +1,91 @@
+#include "context.h"
+#include "fiber.h"
+#include "scheduler.h"
+
+#include <iostream>
+#include <stdlib.h>
+#include <sys/time.h>
+
+static const uint64_t s_switches = 2000000;
+static const size_t s_stack_size = 64 * 1024;
+
+static uint64_t GetCurrentUs()
+{
+    struct timeval t;
+    gettimeofday(&t, NULL);
+    return t.tv_sec * 1000000ul + t.tv_usec;
+}
+
+static void report(const char* name, uint64_t switches, uint64_t us)
+{
+    std::cout << name << ": " << switches << " switches in " << us << " us, "
+              << (uint64_t)(switches * 1000000.0 / (us ? us : 1)) << " switches/s, "
+              << (us * 1000.0 / switches) << " ns/switch" << std::endl;
+}
+
+template<class Context>
+struct PingPong
+{
+    static Context main_ctx;
+    static Context co_ctx;
+
+    static void entry()
+    {
+        while(true)
+        {
+            Context::Swap(&co_ctx, &main_ctx);
+        }
+    }
+
+    static void run(const char* name)
+    {
+        void* stack = malloc(s_stack_size);
+        co_ctx.make(stack, s_stack_size, &entry);
+        uint64_t begin = GetCurrentUs();
+        for(uint64_t i = 0; i < s_switches / 2; i++)
+        {
+            Context::Swap(&main_ctx, &co_ctx);
+        }
+        report(name, s_switches, GetCurrentUs() - begin);
+        free(stack);
+    }
+};
+
+template<class Context> Context PingPong<Context>::main_ctx;
+template<class Context> Context PingPong<Context>::co_ctx;
+
+static bool s_running = true;
+
+static void fiber_loop()
+{
+    while(s_running)
+    {
+        Global::Fiber::YieldToReady();
+    }
+}
+
+// Fiber::swapIn/swapOut 走编译期选择的上下文实现
+static void bench_fiber()
+{
+    Global::Scheduler sc(1, true, "bench");
+    Global::Fiber::ptr fiber(new Global::Fiber(&fiber_loop, s_stack_size));
+    uint64_t begin = GetCurrentUs();
+    for(uint64_t i = 0; i < s_switches / 2; i++)
+    {
+        fiber->swapIn();
+    }
+    uint64_t used = GetCurrentUs() - begin;
+    s_running = false;
+    fiber->swapIn();
+    report("Fiber(" GLOBAL_FIBER_CONTEXT_NAME ")", s_switches, used);
+}
+
+int main(int argc, char** argv)
+{
+    PingPong<Global::UContext>::run("ucontext");
+#ifdef GLOBAL_HAVE_ASM_CONTEXT
+    PingPong<Global::AsmContext>::run("asm");
+#endif
+    bench_fiber();
+    return 0;
+}
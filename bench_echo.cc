@@ -0,0 +1,162 @@
+#include "iomanager.h"
+#include "fd_manager.h"
+#include "hook.h"
+
+#include <atomic>
+#include <iostream>
+#include <dlfcn.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include <sys/epoll.h>
+#include <linux/perf_event.h>
+
+// 统计IOManager发起的epoll_ctl次数
+static std::atomic<uint64_t> s_epoll_ctls{0};
+
+extern "C" int epoll_ctl(int epfd, int op, int fd, struct epoll_event* event)
+{
+    typedef int (*epoll_ctl_fun)(int, int, int, struct epoll_event*);
+    static epoll_ctl_fun real = (epoll_ctl_fun)dlsym(RTLD_NEXT, "epoll_ctl");
+    ++s_epoll_ctls;
+    return real(epfd, op, fd, event);
+}
+
+static uint64_t GetCurrentUs()
+{
+    struct timeval t;
+    gettimeofday(&t, NULL);
+    return t.tv_sec * 1000000ul + t.tv_usec;
+}
+
+// 统计本进程及之后创建的线程的cache miss, 没有权限时返回-1
+static int OpenCacheMissCounter()
+{
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = PERF_COUNT_HW_CACHE_MISSES;
+    attr.disabled = 1;
+    attr.inherit = 1;
+    attr.exclude_hv = 1;
+    return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static const size_t MSG_SIZE = 64;
+
+static void client(int fd, int msgs)
+{
+    char buf[MSG_SIZE];
+    memset(buf, 'x', sizeof(buf));
+    for(int i = 0; i < msgs; i++)
+    {
+        write(fd, buf, sizeof(buf));
+        size_t n = 0;
+        while(n < sizeof(buf))
+        {
+            ssize_t rt = read(fd, buf + n, sizeof(buf) - n);
+            if(rt <= 0) return;
+            n += rt;
+        }
+    }
+    close(fd);
+}
+
+static void server(int fd)
+{
+    char buf[MSG_SIZE];
+    while(true)
+    {
+        ssize_t rt = read(fd, buf, sizeof(buf));
+        if(rt <= 0) break;
+        write(fd, buf, rt);
+    }
+    close(fd);
+}
+
+static void bench(size_t threads, bool sharded, Global::IOManager::Backend backend
+                , bool persistent, int conns, int msgs)
+{
+    int counter = OpenCacheMissCounter();
+    if(counter >= 0)
+    {
+        ioctl(counter, PERF_EVENT_IOC_RESET, 0);
+        ioctl(counter, PERF_EVENT_IOC_ENABLE, 0);
+    }
+    uint64_t ctls = 0;
+    uint64_t begin = GetCurrentUs();
+    std::string mode;
+    {
+        Global::IOManager iom(threads, false, "echo", sharded, backend, persistent);
+        mode = iom.getBackend() == Global::IOManager::IO_URING ? "io_uring"
+             : (iom.isSharded() ? "sharded" : "shared");
+        if(iom.isPersistent())
+        {
+            mode += "+persistent";
+        }
+        // 不计入构造时注册eventfd/ring的调用
+        ctls = s_epoll_ctls;
+        for(int i = 0; i < conns; i++)
+        {
+            int sv[2];
+            if(socketpair(AF_UNIX, SOCK_STREAM, 0, sv))
+            {
+                perror("socketpair");
+                return;
+            }
+            // socketpair没有hook, 手动登记使其走协程IO
+            Global::FdMgr::GetInstance()->get(sv[0], true);
+            Global::FdMgr::GetInstance()->get(sv[1], true);
+            iom.schedule([sv](){ server(sv[1]); });
+            iom.schedule([sv, msgs](){ client(sv[0], msgs); });
+        }
+    }
+    uint64_t used = GetCurrentUs() - begin;
+    ctls = s_epoll_ctls - ctls;
+    long long misses = -1;
+    if(counter >= 0)
+    {
+        ioctl(counter, PERF_EVENT_IOC_DISABLE, 0);
+        if(read(counter, &misses, sizeof(misses)) != sizeof(misses))
+        {
+            misses = -1;
+        }
+        close(counter);
+    }
+    uint64_t total = (uint64_t)conns * msgs;
+    std::cout << "[bench] threads=" << threads
+              << " mode=" << mode
+              << " round_trips/s=" << (uint64_t)(total * 1000000.0 / used)
+              << " epoll_ctl/round_trip=" << ((double)ctls / total)
+              << " cache_misses/round_trip=";
+    if(misses >= 0)
+    {
+        std::cout << ((double)misses / total);
+    }
+    else
+    {
+        std::cout << "n/a";
+    }
+    std::cout << std::endl;
+}
+
+int main(int argc, char** argv)
+{
+    size_t max_threads = argc > 1 ? atoi(argv[1]) : 4;
+    int conns = argc > 2 ? atoi(argv[2]) : 100;
+    int msgs = argc > 3 ? atoi(argv[3]) : 1000;
+    for(size_t t = 1; t <= max_threads; t++)
+    {
+        bench(t, false, Global::IOManager::EPOLL, false, conns, msgs);
+        bench(t, false, Global::IOManager::EPOLL, true, conns, msgs);
+        bench(t, true, Global::IOManager::EPOLL, false, conns, msgs);
+        bench(t, true, Global::IOManager::EPOLL, true, conns, msgs);
+        bench(t, false, Global::IOManager::IO_URING, false, conns, msgs);
+    }
+    return 0;
+}
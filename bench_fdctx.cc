@@ -0,0 +1,182 @@
+#include "iomanager.h"
+#include "fd_manager.h"
+#include "hook.h"
+
+#include <iostream>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include <linux/perf_event.h>
+
+static uint64_t GetCurrentUs()
+{
+    struct timeval t;
+    gettimeofday(&t, NULL);
+    return t.tv_sec * 1000000ul + t.tv_usec;
+}
+
+// 统计本进程及之后创建的线程的硬件事件, 没有权限时返回-1
+static int OpenCounter(uint32_t type, uint64_t config)
+{
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = 1;
+    attr.inherit = 1;
+    attr.exclude_hv = 1;
+    return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static void StartCounter(int counter)
+{
+    if(counter >= 0)
+    {
+        ioctl(counter, PERF_EVENT_IOC_RESET, 0);
+        ioctl(counter, PERF_EVENT_IOC_ENABLE, 0);
+    }
+}
+
+static long long StopCounter(int counter)
+{
+    long long value = -1;
+    if(counter >= 0)
+    {
+        ioctl(counter, PERF_EVENT_IOC_DISABLE, 0);
+        if(read(counter, &value, sizeof(value)) != sizeof(value))
+        {
+            value = -1;
+        }
+        close(counter);
+    }
+    return value;
+}
+
+static void PrintPerIo(const char* name, long long value, uint64_t ios)
+{
+    std::cout << " " << name << "/io=";
+    if(value >= 0)
+    {
+        std::cout << ((double)value / ios);
+    }
+    else
+    {
+        std::cout << "n/a";
+    }
+}
+
+static const size_t MSG_SIZE = 16;
+
+static bool recv_all(int fd, char* buf)
+{
+    size_t n = 0;
+    while(n < MSG_SIZE)
+    {
+        ssize_t rt = recv(fd, buf + n, MSG_SIZE - n, 0);
+        if(rt <= 0) return false;
+        n += rt;
+    }
+    return true;
+}
+
+static void set_recv_timeout(int fd, int ms)
+{
+    struct timeval tv;
+    tv.tv_sec = ms / 1000;
+    tv.tv_usec = ms % 1000 * 1000;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+}
+
+// 大量连接同时往返, 每次hook调用访问的per-fd数据远超cache容量,
+// cache miss主要来自查找和访问per-fd记录
+static void bench(size_t threads, int conns, int msgs, bool timeout)
+{
+    int misses = OpenCounter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+    int l1d = OpenCounter(PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D
+                | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+                | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+    uint64_t begin = 0;
+    uint64_t used = 0;
+    {
+        Global::IOManager iom(threads, false, "fdctx");
+        for(int i = 0; i < conns; i++)
+        {
+            int sv[2];
+            if(socketpair(AF_UNIX, SOCK_STREAM, 0, sv))
+            {
+                perror("socketpair");
+                break;
+            }
+            // socketpair没有hook, 手动登记使其走协程IO
+            Global::FdMgr::GetInstance()->get(sv[0], true);
+            Global::FdMgr::GetInstance()->get(sv[1], true);
+            iom.schedule([sv, timeout](){
+                char buf[MSG_SIZE];
+                if(timeout)
+                {
+                    set_recv_timeout(sv[1], 5000);
+                }
+                while(recv_all(sv[1], buf))
+                {
+                    send(sv[1], buf, MSG_SIZE, 0);
+                }
+                close(sv[1]);
+            });
+            iom.schedule([sv, msgs, timeout](){
+                char buf[MSG_SIZE];
+                memset(buf, 'x', sizeof(buf));
+                if(timeout)
+                {
+                    set_recv_timeout(sv[0], 5000);
+                }
+                for(int i = 0; i < msgs; i++)
+                {
+                    send(sv[0], buf, MSG_SIZE, 0);
+                    if(!recv_all(sv[0], buf)) break;
+                }
+                close(sv[0]);
+            });
+        }
+        // 连接建立和协程创建不计入
+        begin = GetCurrentUs();
+        StartCounter(misses);
+        StartCounter(l1d);
+    }
+    used = GetCurrentUs() - begin;
+    long long miss_count = StopCounter(misses);
+    long long l1d_count = StopCounter(l1d);
+    // 每次往返两端各一次send和一次recv
+    uint64_t ios = (uint64_t)conns * msgs * 4;
+    std::cout << "[bench] threads=" << threads
+              << " conns=" << conns
+              << " timeout=" << (timeout ? "on" : "off")
+              << " ns/io=" << (used * 1000.0 / ios);
+    PrintPerIo("cache_misses", miss_count, ios);
+    PrintPerIo("l1d_misses", l1d_count, ios);
+    std::cout << std::endl;
+}
+
+int main(int argc, char** argv)
+{
+    size_t max_threads = argc > 1 ? atoi(argv[1]) : 2;
+    int conns = argc > 2 ? atoi(argv[2]) : 4000;
+    int msgs = argc > 3 ? atoi(argv[3]) : 100;
+    struct rlimit limit;
+    if(getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max)
+    {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+    for(size_t t = 1; t <= max_threads; t++)
+    {
+        bench(t, conns, msgs, false);
+        bench(t, conns, msgs, true);
+    }
+    return 0;
+}
@@ -0,0 +1,91 @@
+#include "fiber.h"
+#include "scheduler.h"
+
+#include <iostream>
+#include <memory>
+#include <stdlib.h>
+#include <sys/time.h>
+
+static uint64_t GetCurrentUs()
+{
+    struct timeval t;
+    gettimeofday(&t, NULL);
+    return t.tv_sec * 1000000ul + t.tv_usec;
+}
+
+static uint64_t s_cycles = 1000000;
+static uint64_t s_ops = 0;
+
+static void yield_loop()
+{
+    uint64_t ops = Global::RefCountOps();
+    for(uint64_t i = 0; i < s_cycles; i++)
+    {
+        Global::Fiber::YieldToReady();
+    }
+    s_ops = Global::RefCountOps() - ops;
+}
+
+// YieldToReady -> run()重新入队 -> swapIn 的完整一轮
+static void bench_cycle()
+{
+    Global::Scheduler sc(1, true, "bench");
+    sc.start();
+    sc.schedule(&yield_loop);
+    uint64_t begin = GetCurrentUs();
+    sc.stop();
+    uint64_t used = GetCurrentUs() - begin;
+    std::cout << "[bench] yield/resume cycle: " << (used * 1000.0 / s_cycles) << " ns/cycle, "
+              << ((double)s_ops / s_cycles) << " refcount atomics/cycle" << std::endl;
+}
+
+struct SharedFiber : public std::enable_shared_from_this<SharedFiber> { };
+
+// 获取当前协程句柄的三种方式
+static void bench_get_this()
+{
+    std::shared_ptr<SharedFiber> shared(new SharedFiber);
+    SharedFiber* raw = shared.get();
+    uint64_t begin = GetCurrentUs();
+    for(uint64_t i = 0; i < s_cycles; i++)
+    {
+        std::shared_ptr<SharedFiber> p = raw->shared_from_this();
+        asm volatile("" : : "r"(p.get()) : "memory");
+    }
+    uint64_t used = GetCurrentUs() - begin;
+    std::cout << "[bench] shared_from_this: " << (used * 1000.0 / s_cycles) << " ns/call" << std::endl;
+
+    Global::Fiber::GetCurrent();
+    uint64_t ops = Global::RefCountOps();
+    begin = GetCurrentUs();
+    for(uint64_t i = 0; i < s_cycles; i++)
+    {
+        Global::Fiber::ptr p = Global::Fiber::GetThis();
+        asm volatile("" : : "r"(p.get()) : "memory");
+    }
+    used = GetCurrentUs() - begin;
+    std::cout << "[bench] Fiber::GetThis: " << (used * 1000.0 / s_cycles) << " ns/call, "
+              << ((double)(Global::RefCountOps() - ops) / s_cycles) << " atomics/call" << std::endl;
+
+    ops = Global::RefCountOps();
+    begin = GetCurrentUs();
+    for(uint64_t i = 0; i < s_cycles; i++)
+    {
+        Global::Fiber* p = Global::Fiber::GetCurrent();
+        asm volatile("" : : "r"(p) : "memory");
+    }
+    used = GetCurrentUs() - begin;
+    std::cout << "[bench] Fiber::GetCurrent: " << (used * 1000.0 / s_cycles) << " ns/call, "
+              << ((double)(Global::RefCountOps() - ops) / s_cycles) << " atomics/call" << std::endl;
+}
+
+int main(int argc, char** argv)
+{
+    if(argc > 1)
+    {
+        s_cycles = atoll(argv[1]);
+    }
+    bench_get_this();
+    bench_cycle();
+    return 0;
+}
@@ -0,0 +1,86 @@
+#include "fiber.h"
+#include "scheduler.h"
+
+#include <iostream>
+#include <vector>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+static bool s_running = true;
+
+static uint64_t GetCurrentUs()
+{
+    struct timeval t;
+    gettimeofday(&t, NULL);
+    return t.tv_sec * 1000000ul + t.tv_usec;
+}
+
+static long GetRssKB()
+{
+    long pages = 0, resident = 0;
+    FILE* fp = fopen("/proc/self/statm", "r");
+    if(!fp) return 0;
+    if(fscanf(fp, "%ld %ld", &pages, &resident) != 2) resident = 0;
+    fclose(fp);
+    return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+// 模拟空闲连接: 栈上有一块读缓冲区, 之后一直挂起
+static void idle_connection()
+{
+    char buf[2048];
+    memset(buf, 0, sizeof(buf));
+    while(s_running)
+    {
+        Global::Fiber::YieldToReady();
+        buf[0]++;
+    }
+}
+
+static void bench(const char* name, size_t count, bool shared_stack, int rounds)
+{
+    s_running = true;
+    std::vector<Global::Fiber::ptr> fibers;
+    fibers.reserve(count);
+    long rss_begin = GetRssKB();
+    for(size_t i = 0; i < count; i++)
+    {
+        fibers.emplace_back(new Global::Fiber(&idle_connection, 0, false, shared_stack));
+        fibers.back()->swapIn();
+    }
+    long rss_used = GetRssKB() - rss_begin;
+
+    uint64_t begin = GetCurrentUs();
+    for(int r = 0; r < rounds; r++)
+    {
+        for(auto& i : fibers)
+        {
+            i->swapIn();
+        }
+    }
+    uint64_t used = GetCurrentUs() - begin;
+
+    s_running = false;
+    for(auto& i : fibers)
+    {
+        i->swapIn();
+    }
+    std::cout << "[bench] " << name << ": fibers=" << count
+              << " rss=" << rss_used << "KB"
+              << " per_fiber=" << (rss_used * 1024.0 / count) << "B"
+              << " swapIn+swapOut=" << (used * 1000.0 / (count * rounds)) << "ns"
+              << std::endl;
+}
+
+int main(int argc, char** argv)
+{
+    size_t count = argc > 1 ? atoi(argv[1]) : 10000;
+    int rounds = argc > 2 ? atoi(argv[2]) : 20;
+    Global::Scheduler sc(1, true, "bench");
+    bench("private stack", count, false, rounds);
+    bench("shared stack", count, true, rounds);
+    return 0;
+}
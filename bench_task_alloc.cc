@@ -0,0 +1,110 @@
+#include "fiber.h"
+#include "scheduler.h"
+#include "task.h"
+
+#include <atomic>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <stdlib.h>
+#include <sys/time.h>
+
+// 统计全局operator new次数
+static std::atomic<uint64_t> s_allocs{0};
+
+void* operator new(size_t size)
+{
+    ++s_allocs;
+    void* p = malloc(size ? size : 1);
+    if(!p) throw std::bad_alloc();
+    return p;
+}
+
+void operator delete(void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+
+static uint64_t GetCurrentUs()
+{
+    struct timeval t;
+    gettimeofday(&t, NULL);
+    return t.tv_sec * 1000000ul + t.tv_usec;
+}
+
+static uint64_t s_count = 1000000;
+static uint64_t s_sum = 0;
+
+// 与hook中do_io超时回调相同的捕获: fd + 管理器指针 + weak_ptr + 协程句柄
+template<class Func>
+static void bench_construct(const char* name)
+{
+    std::shared_ptr<int> cond(new int(0));
+    std::weak_ptr<int> weak(cond);
+    Global::Fiber::ptr fiber;
+    int fd = 3;
+    void* manager = &s_sum;
+    uint64_t allocs = s_allocs;
+    uint64_t begin = GetCurrentUs();
+    for(uint64_t i = 0; i < s_count; i++)
+    {
+        Func f([fd, manager, weak, fiber](){
+            s_sum += fd + (manager ? 1 : 0) + (weak.expired() ? 0 : 1) + (fiber ? 1 : 0);
+        });
+        Func g(std::move(f));
+        g();
+    }
+    uint64_t used = GetCurrentUs() - begin;
+    std::cout << "[bench] " << name << ": " << (used * 1000.0 / s_count) << " ns/task, "
+              << ((double)(s_allocs - allocs) / s_count) << " allocs/task" << std::endl;
+}
+
+static void noop() { ++s_sum; }
+
+// 经过调度队列执行的完整路径: schedule -> 协程池取协程 -> 执行
+static void bench_schedule()
+{
+    Global::Scheduler sc(1, true, "bench");
+    sc.start();
+    uint64_t batch = 1000;
+    uint64_t rounds = s_count / batch;
+    // 预热协程池和队列容量
+    for(uint64_t i = 0; i < batch; i++)
+    {
+        sc.schedule(&noop);
+    }
+    std::shared_ptr<int> cond(new int(0));
+    std::weak_ptr<int> weak(cond);
+    uint64_t allocs = s_allocs;
+    uint64_t begin = GetCurrentUs();
+    sc.schedule([&sc, batch, rounds, weak](){
+        Global::Scheduler* manager = &sc;
+        Global::Fiber::ptr fiber;
+        for(uint64_t r = 0; r < rounds; r++)
+        {
+            for(uint64_t i = 0; i < batch; i++)
+            {
+                int fd = (int)i;
+                sc.schedule([fd, manager, weak, fiber](){
+                    s_sum += fd + (manager ? 1 : 0) + (weak.expired() ? 0 : 1) + (fiber ? 1 : 0);
+                });
+            }
+            Global::Fiber::YieldToReady();
+        }
+    });
+    sc.stop();
+    uint64_t used = GetCurrentUs() - begin;
+    std::cout << "[bench] scheduled lambda: " << (used * 1000.0 / (rounds * batch)) << " ns/task, "
+              << ((double)(s_allocs - allocs) / (rounds * batch)) << " allocs/task" << std::endl;
+}
+
+int main(int argc, char** argv)
+{
+    if(argc > 1)
+    {
+        s_count = atoll(argv[1]);
+    }
+    bench_construct<std::function<void()> >("std::function");
+    bench_construct<Global::Task>("Global::Task");
+    bench_schedule();
+    return s_sum == 0;
+}
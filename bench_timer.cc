@@ -0,0 +1,134 @@
+#include "timer.h"
+#include "iomanager.h"
+#include "utils.h"
+
+#include <iostream>
+#include <memory>
+#include <stdlib.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#ifdef GLOBAL_TIMER_SET
+static const char* s_impl = "std::set";
+#else
+static const char* s_impl = "timing wheel";
+#endif
+
+static uint64_t GetCurrentUs()
+{
+    struct timeval t;
+    gettimeofday(&t, NULL);
+    return t.tv_sec * 1000000ul + t.tv_usec;
+}
+
+// 单线程使用, 调用线程拥有唯一的队列
+class BenchTimerManager : public Global::TimerManager
+{
+protected:
+    void onTimerInsertedAtFront(size_t queue) override { }
+    int getTimerQueue() override { return 0; }
+};
+
+static uint64_t s_fired = 0;
+
+// 与hook中do_io相同的用法: 每次阻塞等待加一个条件定时器, 事件到达后取消
+static void bench_add_cancel(size_t live, size_t ops)
+{
+    BenchTimerManager tm;
+    std::shared_ptr<int> cond(new int(0));
+    std::vector<Global::Timer::ptr> conns;
+    conns.reserve(live);
+    // 大量连接各自挂着1~60s的接收超时
+    for(size_t i = 0; i < live; i++)
+    {
+        conns.push_back(tm.addConditionTimer(1000 + rand() % 59000, [](){ ++s_fired; }, cond));
+    }
+    uint64_t begin = GetCurrentUs();
+    for(size_t i = 0; i < ops; i++)
+    {
+        Global::Timer::ptr timer = tm.addConditionTimer(5000 + i % 1000, [](){ ++s_fired; }, cond);
+        timer->cancel();
+    }
+    uint64_t used = GetCurrentUs() - begin;
+    std::cout << "[bench] " << s_impl << " add+cancel with " << live << " live timers: "
+              << (used * 1000.0 / ops) << " ns/op" << std::endl;
+    for(auto& i : conns)
+    {
+        i->cancel();
+    }
+}
+
+// 短超时全部到期的吞吐
+static void bench_expire(size_t count)
+{
+    BenchTimerManager tm;
+    std::shared_ptr<int> cond(new int(0));
+    s_fired = 0;
+    uint64_t begin = GetCurrentUs();
+    for(size_t i = 0; i < count; i++)
+    {
+        tm.addConditionTimer(i % 50, [](){ ++s_fired; }, cond);
+    }
+    std::vector<Global::Task> cbs;
+    while(tm.hasTimer())
+    {
+        tm.listExpiredCb(cbs);
+        for(auto& cb : cbs)
+        {
+            cb();
+        }
+        cbs.clear();
+        usleep(1000);
+    }
+    uint64_t used = GetCurrentUs() - begin;
+    std::cout << "[bench] " << s_impl << " insert+expire " << count << " timers: "
+              << (used / 1000) << " ms, fired=" << s_fired << std::endl;
+}
+
+// 多线程下每个协程反复加/取消超时定时器, 并穿插短定时器到期后恢复
+static void bench_threads(size_t threads, size_t ops)
+{
+    size_t fibers = threads * 8;
+    uint64_t begin = GetCurrentUs();
+    {
+        Global::IOManager iom(threads, false, "timer");
+        for(size_t f = 0; f < fibers; f++)
+        {
+            iom.schedule([&iom, ops](){
+                std::shared_ptr<int> cond(new int(0));
+                for(size_t i = 0; i < ops; i++)
+                {
+                    Global::Timer::ptr timer = iom.addConditionTimer(5000, [](){ }, cond);
+                    timer->cancel();
+                    if(i % 1000 == 0)
+                    {
+                        Global::Fiber::ptr fiber = Global::Fiber::GetThis();
+                        Global::IOManager* manager = &iom;
+                        iom.addConditionTimer(1, [manager, fiber](){
+                            manager->schedule(fiber);
+                        }, cond);
+                        Global::Fiber::YieldToHold();
+                    }
+                }
+            });
+        }
+    }
+    uint64_t used = GetCurrentUs() - begin;
+    std::cout << "[bench] " << s_impl << " threads=" << threads
+              << " add+cancel/s=" << (uint64_t)(fibers * ops * 1000000.0 / used) << std::endl;
+}
+
+int main(int argc, char** argv)
+{
+    size_t live = argc > 1 ? atoi(argv[1]) : 200000;
+    size_t ops = argc > 2 ? atoi(argv[2]) : 1000000;
+    srand(1);
+    bench_add_cancel(0, ops);
+    bench_add_cancel(live, ops);
+    bench_expire(live);
+    for(size_t threads = 1; threads <= 32; threads *= 2)
+    {
+        bench_threads(threads, 20000);
+    }
+    return 0;
+}
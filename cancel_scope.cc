@@ -0,0 +1,75 @@
+#include "cancel_scope.h"
+#include "fiber.h"
+#include "macro.h"
+
+namespace Global
+{
+
+CancelScope::~CancelScope()
+{
+    GLOBAL_ASSERT2(!m_head, "CancelScope destroyed with attached waits");
+}
+
+void CancelScope::cancel(int reason)
+{
+    MutexType::LockGuard lock(m_mutex);
+    if(isCancelled())
+    {
+        return;
+    }
+    m_reason.store(reason, std::memory_order_release);
+    // 被唤醒的等待者要先拿到锁才能移除登记, 遍历期间链表不会变化
+    for(Hook* hook = m_head; hook; hook = hook->next)
+    {
+        hook->cancel(hook);
+    }
+}
+
+bool CancelScope::attach(Hook* hook)
+{
+    MutexType::LockGuard lock(m_mutex);
+    if(isCancelled())
+    {
+        return false;
+    }
+    hook->prev = nullptr;
+    hook->next = m_head;
+    if(m_head)
+    {
+        m_head->prev = hook;
+    }
+    m_head = hook;
+    hook->linked = true;
+    return true;
+}
+
+void CancelScope::detach(Hook* hook)
+{
+    MutexType::LockGuard lock(m_mutex);
+    if(!hook->linked)
+    {
+        return;
+    }
+    if(hook->prev)
+    {
+        hook->prev->next = hook->next;
+    }
+    else
+    {
+        m_head = hook->next;
+    }
+    if(hook->next)
+    {
+        hook->next->prev = hook->prev;
+    }
+    hook->prev = hook->next = nullptr;
+    hook->linked = false;
+}
+
+CancelScope* CancelScope::GetThis()
+{
+    Fiber* fiber = Fiber::GetCurrent();
+    return fiber ? fiber->getCancelScope() : nullptr;
+}
+
+} // namespace Global
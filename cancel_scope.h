@@ -0,0 +1,69 @@
+#ifndef __CANCEL_SCOPE_H__
+#define __CANCEL_SCOPE_H__
+
+#include "mutex.h"
+#include "noncopyable.h"
+
+#include <errno.h>
+#include <atomic>
+#include <memory>
+
+namespace Global
+{
+
+/**
+ * @brief 取消域
+ * @details 正在等待的操作登记一个Hook, cancel()时逐个调用其cancel回调把等待者
+ *          唤醒; 已取消后登记会失败. hook的socket IO等待在协程所在的取消域中登记,
+ *          被取消时返回-1, errno为取消原因. 协程所在的取消域由TaskGroup设置
+ */
+class CancelScope : Noncopyable
+{
+public:
+    typedef std::shared_ptr<CancelScope> ptr;
+    typedef Mutex MutexType;
+
+    struct Hook
+    {
+        /// 持有取消域的锁时调用, 应该只做唤醒
+        void (*cancel)(Hook* hook) = nullptr;
+        Hook* prev = nullptr;
+        Hook* next = nullptr;
+        bool linked = false;
+    };
+
+    CancelScope() { }
+    ~CancelScope();
+
+    bool isCancelled() const { return getReason() != 0; }
+
+    /// 取消原因(errno), 未取消时为0
+    int getReason() const { return m_reason.load(std::memory_order_acquire); }
+
+    /**
+     * @brief 取消, 唤醒所有已登记的等待
+     * @param[in] reason 取消原因, 只有第一次取消生效
+     */
+    void cancel(int reason = ECANCELED);
+
+    /**
+     * @brief 登记一个等待
+     * @return 已取消时返回false, 不登记
+     */
+    bool attach(Hook* hook);
+
+    /// 移除登记, 未登记时什么也不做
+    void detach(Hook* hook);
+
+    /// 当前协程所在的取消域
+    static CancelScope* GetThis();
+
+private:
+    MutexType m_mutex;
+    std::atomic<int> m_reason{0};
+    Hook* m_head = nullptr;
+};
+
+} // namespace Global
+
+#endif
@@ -0,0 +1,185 @@
+#include "channel.h"
+#include "utils.h"
+
+#include <algorithm>
+
+namespace Global
+{
+
+ChannelBase::~ChannelBase()
+{
+    GLOBAL_ASSERT2(m_watchers.empty(), "Channel destroyed while selected");
+}
+
+void ChannelBase::close()
+{
+    if(m_closed.exchange(true, std::memory_order_seq_cst))
+    {
+        return;
+    }
+    // 等待者在队列锁内检查关闭状态后才入队, 这里加锁之后一定能看到所有等待者
+    FiberWaitQueue::MutexType::LockGuard lock(m_senders.mutex());
+    FiberWaitQueue::Waiter* senders = m_senders.popAll();
+    lock.unlock();
+    FiberWaitQueue::MutexType::LockGuard lock2(m_receivers.mutex());
+    FiberWaitQueue::Waiter* receivers = m_receivers.popAll();
+    lock2.unlock();
+    FiberWaitQueue::Wake(senders);
+    FiberWaitQueue::Wake(receivers);
+    notifyWatchers();
+}
+
+ChannelBase::Result ChannelBase::waitSlow(bool send, TryOp op, void* value, uint64_t timeout_us)
+{
+    FiberWaitQueue& queue = send ? m_senders : m_receivers;
+    std::atomic<uint32_t>& waiting = send ? m_sendWaiting : m_recvWaiting;
+    uint64_t deadline = timeout_us == FiberWaitQueue::NO_TIMEOUT
+                        ? FiberWaitQueue::NO_TIMEOUT : GetMonotonicUs() + timeout_us;
+    FiberWaitQueue::MutexType::LockGuard lock(queue.mutex());
+    // 先登记再尝试, 对端发布之后看到等待数不为0就会加锁唤醒
+    waiting.fetch_add(1, std::memory_order_seq_cst);
+    Result rt;
+    while(true)
+    {
+        rt = op(this, value);
+        if(rt != WOULD_BLOCK)
+        {
+            break;
+        }
+        uint64_t timeout = FiberWaitQueue::NO_TIMEOUT;
+        if(deadline != FiberWaitQueue::NO_TIMEOUT)
+        {
+            uint64_t now = GetMonotonicUs();
+            if(now >= deadline)
+            {
+                rt = TIMEOUT;
+                break;
+            }
+            timeout = deadline - now;
+        }
+        queue.wait(lock, timeout);
+        lock.lock();
+    }
+    waiting.fetch_sub(1, std::memory_order_relaxed);
+    return rt;
+}
+
+void ChannelBase::wakeSlow(FiberWaitQueue& queue, std::atomic<uint32_t>& waiting)
+{
+    if(waiting.load(std::memory_order_relaxed))
+    {
+        FiberWaitQueue::MutexType::LockGuard lock(queue.mutex());
+        FiberWaitQueue::Waiter* waiter = queue.popOne();
+        lock.unlock();
+        FiberWaitQueue::Wake(waiter);
+    }
+    if(m_watcherCount.load(std::memory_order_relaxed))
+    {
+        notifyWatchers();
+    }
+}
+
+void ChannelBase::notifyWatchers()
+{
+    // 持锁通知, 监听者移除自己之前不会被销毁
+    Spinlock::LockGuard lock(m_watcherMutex);
+    for(auto watcher : m_watchers)
+    {
+        watcher->notify();
+    }
+}
+
+void ChannelBase::addWatcher(FiberSemaphore* watcher)
+{
+    Spinlock::LockGuard lock(m_watcherMutex);
+    m_watchers.push_back(watcher);
+    m_watcherCount.fetch_add(1, std::memory_order_seq_cst);
+}
+
+void ChannelBase::removeWatcher(FiberSemaphore* watcher)
+{
+    Spinlock::LockGuard lock(m_watcherMutex);
+    auto it = std::find(m_watchers.begin(), m_watchers.end(), watcher);
+    if(it != m_watchers.end())
+    {
+        m_watchers.erase(it);
+        m_watcherCount.fetch_sub(1, std::memory_order_relaxed);
+    }
+}
+
+int ChannelSelector::trySelect()
+{
+    GLOBAL_ASSERT2(!m_cases.empty(), "select without cases");
+    // 随机起点, 多个分支同时可完成时不总是偏向前面的
+    static thread_local uint32_t t_seed = GetThreadId();
+    t_seed = t_seed * 1103515245 + 12345;
+    size_t count = m_cases.size();
+    size_t start = (t_seed >> 16) % count;
+    for(size_t i = 0; i < count; i++)
+    {
+        size_t idx = (start + i) % count;
+        Case& c = m_cases[idx];
+        ChannelBase::Result rt = c.op(c.channel, c.value);
+        if(rt == ChannelBase::WOULD_BLOCK)
+        {
+            continue;
+        }
+        if(rt == ChannelBase::OK)
+        {
+            if(c.send)
+            {
+                c.channel->onSent();
+            }
+            else
+            {
+                c.channel->onReceived();
+            }
+        }
+        m_result = rt;
+        return idx;
+    }
+    return -1;
+}
+
+int ChannelSelector::selectImpl(uint64_t timeout_us)
+{
+    int idx = trySelect();
+    if(idx >= 0)
+    {
+        return idx;
+    }
+    uint64_t deadline = timeout_us == FiberWaitQueue::NO_TIMEOUT
+                        ? FiberWaitQueue::NO_TIMEOUT : GetMonotonicUs() + timeout_us;
+    // 任一通道收发或关闭时都会notify, 唤醒可能是虚假的, 重新尝试即可.
+    // 通道持有它的指针, 共享栈协程让出后栈会被其他协程覆盖, 所以放在堆上
+    std::unique_ptr<FiberSemaphore> signal(new FiberSemaphore);
+    for(auto& c : m_cases)
+    {
+        c.channel->addWatcher(signal.get());
+    }
+    while((idx = trySelect()) < 0)
+    {
+        if(deadline == FiberWaitQueue::NO_TIMEOUT)
+        {
+            signal->wait();
+            continue;
+        }
+        uint64_t now = GetMonotonicUs();
+        if(now >= deadline || !signal->waitForUs(deadline - now))
+        {
+            idx = trySelect();
+            break;
+        }
+    }
+    for(auto& c : m_cases)
+    {
+        c.channel->removeWatcher(signal.get());
+    }
+    if(idx < 0)
+    {
+        m_result = ChannelBase::TIMEOUT;
+    }
+    return idx;
+}
+
+} // namespace Global
@@ -0,0 +1,420 @@
+#ifndef __CHANNEL_H__
+#define __CHANNEL_H__
+
+#include "fiber_sync.h"
+#include "macro.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace Global
+{
+
+class ChannelSelector;
+
+/**
+ * @brief 通道中与元素类型无关的部分: 等待队列、关闭状态和select的监听者
+ * @details 收发双方各有一个FiberWaitQueue. 缓冲中的操作成功后只有对端计数不为0时
+ *          才进入等待队列唤醒, 未竞争时收发不加锁
+ */
+class ChannelBase : Noncopyable
+{
+public:
+    enum Result
+    {
+        /// 操作完成
+        OK = 0,
+        /// 非阻塞操作时缓冲已满(发送)或为空(接收)
+        WOULD_BLOCK = 1,
+        /// 超时
+        TIMEOUT = 2,
+        /// 通道已关闭: 发送总是失败, 接收在取完剩余元素之后失败
+        CLOSED = 3,
+    };
+
+    /**
+     * @brief 关闭通道, 唤醒所有等待的收发方和select
+     * @details 与关闭同时进行的发送可能仍然写入缓冲, 之后的接收可以取到
+     */
+    void close();
+
+    bool isClosed() const { return m_closed.load(std::memory_order_acquire); }
+
+protected:
+    /// 不加锁的一次尝试, 由Channel<T>实现
+    typedef Result (*TryOp)(void* channel, void* value);
+
+    ChannelBase() { }
+    ~ChannelBase();
+
+    /**
+     * @brief 在发送或接收队列上等待, 直到op成功、通道关闭或超时
+     * @details 先登记等待数再尝试, 与对端成功后先发布再检查等待数配对, 不会丢失唤醒
+     */
+    Result waitSlow(bool send, TryOp op, void* value, uint64_t timeout_us);
+
+    /// 写入一个元素之后调用, 唤醒一个接收方和所有select
+    void onSent()
+    {
+        // 元素的发布是普通store, 读等待数之前需要全屏障
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if(m_recvWaiting.load(std::memory_order_relaxed)
+            || m_watcherCount.load(std::memory_order_relaxed))
+        {
+            wakeSlow(m_receivers, m_recvWaiting);
+        }
+    }
+
+    /// 取出一个元素之后调用, 唤醒一个发送方和所有select
+    void onReceived()
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if(m_sendWaiting.load(std::memory_order_relaxed)
+            || m_watcherCount.load(std::memory_order_relaxed))
+        {
+            wakeSlow(m_senders, m_sendWaiting);
+        }
+    }
+
+private:
+    friend class ChannelSelector;
+
+    void wakeSlow(FiberWaitQueue& queue, std::atomic<uint32_t>& waiting);
+    void notifyWatchers();
+    void addWatcher(FiberSemaphore* watcher);
+    void removeWatcher(FiberSemaphore* watcher);
+
+private:
+    std::atomic<bool> m_closed{false};
+    std::atomic<uint32_t> m_sendWaiting{0};
+    std::atomic<uint32_t> m_recvWaiting{0};
+    std::atomic<uint32_t> m_watcherCount{0};
+    FiberWaitQueue m_senders;
+    FiberWaitQueue m_receivers;
+    Spinlock m_watcherMutex;
+    std::vector<FiberSemaphore*> m_watchers;
+};
+
+/**
+ * @brief 有界多生产者多消费者通道
+ * @details 缓冲是固定容量的无锁环形队列(每个槽位一个序号), 未竞争时发送或接收是
+ *          一次CAS加一次store. 缓冲满或空时在协程中让出, 由对端通过所属调度器的
+ *          schedule恢复; 在普通线程中调用时阻塞线程. 超时由IOManager的定时器触发.
+ *          不支持容量为0的同步通道
+ */
+template<class T>
+class Channel : public ChannelBase
+{
+public:
+    typedef std::shared_ptr<Channel> ptr;
+
+    explicit Channel(size_t capacity)
+        : m_capacity(capacity)
+        , m_cells(new Cell[capacity])
+    {
+        GLOBAL_ASSERT2(capacity > 0, "Channel capacity must be positive");
+        for(size_t i = 0; i < capacity; i++)
+        {
+            m_cells[i].seq.store(2 * i, std::memory_order_relaxed);
+        }
+    }
+
+    ~Channel()
+    {
+        uint64_t tail = m_tail.load(std::memory_order_relaxed);
+        for(uint64_t pos = m_head.load(std::memory_order_relaxed); pos != tail; ++pos)
+        {
+            reinterpret_cast<T*>(&m_cells[pos % m_capacity].storage)->~T();
+        }
+        delete[] m_cells;
+    }
+
+    /**
+     * @brief 发送, 缓冲满时等待
+     * @return 通道已关闭返回false
+     */
+    bool send(const T& value) { return sendImpl(value, FiberWaitQueue::NO_TIMEOUT) == OK; }
+    bool send(T&& value) { return sendImpl(std::move(value), FiberWaitQueue::NO_TIMEOUT) == OK; }
+
+    /**
+     * @brief 不等待的发送
+     * @return OK, WOULD_BLOCK或CLOSED. 失败时value不会被移走
+     */
+    Result trySend(const T& value) { return trySendImpl(value); }
+    Result trySend(T&& value) { return trySendImpl(std::move(value)); }
+
+    /**
+     * @brief 最多等待ms毫秒的发送
+     * @return OK, TIMEOUT或CLOSED
+     */
+    Result sendFor(const T& value, uint64_t ms) { return sendImpl(value, ms * 1000); }
+    Result sendFor(T&& value, uint64_t ms) { return sendImpl(std::move(value), ms * 1000); }
+
+    /**
+     * @brief 接收, 缓冲空时等待
+     * @return 通道已关闭且缓冲为空返回false
+     */
+    bool recv(T& value) { return recvImpl(value, FiberWaitQueue::NO_TIMEOUT) == OK; }
+
+    /**
+     * @brief 不等待的接收
+     * @return OK, WOULD_BLOCK或CLOSED
+     */
+    Result tryRecv(T& value)
+    {
+        Result rt = TryRecv(this, &value);
+        if(rt == OK)
+        {
+            onReceived();
+        }
+        return rt;
+    }
+
+    /**
+     * @brief 最多等待ms毫秒的接收
+     * @return OK, TIMEOUT或CLOSED
+     */
+    Result recvFor(T& value, uint64_t ms) { return recvImpl(value, ms * 1000); }
+
+    size_t capacity() const { return m_capacity; }
+
+    /// 缓冲中的元素数, 并发时只是近似值
+    size_t size() const
+    {
+        uint64_t head = m_head.load(std::memory_order_relaxed);
+        uint64_t tail = m_tail.load(std::memory_order_relaxed);
+        return tail > head ? tail - head : 0;
+    }
+
+private:
+    friend class ChannelSelector;
+
+    struct Cell
+    {
+        /// 等于位置*2时可写入, 等于位置*2+1时可读取; 乘2使容量为1时两种状态也不会重合
+        std::atomic<uint64_t> seq;
+        typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+    };
+
+    template<class U>
+    bool push(U&& value)
+    {
+        uint64_t pos = m_tail.load(std::memory_order_relaxed);
+        Cell* cell;
+        while(true)
+        {
+            cell = &m_cells[pos % m_capacity];
+            uint64_t seq = cell->seq.load(std::memory_order_acquire);
+            int64_t diff = (int64_t)(seq - 2 * pos);
+            if(diff == 0)
+            {
+                if(m_tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    break;
+                }
+            }
+            else if(diff < 0)
+            {
+                // 已满, 或者上一轮的接收方还未取走
+                return false;
+            }
+            else
+            {
+                pos = m_tail.load(std::memory_order_relaxed);
+            }
+        }
+        new (&cell->storage) T(std::forward<U>(value));
+        cell->seq.store(2 * pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool pop(T& value)
+    {
+        uint64_t pos = m_head.load(std::memory_order_relaxed);
+        Cell* cell;
+        while(true)
+        {
+            cell = &m_cells[pos % m_capacity];
+            uint64_t seq = cell->seq.load(std::memory_order_acquire);
+            int64_t diff = (int64_t)(seq - (2 * pos + 1));
+            if(diff == 0)
+            {
+                if(m_head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    break;
+                }
+            }
+            else if(diff < 0)
+            {
+                return false;
+            }
+            else
+            {
+                pos = m_head.load(std::memory_order_relaxed);
+            }
+        }
+        T* slot = reinterpret_cast<T*>(&cell->storage);
+        value = std::move(*slot);
+        slot->~T();
+        cell->seq.store(2 * (pos + m_capacity), std::memory_order_release);
+        return true;
+    }
+
+    template<class U>
+    static Result TrySend(void* channel, void* value)
+    {
+        Channel* self = static_cast<Channel*>(channel);
+        if(self->isClosed())
+        {
+            return CLOSED;
+        }
+        return self->push(std::forward<U>(*static_cast<typename std::remove_reference<U>::type*>(value)))
+                ? OK : WOULD_BLOCK;
+    }
+
+    static Result TryRecv(void* channel, void* value)
+    {
+        Channel* self = static_cast<Channel*>(channel);
+        T& v = *static_cast<T*>(value);
+        if(self->pop(v))
+        {
+            return OK;
+        }
+        if(!self->isClosed())
+        {
+            return WOULD_BLOCK;
+        }
+        // 关闭之前写入的元素仍要取完
+        return self->pop(v) ? OK : CLOSED;
+    }
+
+    template<class U>
+    Result trySendImpl(U&& value)
+    {
+        Result rt = TrySend<U&&>(this, (void*)&value);
+        if(rt == OK)
+        {
+            onSent();
+        }
+        return rt;
+    }
+
+    template<class U>
+    Result sendImpl(U&& value, uint64_t timeout_us)
+    {
+        Result rt = TrySend<U&&>(this, (void*)&value);
+        if(rt == WOULD_BLOCK)
+        {
+            rt = waitSlow(true, &TrySend<U&&>, (void*)&value, timeout_us);
+        }
+        if(rt == OK)
+        {
+            onSent();
+        }
+        return rt;
+    }
+
+    Result recvImpl(T& value, uint64_t timeout_us)
+    {
+        Result rt = TryRecv(this, &value);
+        if(rt == WOULD_BLOCK)
+        {
+            rt = waitSlow(false, &TryRecv, &value, timeout_us);
+        }
+        if(rt == OK)
+        {
+            onReceived();
+        }
+        return rt;
+    }
+
+private:
+    const size_t m_capacity;
+    Cell* m_cells;
+    alignas(64) std::atomic<uint64_t> m_head{0};
+    alignas(64) std::atomic<uint64_t> m_tail{0};
+};
+
+/**
+ * @brief 在多个通道上等待第一个可完成的收发, 类似Go的select
+ * @details 先以随机起点依次尝试每个分支; 都不能完成时在所有通道上登记监听,
+ *          任一通道状态变化都会唤醒, 再重新尝试.
+ *          recv/send登记的变量在select返回之前必须有效
+ *
+ *     ChannelSelector sel;
+ *     sel.recv(*ch1, a);
+ *     sel.send(*ch2, b);
+ *     int idx = sel.selectFor(100);
+ */
+class ChannelSelector : Noncopyable
+{
+public:
+    /**
+     * @brief 添加接收分支
+     * @return 分支序号
+     */
+    template<class T>
+    size_t recv(Channel<T>& channel, T& value)
+    {
+        m_cases.push_back({&channel, &Channel<T>::TryRecv, &value, false});
+        return m_cases.size() - 1;
+    }
+
+    /**
+     * @brief 添加发送分支, 发送的是value的拷贝
+     * @return 分支序号
+     */
+    template<class T>
+    size_t send(Channel<T>& channel, const T& value)
+    {
+        m_cases.push_back({&channel, &Channel<T>::template TrySend<const T&>
+                        , const_cast<T*>(&value), true});
+        return m_cases.size() - 1;
+    }
+
+    /**
+     * @brief 等待直到某个分支完成
+     * @return 完成的分支序号
+     */
+    int select() { return selectImpl(FiberWaitQueue::NO_TIMEOUT); }
+
+    /**
+     * @brief 不等待
+     * @return 完成的分支序号, 没有可完成的返回-1
+     */
+    int trySelect();
+
+    /**
+     * @brief 最多等待ms毫秒
+     * @return 完成的分支序号, 超时返回-1
+     */
+    int selectFor(uint64_t ms) { return selectImpl(ms * 1000); }
+
+    /// 完成的分支的结果: OK, 或通道已关闭时的CLOSED
+    ChannelBase::Result getResult() const { return m_result; }
+
+private:
+    struct Case
+    {
+        ChannelBase* channel;
+        ChannelBase::TryOp op;
+        void* value;
+        bool send;
+    };
+
+    int selectImpl(uint64_t timeout_us);
+
+private:
+    std::vector<Case> m_cases;
+    ChannelBase::Result m_result = ChannelBase::WOULD_BLOCK;
+};
+
+} // namespace Global
+
+#endif
@@ -0,0 +1,143 @@
+#include "context.h"
+#include "macro.h"
+
+#include <stdint.h>
+
+namespace Global
+{
+
+void UContext::make(void* stack, size_t size, ContextFunc fn)
+{
+    if(getcontext(&m_ctx))
+    {
+        GLOBAL_ASSERT2(false, "getcontext");
+    }
+    m_ctx.uc_link = nullptr;
+    m_ctx.uc_stack.ss_sp = stack;
+    m_ctx.uc_stack.ss_size = size;
+    makecontext(&m_ctx, fn, 0);
+}
+
+void UContext::Swap(UContext* from, UContext* to)
+{
+    if(swapcontext(&from->m_ctx, &to->m_ctx))
+    {
+        perror("swapcontext");
+    }
+}
+
+void* UContext::sp() const
+{
+#if defined(__x86_64__)
+    return (void*)m_ctx.uc_mcontext.gregs[REG_RSP];
+#elif defined(__aarch64__)
+    return (void*)m_ctx.uc_mcontext.sp;
+#else
+    return nullptr;
+#endif
+}
+
+#if defined(__x86_64__)
+/**
+ * 栈布局(低地址 -> 高地址):
+ *   mxcsr/x87cw | r12 | r13 | r14 | r15 | rbx | rbp | 返回地址
+ */
+asm(R"(
+    .text
+    .globl global_context_swap
+    .type global_context_swap, @function
+    .align 16
+global_context_swap:
+    pushq %rbp
+    pushq %rbx
+    pushq %r15
+    pushq %r14
+    pushq %r13
+    pushq %r12
+    subq $8, %rsp
+    stmxcsr (%rsp)
+    fnstcw 4(%rsp)
+    movq %rsp, (%rdi)
+    movq %rsi, %rsp
+    ldmxcsr (%rsp)
+    fldcw 4(%rsp)
+    addq $8, %rsp
+    popq %r12
+    popq %r13
+    popq %r14
+    popq %r15
+    popq %rbx
+    popq %rbp
+    ret
+    .size global_context_swap, .-global_context_swap
+)");
+
+void AsmContext::make(void* stack, size_t size, ContextFunc fn)
+{
+    uintptr_t top = ((uintptr_t)stack + size) & ~(uintptr_t)15;
+    uint64_t* sp = (uint64_t*)(top - 72);
+    // ret之后 rsp = top - 8, 与call指令进入函数时的对齐一致
+    sp[0] = 0x1F80 | ((uint64_t)0x037F << 32);  // 默认mxcsr与x87控制字
+    for(int i = 1; i <= 6; i++)
+    {
+        sp[i] = 0;                              // r12 ~ rbp
+    }
+    sp[7] = (uint64_t)fn;
+    sp[8] = 0;
+    m_sp = sp;
+}
+
+#elif defined(__aarch64__)
+/**
+ * 栈布局(低地址 -> 高地址):
+ *   x19 ~ x28 | x29(fp) | x30(lr) | d8 ~ d15
+ */
+asm(R"(
+    .text
+    .globl global_context_swap
+    .type global_context_swap, %function
+    .align 4
+global_context_swap:
+    sub sp, sp, #160
+    stp x19, x20, [sp, #0]
+    stp x21, x22, [sp, #16]
+    stp x23, x24, [sp, #32]
+    stp x25, x26, [sp, #48]
+    stp x27, x28, [sp, #64]
+    stp x29, x30, [sp, #80]
+    stp d8,  d9,  [sp, #96]
+    stp d10, d11, [sp, #112]
+    stp d12, d13, [sp, #128]
+    stp d14, d15, [sp, #144]
+    mov x9, sp
+    str x9, [x0]
+    mov sp, x1
+    ldp x19, x20, [sp, #0]
+    ldp x21, x22, [sp, #16]
+    ldp x23, x24, [sp, #32]
+    ldp x25, x26, [sp, #48]
+    ldp x27, x28, [sp, #64]
+    ldp x29, x30, [sp, #80]
+    ldp d8,  d9,  [sp, #96]
+    ldp d10, d11, [sp, #112]
+    ldp d12, d13, [sp, #128]
+    ldp d14, d15, [sp, #144]
+    add sp, sp, #160
+    ret
+    .size global_context_swap, .-global_context_swap
+)");
+
+void AsmContext::make(void* stack, size_t size, ContextFunc fn)
+{
+    uintptr_t top = ((uintptr_t)stack + size) & ~(uintptr_t)15;
+    uint64_t* sp = (uint64_t*)(top - 160);
+    for(int i = 0; i < 20; i++)
+    {
+        sp[i] = 0;
+    }
+    sp[11] = (uint64_t)fn;                      // x30, ret跳转到入口函数
+    m_sp = sp;
+}
+#endif
+
+} // namespace Global
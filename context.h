@@ -0,0 +1,87 @@
+#ifndef __CONTEXT_H__
+#define __CONTEXT_H__
+
+#include <stddef.h>
+#include <ucontext.h>
+
+namespace Global
+{
+
+/**
+ * @brief 上下文入口函数, 不会返回
+ */
+typedef void (*ContextFunc)();
+
+/**
+ * @brief 基于glibc ucontext的上下文
+ * @attention swapcontext每次切换都会调用rt_sigprocmask系统调用
+ */
+class UContext
+{
+public:
+    /**
+     * @brief 在指定栈上构造上下文, 切入后执行fn
+     */
+    void make(void* stack, size_t size, ContextFunc fn);
+
+    /**
+     * @brief 保存当前上下文到from, 切换到to
+     */
+    static void Swap(UContext* from, UContext* to);
+
+    /**
+     * @brief 切出时的栈顶, 平台不支持时返回nullptr
+     */
+    void* sp() const;
+
+private:
+    ucontext_t m_ctx;
+};
+
+#if defined(__x86_64__) || defined(__aarch64__)
+#define GLOBAL_HAVE_ASM_CONTEXT 1
+
+extern "C" void global_context_swap(void** from_sp, void* to_sp);
+
+/**
+ * @brief 汇编实现的上下文, 只保存callee-saved寄存器, 不涉及系统调用
+ */
+class AsmContext
+{
+public:
+    /**
+     * @brief 在指定栈上构造上下文, 切入后执行fn
+     */
+    void make(void* stack, size_t size, ContextFunc fn);
+
+    /**
+     * @brief 保存当前上下文到from, 切换到to
+     */
+    static void Swap(AsmContext* from, AsmContext* to)
+    {
+        global_context_swap(&from->m_sp, to->m_sp);
+    }
+
+    /**
+     * @brief 切出时的栈顶, 寄存器保存在其上方
+     */
+    void* sp() const { return m_sp; }
+
+private:
+    /// 切出时的栈顶, 寄存器保存在栈上
+    void* m_sp = nullptr;
+};
+#endif
+
+/// 编译期选择协程上下文实现, 定义GLOBAL_FIBER_UCONTEXT强制使用ucontext
+#if defined(GLOBAL_HAVE_ASM_CONTEXT) && !defined(GLOBAL_FIBER_UCONTEXT)
+typedef AsmContext FiberContext;
+#define GLOBAL_FIBER_CONTEXT_NAME "asm"
+#else
+typedef UContext FiberContext;
+#define GLOBAL_FIBER_CONTEXT_NAME "ucontext"
+#endif
+
+} // namespace Global
+
+#endif
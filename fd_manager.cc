@@ -15,6 +15,7 @@ FdCtx::FdCtx(int fd)
     , m_isSocket(false)
     , m_sysNonblock(false)
     , m_userNonblock(false)
+    , m_isClose(false)
     , m_recvTimeout(-1)
     , m_sendTimeout(-1)
 {
@@ -57,10 +58,18 @@ bool FdCtx::init()
     else m_sysNonblock = false;
 
     m_userNonblock = false;
-    m_isClose = false;
+    m_isClose.store(false, std::memory_order_release);
     return m_isInit;
 }
 
+bool FdCtx::reopen()
+{
+    m_isInit = false;
+    // fd关闭时内核已将其移出epoll
+    m_owner = 0;
+    return init();
+}
+
 void FdCtx::setTimeout(int type, uint64_t val)
 {
     if(type == SO_RCVTIMEO)
@@ -84,41 +93,38 @@ uint64_t FdCtx::getTimeout(int type)
     }
 }
 
-FdManager::FdManager()
+FdCtx::IoWait& FdCtx::getWait(int type)
 {
-    m_pfds.resize(64);
+    return type == SO_RCVTIMEO ? m_recvWait : m_sendWait;
 }
 
-FdCtx::ptr FdManager::get(int fd, bool auto_create)
+FdCtx* FdManager::get(int fd, bool auto_create)
 {
-    RWMutexType::ReadLock Lock(m_mutex);
-    if(fd >= m_pfds.size())
+    FdCtx* ctx = m_fds.get(fd);
+    if(ctx && !ctx->isClose())
     {
-        if(auto_create) return nullptr;
+        return ctx;
     }
-    else
+    if(!auto_create)
     {
-        if(m_pfds[fd] || !auto_create)
-        {
-            return m_pfds[fd];
-        }
+        return nullptr;
     }
-    Lock.unlock();
-    RWMutexType::WriteLock Lock1(m_mutex);
-    FdCtx::ptr ctx(new FdCtx(fd));
-    if(fd >= (int)m_pfds.size())
+    MutexType::LockGuard lock(m_mutex);
+    ctx = m_fds.getOrCreate(fd, [fd](){ return new FdCtx(fd); });
+    if(ctx && ctx->isClose())
     {
-        m_pfds.resize(fd*1.5);
+        ctx->reopen();
     }
-    m_pfds[fd] = ctx;
     return ctx;
 }
 
 void FdManager::del(int fd)
 {
-    RWMutexType::WriteLock Lock(m_mutex);
-    if(fd >= (int)m_pfds.size()) return;
-    m_pfds[fd].reset();
+    FdCtx* ctx = m_fds.get(fd);
+    if(ctx)
+    {
+        ctx->markClose();
+    }
 }
 
 } // namespace Global
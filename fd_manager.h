@@ -3,6 +3,9 @@
 
 #include "thread.h"
 #include "singleton.h"
+#include "fiber.h"
+#include "timer.h"
+#include "fd_table.h"
 
 #include <memory>
 #include <vector>
@@ -10,51 +13,121 @@
 namespace Global
 {
 
-class FdCtx : public std::enable_shared_from_this<FdCtx>
+class Scheduler;
+class IOManager;
+
+/**
+ * @brief 一个fd的全部状态: hook的非阻塞标记和超时, IOManager注册的事件和等待者
+ * @details 由FdManager创建并持有到进程退出, 同一个fd号关闭后再打开时原地重新初始化,
+ *          因此指针可以长期保存, 不需要引用计数. 一次hook调用只查找一次.
+ *          按访问频率排布: 第一个cache line是锁和事件状态, 第二个是等待者和超时,
+ *          只有设置了超时才用到的IoWait和很少用到的回调放在最后
+ */
+class alignas(64) FdCtx
 {
+friend class FdManager;
+friend class IOManager;
 public:
-    typedef std::shared_ptr<FdCtx> ptr;
+    typedef Mutex MutexType;
     FdCtx(int fd);
     ~FdCtx();
+
+    /**
+     * @brief 一个方向上阻塞等待的超时状态, 定时器在多次等待间复用
+     */
+    struct IoWait
+    {
+        Timer::ptr timer;
+        /// 在其他线程恢复后取消的定时器要等原队列移除, 这期间用备用的
+        Timer::ptr spare;
+        /// 每次等待递增, 用来识别上一次等待遗留的超时回调
+        std::atomic<uint64_t> seq = {0};
+        /// 发生超时的那次等待的seq
+        std::atomic<uint64_t> timedOut = {0};
+    };
     
+    int getFd() const { return m_fd; }
     bool isInit() const { return m_isInit; }
     bool isSocket() const { return m_isSocket; }
-    bool isClose() const { return m_isClose; }
+    bool isClose() const { return m_isClose.load(std::memory_order_acquire); }
     void setUserNonblock(bool val) { m_userNonblock = val; }
     bool getUserNonblock() const { return m_userNonblock; }
     bool getSysNonblock() const { return m_sysNonblock; }
     void setSysrNonblock(bool val) { m_sysNonblock = val; }
     void setTimeout(int type, uint64_t v);
     uint64_t getTimeout(int type);
+    /// @param[in] type SO_RCVTIMEO或SO_SNDTIMEO
+    IoWait& getWait(int type);
 
 private:
     bool init();
+    /// fd号被重新使用时恢复为初始状态
+    bool reopen();
+    void markClose() { m_isClose.store(true, std::memory_order_release); }
+
+    /// 一个方向上的等待者
+    struct EventContext
+    {
+        Scheduler* scheduler = nullptr;     // 所在调度器
+        Fiber::ptr fiber;                   // 所在协程
+    };
+
 private:
+    // ---- cache line 0: IOManager的锁和事件状态 ----
+    /// 保护IOManager使用的字段
+    MutexType m_mutex;
     int  m_fd;  
+    /// 已注册的IOManager::Event
+    int m_events = 0;
+    /// 持久注册模式下锁存的就绪状态
+    int m_ready = 0;
+    /// 分片模式下所属的工作线程下标
+    int m_reactor = -1;
     bool m_isInit: 1;
     bool m_isSocket: 1;
     bool m_sysNonblock: 1;
     bool m_userNonblock: 1;
-    bool m_isClose: 1;
+    /// 持久注册模式下是否已加入m_owner的epoll
+    bool m_registered = false;
+    std::atomic<bool> m_isClose;
+
+    // ---- cache line 1: 等待者和超时 ----
+    alignas(64) EventContext m_read;
+    EventContext m_write;
     /// 读超时时间毫秒
     uint64_t m_recvTimeout;
     /// 写超时时间毫秒
     uint64_t m_sendTimeout;
+    /// 最近注册事件的IOManager编号, 更换时丢弃旧的注册状态.
+    /// 不用指针, 避免新实例恰好分配在旧实例的地址上
+    uint64_t m_owner = 0;
 
+    // ---- 冷数据 ----
+    alignas(64) IoWait m_recvWait;
+    IoWait m_sendWait;
+    /// addEvent传入回调时使用
+    Task m_readCb;
+    Task m_writeCb;
 };  
 
 
 class FdManager 
 {
 public:
-    typedef RWMutex RWMutexType;
-    FdManager();
-    FdCtx::ptr get(int fd, bool auto_create = false);
+    typedef Mutex MutexType;
+    /**
+     * @brief 查找fd状态, 已存在时不加锁
+     * @param[in] auto_create 不存在或已关闭时是否创建
+     * @return 不存在, 已关闭或fd越界时返回nullptr
+     */
+    FdCtx* get(int fd, bool auto_create = false);
+    /// 标记为已关闭, 对象保留给之后相同的fd号
     void del(int fd);
 
 private:
-    RWMutexType m_mutex;
-    std::vector<FdCtx::ptr> m_pfds;
+    /// 只在创建和重新初始化时加锁
+    MutexType m_mutex;
+    FdTable<FdCtx> m_fds;
 };
 
 typedef Singleton<FdManager> FdMgr;
@@ -0,0 +1,129 @@
+#ifndef __FD_TABLE_H__
+#define __FD_TABLE_H__
+
+#include "noncopyable.h"
+
+#include <atomic>
+#include <stddef.h>
+
+namespace Global
+{
+
+/**
+ * @brief 按fd索引的两级分块数组
+ * @details 第一级是固定长度的块指针数组, 第二级每块CHUNK_SIZE个槽位.
+ *          块和元素一旦放入就不再移动或释放(直到表析构), 查找只有两次原子读, 无等待;
+ *          扩容只分配新块, 不影响正在进行的查找. 并发创建同一位置时用CAS决出唯一结果
+ */
+template<class T>
+class FdTable : Noncopyable
+{
+public:
+    static const int CHUNK_BITS = 10;
+    static const size_t CHUNK_SIZE = 1 << CHUNK_BITS;
+    static const size_t CHUNK_MASK = CHUNK_SIZE - 1;
+    /// 共支持CHUNK_COUNT * CHUNK_SIZE(4M)个fd
+    static const size_t CHUNK_COUNT = 4096;
+
+    FdTable()
+    {
+        for(size_t i = 0; i < CHUNK_COUNT; i++)
+        {
+            m_chunks[i].store(nullptr, std::memory_order_relaxed);
+        }
+    }
+
+    ~FdTable()
+    {
+        for(size_t i = 0; i < CHUNK_COUNT; i++)
+        {
+            Chunk* chunk = m_chunks[i].load(std::memory_order_relaxed);
+            if(!chunk)
+            {
+                continue;
+            }
+            for(size_t j = 0; j < CHUNK_SIZE; j++)
+            {
+                delete chunk->slots[j].load(std::memory_order_relaxed);
+            }
+            delete chunk;
+        }
+    }
+
+    /**
+     * @brief 无等待查找
+     * @return fd越界或尚未创建时返回nullptr
+     */
+    T* get(int fd) const
+    {
+        if(fd < 0 || (size_t)fd >= CHUNK_COUNT * CHUNK_SIZE)
+        {
+            return nullptr;
+        }
+        Chunk* chunk = m_chunks[fd >> CHUNK_BITS].load(std::memory_order_acquire);
+        if(!chunk)
+        {
+            return nullptr;
+        }
+        return chunk->slots[fd & CHUNK_MASK].load(std::memory_order_acquire);
+    }
+
+    /**
+     * @brief 查找, 不存在时用create()创建
+     * @details 多个线程同时创建时只保留先放入的一个, 其余的被释放
+     * @return fd越界时返回nullptr
+     */
+    template<class Create>
+    T* getOrCreate(int fd, Create create)
+    {
+        T* value = get(fd);
+        if(value || fd < 0 || (size_t)fd >= CHUNK_COUNT * CHUNK_SIZE)
+        {
+            return value;
+        }
+        std::atomic<Chunk*>& slot = m_chunks[fd >> CHUNK_BITS];
+        Chunk* chunk = slot.load(std::memory_order_acquire);
+        if(!chunk)
+        {
+            Chunk* fresh = new Chunk;
+            if(slot.compare_exchange_strong(chunk, fresh
+                        , std::memory_order_acq_rel, std::memory_order_acquire))
+            {
+                chunk = fresh;
+            }
+            else
+            {
+                delete fresh;
+            }
+        }
+        std::atomic<T*>& entry = chunk->slots[fd & CHUNK_MASK];
+        T* fresh = create();
+        value = nullptr;
+        if(entry.compare_exchange_strong(value, fresh
+                    , std::memory_order_acq_rel, std::memory_order_acquire))
+        {
+            return fresh;
+        }
+        delete fresh;
+        return value;
+    }
+
+private:
+    struct Chunk
+    {
+        Chunk()
+        {
+            for(size_t i = 0; i < CHUNK_SIZE; i++)
+            {
+                slots[i].store(nullptr, std::memory_order_relaxed);
+            }
+        }
+        std::atomic<T*> slots[CHUNK_SIZE];
+    };
+
+    std::atomic<Chunk*> m_chunks[CHUNK_COUNT];
+};
+
+} // namespace Global
+
+#endif
@@ -1,68 +1,134 @@
 #include "scheduler.h"
 #include "fiber.h"
 #include "macro.h"
+#include "stack_allocator.h"
 #include <atomic>
+#include <vector>
 
 namespace Global
 {
+
+static Logger::ptr g_logger = GLOBAL_LOG_NAME("system");
+
 static std::atomic<uint64_t> s_fiber_id{0};
 static std::atomic<uint64_t> s_fiber_count{0};
 
 static thread_local Fiber* t_fiber = nullptr;
 static thread_local Fiber::ptr t_threadFiber = nullptr;
 
-class MallocStackAllocator {
-public:
-    static void* Alloc(size_t size) {
-        return malloc(size);
+using StackAllocator = PoolStackAllocator;
+
+static const uint32_t s_default_stack_size = 1024 * 1024;
+static std::atomic<size_t> s_shared_stack_count{4};
+static std::atomic<size_t> s_shared_stack_size{1024 * 1024};
+
+/**
+ * @brief 线程共享的运行栈, occupant为当前栈上内容的所有者
+ */
+struct SharedStack
+{
+    void* stack = nullptr;
+    size_t size = 0;
+    Fiber::ptr occupant;
+};
+
+struct SharedStackSet
+{
+    std::vector<SharedStack> stacks;
+    size_t next = 0;
+    int thread_id = -1;
+
+    ~SharedStackSet()
+    {
+        clear();
+    }
+
+    void clear()
+    {
+        for(auto& i : stacks)
+        {
+            i.occupant.reset();
+            if(i.stack)
+            {
+                StackAllocator::Dealloc(i.stack, i.size);
+            }
+        }
+        stacks.clear();
     }
 
-    static void Dealloc(void* vp, size_t size) {
-        return free(vp);
+    // 轮流分配运行栈
+    SharedStack* get()
+    {
+        if(stacks.empty())
+        {
+            thread_id = GetThreadId();
+            size_t count = s_shared_stack_count;
+            stacks.resize(count ? count : 1);
+            try
+            {
+                for(auto& i : stacks)
+                {
+                    i.size = s_shared_stack_size;
+                    i.stack = StackAllocator::Alloc(i.size);
+                }
+            }
+            catch(...)
+            {
+                // 分配失败时抛出std::bad_alloc, 不留下半初始化的栈
+                clear();
+                throw;
+            }
+        }
+        SharedStack* ss = &stacks[next];
+        next = (next + 1) % stacks.size();
+        return ss;
     }
 };
 
-using StackAllocator = MallocStackAllocator;
+static thread_local SharedStackSet t_shared_stacks;
 
 Fiber::Fiber()      // 主协程无任何参数
 {
     m_state = EXEC;
     SetThis(this);
-    if(getcontext(&m_ctx))
-    {
-        GLOBAL_ASSERT2(false, "getcontent");
-    }
     ++s_fiber_count;
-    std::cout << "Fiber id = " << m_id << std::endl;
+    GLOBAL_LOG_DEBUG(g_logger) << "Fiber id = " << m_id;
 }
 
-Fiber::Fiber(std::function<void()> cb, size_t stack_size, bool use_caller)       // 真正运行协程
+Fiber::Fiber(Task cb, size_t stack_size, bool use_caller, bool shared_stack)       // 真正运行协程
     : m_id(++s_fiber_id)
-    , m_cb(cb)
+    , m_cb(std::move(cb))
+    , m_shared(shared_stack)
 {
-    std::cout << "Fiber() id = " << m_id << std::endl;
-    ++s_fiber_count;
-    m_stacksize = stack_size ? stack_size : 1024 * 1024;
-    m_stack = StackAllocator::Alloc(m_stacksize);
-    if(getcontext(&m_ctx))
+    GLOBAL_LOG_DEBUG(g_logger) << "Fiber() id = " << m_id;
+    if(m_shared)
     {
-        perror("Fiber construct");
+        // 运行栈在第一次swapIn时绑定, 上下文随之构造
+        GLOBAL_ASSERT2(!use_caller, "shared stack fiber can not use caller");
+        ++s_fiber_count;
+        return;
     }
-    m_ctx.uc_link = nullptr;
-    m_ctx.uc_stack.ss_sp = m_stack;
-    m_ctx.uc_stack.ss_size = m_stacksize;
+    m_stacksize = stack_size ? stack_size : s_default_stack_size;
+    // 分配失败时抛出std::bad_alloc, 不会在空栈上构造上下文
+    m_stack = StackAllocator::Alloc(m_stacksize);
+    ++s_fiber_count;
 
     if(!use_caller) {
-        makecontext(&m_ctx, &Fiber::MainFunc, 0);
+        m_ctx.make(m_stack, m_stacksize, &Fiber::MainFunc);
     } else {
-        makecontext(&m_ctx, &Fiber::CallerMainFunc, 0);
+        m_ctx.make(m_stack, m_stacksize, &Fiber::CallerMainFunc);
     }
 }
 
 Fiber::~Fiber()
 {
     --s_fiber_count;
-    if(m_stack)
+    if(m_shared)
+    {
+        assert(m_state == TERM || m_state == INIT || m_state == EXCEPT);
+        free(m_saveBuf);
+    }
+    else if(m_stack)
     {
         assert(m_state == TERM || m_state == INIT || m_state == EXCEPT);
         StackAllocator::Dealloc(m_stack, m_stacksize);
@@ -76,63 +142,127 @@ Fiber::~Fiber()
             SetThis(nullptr);   // 销毁主协程
         }
     }
-    std::cout << "~Fiber() id = " << m_id << std::endl;
+    GLOBAL_LOG_DEBUG(g_logger) << "~Fiber() id = " << m_id;
 }
 
-void Fiber::reset(std::function<void()> cb)
+void Fiber::reset(Task cb)
 {
-    assert(m_stack);
+    assert(m_stack || m_shared);
     assert(m_state == TERM
         || m_state == INIT
         || m_state == EXCEPT);
 
-    m_cb = cb;
-    if(getcontext(&m_ctx))
+    m_cb = std::move(cb);
+    if(!m_shared)
     {
-        perror("Fiber construct");
+        m_ctx.make(m_stack, m_stacksize, &Fiber::MainFunc);
     }
-    m_ctx.uc_link = nullptr;
-    m_ctx.uc_stack.ss_sp = m_stack;
-    m_ctx.uc_stack.ss_size = m_stacksize;
+    m_state.store(INIT, std::memory_order_relaxed);
+}
 
-    makecontext(&m_ctx, &Fiber::MainFunc, 0);
-    m_state = INIT;
+void Fiber::attachStack()
+{
+    if(!m_runStack)
+    {
+        m_runStack = t_shared_stacks.get();
+        m_thread = t_shared_stacks.thread_id;
+        m_stack = m_runStack->stack;
+        m_stacksize = m_runStack->size;
+    }
+    GLOBAL_ASSERT2(m_thread == t_shared_stacks.thread_id
+                , "shared stack fiber resumed on another thread, bound=" << m_thread);
+    GLOBAL_ASSERT2(!t_fiber || !t_fiber->m_shared, "swapIn from a shared stack fiber");
+
+    if(m_runStack->occupant.get() != this)
+    {
+        Fiber::ptr& occupant = m_runStack->occupant;
+        if(occupant && occupant->m_state != TERM && occupant->m_state != EXCEPT)
+        {
+            occupant->saveStack();
+        }
+        if(m_state != INIT)
+        {
+            restoreStack();
+        }
+        occupant.reset(this);
+    }
+    if(m_state == INIT)
+    {
+        m_ctx.make(m_stack, m_stacksize, &Fiber::MainFunc);
+    }
+}
+
+void Fiber::saveStack()
+{
+    char* top = (char*)m_stack + m_stacksize;
+    char* sp = (char*)m_ctx.sp();
+    if(!sp)
+    {
+        sp = (char*)m_stack;    // 取不到栈顶时保存整个栈
+    }
+    size_t size = top - sp;
+    // 按实际使用量分配, 明显变小时收缩
+    if(size > m_saveCap || size < m_saveCap / 4)
+    {
+        free(m_saveBuf);
+        m_saveBuf = (char*)malloc(size);
+        m_saveCap = size;
+    }
+    memcpy(m_saveBuf, sp, size);
+    m_saveSize = size;
+}
+
+void Fiber::restoreStack()
+{
+    memcpy((char*)m_stack + m_stacksize - m_saveSize, m_saveBuf, m_saveSize);
+}
+
+uint32_t Fiber::GetDefaultStackSize()
+{
+    return s_default_stack_size;
+}
+
+void Fiber::SetSharedStack(size_t count, size_t size)
+{
+    s_shared_stack_count = count;
+    s_shared_stack_size = size;
 }
 
 void Fiber::back()
 {
     SetThis(t_threadFiber.get());
-    if(swapcontext(&m_ctx, &t_threadFiber->m_ctx)) {
-        perror("back");
-    }
+    FiberContext::Swap(&m_ctx, &t_threadFiber->m_ctx);
 }
 
 void Fiber::call()
 {
     SetThis(this);
     assert(m_state != EXEC);
-    m_state = EXEC;
-    if(swapcontext(&t_threadFiber->m_ctx, &m_ctx)){
-        perror("call");
-    }
+    m_state.store(EXEC, std::memory_order_relaxed);
+    FiberContext::Swap(&t_threadFiber->m_ctx, &m_ctx);
 }
 
 void Fiber::swapIn()
 {
+    if(m_shared)
+    {
+        attachStack();
+    }
     SetThis(this);
     assert(m_state != EXEC);
-    m_state = EXEC;
-    if(swapcontext(&Global::Scheduler::GetMainFiber()->m_ctx, &m_ctx)){
-        perror("swapIn");
+    m_state.store(EXEC, std::memory_order_relaxed);
+    FiberContext::Swap(&Global::Scheduler::GetMainFiber()->m_ctx, &m_ctx);
+    if(m_shared && (m_state == TERM || m_state == EXCEPT))
+    {
+        // 结束的协程不再需要保存, 释放运行栈的占用, 调用方仍持有引用
+        m_runStack->occupant.reset();
     }
 }
 
 void Fiber::swapOut()
 {
     SetThis(Scheduler::GetMainFiber());
-    if(swapcontext(&m_ctx, &Global::Scheduler::GetMainFiber()->m_ctx)){
-        perror("swapOut");
-    }
+    FiberContext::Swap(&m_ctx, &Global::Scheduler::GetMainFiber()->m_ctx);
 }
 
 void Fiber::SetThis(Fiber* f)
@@ -142,84 +272,93 @@ void Fiber::SetThis(Fiber* f)
 
 Fiber::ptr Fiber::GetThis()
 {
-    if(t_fiber) return t_fiber->shared_from_this();
+    return Fiber::ptr(GetCurrent());
+}
+
+uint64_t Fiber::GetFiberId()
+{
+    return t_fiber ? t_fiber->getId() : 0;
+}
+
+Fiber* Fiber::GetCurrent()
+{
+    if(GLOBAL_LIKELY(t_fiber)) return t_fiber;
 
     Fiber::ptr main_fiber(new Fiber);
     assert(main_fiber.get() == t_fiber);
     t_threadFiber = main_fiber;
-    return t_fiber->shared_from_this();
+    return t_fiber;
 }
 
 void Fiber::YieldToReady()
 {
-    Fiber::ptr cur = GetThis();
-    assert(cur->m_state == EXEC);
-    cur->m_state = READY;
+    Fiber* cur = GetCurrent();
+    // 切出前可能已被唤醒方置为READY
+    assert(cur->m_state == EXEC || cur->m_state == READY);
+    cur->m_state.store(READY, std::memory_order_relaxed);
     cur->swapOut();
 }
 
 void Fiber::YieldToHold()
 {
-    Fiber::ptr cur = GetThis();
-    assert(cur->m_state == EXEC);
+    Fiber* cur = GetCurrent();
+    assert(cur->m_state == EXEC || cur->m_state == READY);
     // cur->m_state = HOLD;
     cur->swapOut();
 }
 
 void Fiber::MainFunc()
 {
-    Fiber::ptr cur = GetThis();
+    Fiber* cur = GetCurrent();
     assert(cur);
     try
     {
         cur->m_cb();
         cur->m_cb = nullptr;
-        cur->m_state = TERM;
+        cur->m_state.store(TERM, std::memory_order_release);
     }
     catch(const std::exception& e)
     {
-        cur->m_state = EXCEPT;
-        std::cerr << e.what() << '\n';
+        cur->m_state.store(EXCEPT, std::memory_order_release);
+        GLOBAL_LOG_ERROR(g_logger) << "Fiber Except: " << e.what()
+            << " fiber_id=" << cur->getId();
     }
     catch(...)
     {
-        cur->m_state = EXCEPT;
-        std::cerr << "UNKNWO ERROR" << '\n';
+        cur->m_state.store(EXCEPT, std::memory_order_release);
+        GLOBAL_LOG_ERROR(g_logger) << "Fiber Except fiber_id=" << cur->getId();
     }
-    // 这里为了释放协程 使用raw pointer进行swapOut
-    auto raw = cur.get();
-    cur.reset();
-    raw->swapOut();
-    // 下面部分将不会执行到,同时swapOut之后我们的协程智能指针计数到0,直接析构协程及其他持有的栈内存等.
+    // 不持有引用, 切出后协程可以被调度器直接析构或回收
+    cur->swapOut();
+    // 下面部分将不会执行到
     printf("never reache\n");
     assert(false);
 }
 
 void Fiber::CallerMainFunc()
 {
-    Fiber::ptr cur = GetThis();
+    Fiber* cur = GetCurrent();
     assert(cur);
     try
     {
         cur->m_cb();
         cur->m_cb = nullptr;
-        cur->m_state = TERM;
+        cur->m_state.store(TERM, std::memory_order_release);
     }
     catch(const std::exception& e)
     {
-        cur->m_state = EXCEPT;
-        std::cerr << e.what() << '\n';
+        cur->m_state.store(EXCEPT, std::memory_order_release);
+        GLOBAL_LOG_ERROR(g_logger) << "Fiber Except: " << e.what()
+            << " fiber_id=" << cur->getId();
     }
     catch(...)
     {
-        cur->m_state = EXCEPT;
-        std::cerr << "UNKNWO ERROR" << '\n';
+        cur->m_state.store(EXCEPT, std::memory_order_release);
+        GLOBAL_LOG_ERROR(g_logger) << "Fiber Except fiber_id=" << cur->getId();
     }
-    // 这里为了释放协程 使用raw pointer进行swapOut
-    auto raw = cur.get();
-    cur.reset();
-    raw->back();
-    // 下面部分将不会执行到,同时swapOut之后我们的协程智能指针计数到0,直接析构协程及其他持有的栈内存等.
+    // 不持有引用, 切出后协程可以被调度器直接析构或回收
+    cur->back();
+    // 下面部分将不会执行到
     printf("never reache\n");
     assert(false);
 }
@@ -1,18 +1,25 @@
 #ifndef __FIBER_H__
 #define __FIBER_H__
 
+#include "context.h"
+#include "intrusive_ptr.h"
+#include "task.h"
+
+#include <atomic>
 #include <memory>
-#include <ucontext.h>
 #include <functional>
 
 namespace Global
 {
 
-class Fiber : public std::enable_shared_from_this<Fiber>
+struct SharedStack;
+class CancelScope;
+
+class Fiber : public RefCounted<Fiber>
 {
 friend class Scheduler;
 public:
-    typedef std::shared_ptr<Fiber> ptr;
+    typedef IntrusivePtr<Fiber> ptr;
     enum State
 	{
 		/// 初始化状态
@@ -36,7 +43,15 @@ private:
 	Fiber();
 
 public:
-	Fiber(std::function<void()> cb, size_t stackszie = 0, bool use_caller = false);
+	/**
+	* @brief 构造函数
+	* @param[in] cb 协程执行函数
+	* @param[in] stackszie 协程栈大小, 共享栈模式下忽略
+	* @param[in] use_caller 是否在MainFiber上调度
+	* @param[in] shared_stack 是否运行在线程共享栈上, 切出时只保存栈上的有效部分
+	*/
+	Fiber(Task cb, size_t stackszie = 0, bool use_caller = false
+		, bool shared_stack = false);
 	~Fiber();
 
 	/**
@@ -44,7 +59,7 @@ public:
 	* @pre getState() 为 INIT, TERM, EXCEPT
 	* @post getState() = INIT
 	*/
-	void reset(std::function<void()> cb);
+	void reset(Task cb);
 
 	/**
 	* @brief 将当前协程切换到运行状态
@@ -79,7 +94,29 @@ public:
 	/**
 	* @brief 返回协程状态
 	*/
-	State getState() const { return m_state; }
+	State getState() const { return m_state.load(std::memory_order_acquire); }
+
+	/**
+	* @brief 返回协程栈大小
+	*/
+	uint32_t getStackSize() const { return m_stacksize; }
+
+	/**
+	* @brief 是否运行在共享栈上
+	*/
+	bool isSharedStack() const { return m_shared; }
+
+	/**
+	* @brief 共享栈协程第一次运行后绑定的线程, 之后只能在该线程上恢复, 未绑定返回-1
+	*/
+	int getBoundThread() const { return m_thread; }
+
+	/**
+	* @brief 协程当前所在的取消域, 没有时返回nullptr
+	* @details 由TaskGroup在子任务执行期间设置, hook的IO等待据此响应取消
+	*/
+	CancelScope* getCancelScope() const { return m_cancelScope; }
+	void setCancelScope(CancelScope* scope) { m_cancelScope = scope; }
 public:
 
 	/**
@@ -93,6 +130,12 @@ public:
 	*/
 	static Fiber::ptr GetThis();
 
+	/**
+	* @brief 返回当前所在的协程裸指针, 不增加引用计数
+	* @attention 只在当前协程内使用, 需要跨越挂起持有时使用GetThis
+	*/
+	static Fiber* GetCurrent();
+
 	static void YieldToReady();
 
 	static void YieldToHold();
@@ -112,16 +155,58 @@ public:
 	* @brief 获取当前协程的id
 	*/
 	static uint64_t GetFiberId();
+
+	/**
+	* @brief 未指定栈大小时使用的默认值
+	*/
+	static uint32_t GetDefaultStackSize();
+
+	/**
+	* @brief 设置每个线程共享栈的数量和大小, 在线程第一次使用共享栈前生效
+	*/
+	static void SetSharedStack(size_t count, size_t size);
+private:
+	/**
+	* @brief 将共享栈协程装入运行栈, 必要时先保存原占用者
+	*/
+	void attachStack();
+
+	/**
+	* @brief 将切出时栈上的有效部分拷贝到保存缓冲区
+	*/
+	void saveStack();
+
+	/**
+	* @brief 将保存缓冲区拷贝回运行栈
+	*/
+	void restoreStack();
 private:
 	uint64_t m_id = 0;
 	uint32_t m_stacksize = 0;
-	State m_state = INIT;
+	/**
+	 * @brief 协程状态
+	 * @details 由执行它的线程写入; 唤醒方只会以CAS把EXEC/HOLD改为READY.
+	 *          切出后执行线程以release发布HOLD, 唤醒方acquire读到HOLD才把协程交给其他线程
+	 */
+	std::atomic<State> m_state{INIT};
 	/// 协程上下文
-	ucontext_t m_ctx;
+	FiberContext m_ctx;
 	// 协程运行栈指针
 	void* m_stack = nullptr;
 	/// 协程运行函数
-	std::function<void()> m_cb;
+	Task m_cb;
+	/// 是否运行在共享栈上
+	bool m_shared = false;
+	/// 共享栈协程绑定的线程
+	int m_thread = -1;
+	/// 共享栈协程所在的运行栈
+	SharedStack* m_runStack = nullptr;
+	/// 切出时保存的栈内容
+	char* m_saveBuf = nullptr;
+	size_t m_saveSize = 0;
+	size_t m_saveCap = 0;
+	/// 所在的取消域
+	CancelScope* m_cancelScope = nullptr;
 };
 
 };
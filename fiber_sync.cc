@@ -0,0 +1,456 @@
+#include "fiber_sync.h"
+#include "iomanager.h"
+#include "macro.h"
+#include "utils.h"
+
+namespace Global
+{
+
+/**
+ * @brief 一个等待者
+ * @details 不超时的等待放在等待方的栈上; 超时等待和共享栈协程的等待在堆上分配,
+ *          定时器回调只持有弱引用.
+ *          state由唤醒方和超时回调竞争修改, 只有一方能恢复等待者
+ */
+struct FiberWaitQueue::Waiter
+{
+    enum State
+    {
+        WAITING = 0,
+        NOTIFIED = 1,
+        TIMEOUT = 2,
+    };
+
+    /// 为空时在sem上阻塞线程
+    Scheduler* scheduler = nullptr;
+    Fiber::ptr fiber;
+    Semaphore sem;
+    std::atomic<int> state{WAITING};
+    /// 是否仍在队列中, 受队列锁保护
+    bool linked = false;
+    Waiter* prev = nullptr;
+    Waiter* next = nullptr;
+};
+
+/// 恢复等待者, 之后等待者可能随时返回并销毁, 不能再访问
+static void Resume(FiberWaitQueue::Waiter* waiter)
+{
+    Scheduler* scheduler = waiter->scheduler;
+    if(scheduler)
+    {
+        Fiber::ptr fiber = std::move(waiter->fiber);
+        scheduler->schedule(std::move(fiber));
+    }
+    else
+    {
+        waiter->sem.notify();
+    }
+}
+
+static void OnTimeout(FiberWaitQueue::Waiter* waiter)
+{
+    int expected = FiberWaitQueue::Waiter::WAITING;
+    if(waiter->state.compare_exchange_strong(expected, FiberWaitQueue::Waiter::TIMEOUT))
+    {
+        Resume(waiter);
+    }
+}
+
+FiberWaitQueue::~FiberWaitQueue()
+{
+    GLOBAL_ASSERT2(m_size == 0, "FiberWaitQueue destroyed with " << m_size << " waiters");
+}
+
+bool FiberWaitQueue::CanYield()
+{
+    return Scheduler::GetThis() && Fiber::GetFiberId() != 0
+        && Fiber::GetCurrent() != Scheduler::GetMainFiber();
+}
+
+void FiberWaitQueue::push(Waiter* waiter)
+{
+    waiter->linked = true;
+    waiter->next = nullptr;
+    waiter->prev = m_tail;
+    if(m_tail)
+    {
+        m_tail->next = waiter;
+    }
+    else
+    {
+        m_head = waiter;
+    }
+    m_tail = waiter;
+    ++m_size;
+}
+
+void FiberWaitQueue::unlink(Waiter* waiter)
+{
+    if(waiter->prev)
+    {
+        waiter->prev->next = waiter->next;
+    }
+    else
+    {
+        m_head = waiter->next;
+    }
+    if(waiter->next)
+    {
+        waiter->next->prev = waiter->prev;
+    }
+    else
+    {
+        m_tail = waiter->prev;
+    }
+    waiter->linked = false;
+    waiter->prev = waiter->next = nullptr;
+    --m_size;
+}
+
+FiberWaitQueue::Waiter* FiberWaitQueue::popOne()
+{
+    while(m_head)
+    {
+        Waiter* waiter = m_head;
+        unlink(waiter);
+        int expected = Waiter::WAITING;
+        if(waiter->state.compare_exchange_strong(expected, Waiter::NOTIFIED))
+        {
+            return waiter;
+        }
+        // 已超时, 由超时回调恢复
+    }
+    return nullptr;
+}
+
+FiberWaitQueue::Waiter* FiberWaitQueue::popAll()
+{
+    Waiter* list = nullptr;
+    Waiter* last = nullptr;
+    while(Waiter* waiter = popOne())
+    {
+        if(last)
+        {
+            last->next = waiter;
+        }
+        else
+        {
+            list = waiter;
+        }
+        last = waiter;
+    }
+    return list;
+}
+
+void FiberWaitQueue::Wake(Waiter* waiters)
+{
+    while(waiters)
+    {
+        Waiter* next = waiters->next;
+        Resume(waiters);
+        waiters = next;
+    }
+}
+
+bool FiberWaitQueue::wait(MutexType::LockGuard& lock, uint64_t timeout_us
+                        , void (*before_park)(void*), void* arg)
+{
+    Scheduler* scheduler = CanYield() ? Scheduler::GetThis() : nullptr;
+    IOManager* iom = nullptr;
+    if(scheduler && timeout_us != NO_TIMEOUT)
+    {
+        iom = IOManager::GetThis();
+        if(!iom)
+        {
+            // 没有定时器可用, 退化为阻塞线程的超时等待
+            scheduler = nullptr;
+        }
+    }
+
+    // 共享栈协程让出后栈上的内容被拷走, 原地址由同一共享栈上的其他协程使用,
+    // 这时唤醒方访问的等待者必须在堆上, 与超时等待一起走下面的路径
+    if(timeout_us == NO_TIMEOUT && !(scheduler && Fiber::GetCurrent()->isSharedStack()))
+    {
+        Waiter waiter;
+        waiter.scheduler = scheduler;
+        if(scheduler)
+        {
+            waiter.fiber = Fiber::GetThis();
+        }
+        push(&waiter);
+        lock.unlock();
+        if(before_park)
+        {
+            before_park(arg);
+        }
+        if(scheduler)
+        {
+            Fiber::YieldToHold();
+        }
+        else
+        {
+            waiter.sem.wait();
+        }
+        return true;
+    }
+
+    std::shared_ptr<Waiter> waiter = std::make_shared<Waiter>();
+    waiter->scheduler = scheduler;
+    if(scheduler)
+    {
+        waiter->fiber = Fiber::GetThis();
+    }
+    push(waiter.get());
+    lock.unlock();
+    if(before_park)
+    {
+        before_park(arg);
+    }
+    if(scheduler)
+    {
+        Timer::ptr timer;
+        if(timeout_us != NO_TIMEOUT)
+        {
+            std::weak_ptr<Waiter> weak_waiter(waiter);
+            timer = iom->addTimerUs(timeout_us, [weak_waiter](){
+                std::shared_ptr<Waiter> waiter = weak_waiter.lock();
+                if(waiter)
+                {
+                    OnTimeout(waiter.get());
+                }
+            });
+        }
+        Fiber::YieldToHold();
+        if(timer)
+        {
+            timer->cancel();
+        }
+    }
+    else if(!waiter->sem.waitFor((timeout_us + 999) / 1000))
+    {
+        int expected = Waiter::WAITING;
+        if(!waiter->state.compare_exchange_strong(expected, Waiter::TIMEOUT))
+        {
+            // 超时的同时被唤醒, 等待唤醒方的notify
+            waiter->sem.wait();
+        }
+    }
+    if(waiter->state.load() == Waiter::NOTIFIED)
+    {
+        return true;
+    }
+    lock.lock();
+    if(waiter->linked)
+    {
+        unlink(waiter.get());
+    }
+    lock.unlock();
+    return false;
+}
+
+bool FiberMutex::tryLockFor(uint64_t ms)
+{
+    return tryLock() || lockSlow(ms * 1000);
+}
+
+bool FiberMutex::lockSlow(uint64_t timeout_us)
+{
+    uint64_t deadline = timeout_us == FiberWaitQueue::NO_TIMEOUT
+                        ? FiberWaitQueue::NO_TIMEOUT : GetMonotonicUs() + timeout_us;
+    FiberWaitQueue::MutexType::LockGuard lock(m_waiters.mutex());
+    while(true)
+    {
+        // 标记有等待者; 在队列锁内交换, 解锁方看到2时一定能在队列中找到本等待者
+        if(m_state.exchange(2, std::memory_order_acquire) == 0)
+        {
+            return true;
+        }
+        uint64_t timeout = FiberWaitQueue::NO_TIMEOUT;
+        if(deadline != FiberWaitQueue::NO_TIMEOUT)
+        {
+            uint64_t now = GetMonotonicUs();
+            if(now >= deadline)
+            {
+                return false;
+            }
+            timeout = deadline - now;
+        }
+        m_waiters.wait(lock, timeout);
+        lock.lock();
+    }
+}
+
+void FiberMutex::unlockSlow()
+{
+    FiberWaitQueue::MutexType::LockGuard lock(m_waiters.mutex());
+    FiberWaitQueue::Waiter* waiter = m_waiters.popOne();
+    lock.unlock();
+    // 被唤醒者重新竞争锁
+    FiberWaitQueue::Wake(waiter);
+}
+
+bool FiberRWMutex::markWaiters(uint32_t state)
+{
+    return (state & WAITERS) || m_state.compare_exchange_strong(state, state | WAITERS
+                    , std::memory_order_relaxed, std::memory_order_relaxed);
+}
+
+void FiberRWMutex::rdlockSlow()
+{
+    FiberWaitQueue::MutexType::LockGuard lock(m_readers.mutex());
+    while(true)
+    {
+        uint32_t state = m_state.load(std::memory_order_relaxed);
+        if(!(state & WRITER) && m_writers.empty())
+        {
+            if(m_state.compare_exchange_weak(state, state + 1
+                    , std::memory_order_acquire, std::memory_order_relaxed))
+            {
+                return;
+            }
+            continue;
+        }
+        if(!markWaiters(state))
+        {
+            continue;
+        }
+        m_readers.wait(lock);
+        lock.lock();
+    }
+}
+
+void FiberRWMutex::wrlockSlow()
+{
+    FiberWaitQueue::MutexType::LockGuard lock(m_readers.mutex());
+    while(true)
+    {
+        uint32_t state = m_state.load(std::memory_order_relaxed);
+        if(!(state & (WRITER | READERS)))
+        {
+            if(m_state.compare_exchange_weak(state, state | WRITER
+                    , std::memory_order_acquire, std::memory_order_relaxed))
+            {
+                return;
+            }
+            continue;
+        }
+        if(!markWaiters(state))
+        {
+            continue;
+        }
+        m_writers.wait(lock);
+        lock.lock();
+    }
+}
+
+void FiberRWMutex::unlockSlow()
+{
+    FiberWaitQueue::MutexType::LockGuard lock(m_readers.mutex());
+    if(m_state.load(std::memory_order_relaxed) & (WRITER | READERS))
+    {
+        // 已被其他执行流取得, 它释放时会看到WAITERS
+        return;
+    }
+    FiberWaitQueue::Waiter* waiters = m_writers.popOne();
+    if(!waiters)
+    {
+        waiters = m_readers.popAll();
+    }
+    if(m_writers.empty() && m_readers.empty())
+    {
+        m_state.fetch_and(~WAITERS, std::memory_order_relaxed);
+    }
+    lock.unlock();
+    FiberWaitQueue::Wake(waiters);
+}
+
+bool FiberConditionVariable::waitImpl(void (*unlock)(void*), void* lock, uint64_t timeout_us)
+{
+    FiberWaitQueue::MutexType::LockGuard guard(m_waiters.mutex());
+    // 在释放用户的锁之前登记, 之后的notify一定能看到
+    ++m_waiterCount;
+    bool rt = m_waiters.wait(guard, timeout_us, unlock, lock);
+    --m_waiterCount;
+    return rt;
+}
+
+void FiberConditionVariable::notifyOne()
+{
+    if(m_waiterCount.load() == 0)
+    {
+        return;
+    }
+    FiberWaitQueue::MutexType::LockGuard lock(m_waiters.mutex());
+    FiberWaitQueue::Waiter* waiter = m_waiters.popOne();
+    lock.unlock();
+    FiberWaitQueue::Wake(waiter);
+}
+
+void FiberConditionVariable::notifyAll()
+{
+    if(m_waiterCount.load() == 0)
+    {
+        return;
+    }
+    FiberWaitQueue::MutexType::LockGuard lock(m_waiters.mutex());
+    FiberWaitQueue::Waiter* waiters = m_waiters.popAll();
+    lock.unlock();
+    FiberWaitQueue::Wake(waiters);
+}
+
+bool FiberSemaphore::waitFor(uint64_t ms)
+{
+    return waitForUs(ms * 1000);
+}
+
+bool FiberSemaphore::waitForUs(uint64_t us)
+{
+    return tryWait() || waitSlow(us);
+}
+
+bool FiberSemaphore::waitSlow(uint64_t timeout_us)
+{
+    uint64_t deadline = timeout_us == FiberWaitQueue::NO_TIMEOUT
+                        ? FiberWaitQueue::NO_TIMEOUT : GetMonotonicUs() + timeout_us;
+    FiberWaitQueue::MutexType::LockGuard lock(m_waiters.mutex());
+    // 先登记再检查计数, 与notify先加计数再检查等待者配对, 不会丢失唤醒
+    ++m_waiterCount;
+    bool rt = false;
+    while(true)
+    {
+        if(tryWait())
+        {
+            rt = true;
+            break;
+        }
+        uint64_t timeout = FiberWaitQueue::NO_TIMEOUT;
+        if(deadline != FiberWaitQueue::NO_TIMEOUT)
+        {
+            uint64_t now = GetMonotonicUs();
+            if(now >= deadline)
+            {
+                break;
+            }
+            timeout = deadline - now;
+        }
+        m_waiters.wait(lock, timeout);
+        lock.lock();
+    }
+    --m_waiterCount;
+    return rt;
+}
+
+void FiberSemaphore::notify()
+{
+    m_count.fetch_add(1);
+    if(m_waiterCount.load() == 0)
+    {
+        return;
+    }
+    FiberWaitQueue::MutexType::LockGuard lock(m_waiters.mutex());
+    FiberWaitQueue::Waiter* waiter = m_waiters.popOne();
+    lock.unlock();
+    FiberWaitQueue::Wake(waiter);
+}
+
+} // namespace Global
@@ -0,0 +1,295 @@
+#ifndef __FIBER_SYNC_H__
+#define __FIBER_SYNC_H__
+
+#include "mutex.h"
+#include "noncopyable.h"
+
+#include <stdint.h>
+#include <atomic>
+
+namespace Global
+{
+
+/**
+ * @brief 协程同步原语的等待队列
+ * @details 在调度器的协程中等待时用Fiber::YieldToHold让出, 唤醒方通过等待者所属
+ *          Scheduler的schedule恢复, 工作线程继续执行其他协程; 在普通线程(或调度器
+ *          之外的主协程)中等待时阻塞在线程信号量上. 超时由IOManager的定时器触发.
+ *          所有操作需持有mutex()
+ */
+class FiberWaitQueue : Noncopyable
+{
+public:
+    typedef Spinlock MutexType;
+    struct Waiter;
+
+    /// 不超时
+    static const uint64_t NO_TIMEOUT = ~0ull;
+
+    FiberWaitQueue() { }
+    ~FiberWaitQueue();
+
+    MutexType& mutex() { return m_mutex; }
+
+    /**
+     * @brief 加入队列并挂起当前执行流, 直到被唤醒或超时
+     * @param[in] lock 持有mutex()的锁, 入队后释放, 返回时不再持有
+     * @param[in] timeout_us 超时时间微秒
+     * @param[in] before_park 释放lock之后、挂起之前调用, 条件变量用来释放用户的锁
+     * @return 被唤醒返回true, 超时返回false
+     */
+    bool wait(MutexType::LockGuard& lock, uint64_t timeout_us = NO_TIMEOUT
+                , void (*before_park)(void*) = nullptr, void* arg = nullptr);
+
+    /**
+     * @brief 取出一个等待者, 跳过已超时的
+     * @return 没有等待者返回nullptr. 释放mutex()之后用Wake唤醒
+     */
+    Waiter* popOne();
+
+    /// 取出全部等待者, 以链表返回
+    Waiter* popAll();
+
+    /// 唤醒popOne/popAll取出的等待者, 调用时不应持有mutex()
+    static void Wake(Waiter* waiters);
+
+    bool empty() const { return m_size == 0; }
+    /// 队列中的等待者数, 可能包含已超时但尚未自行移出的
+    size_t size() const { return m_size; }
+
+    /// 当前执行流是否为调度器中的协程, 可以让出而不阻塞线程
+    static bool CanYield();
+
+private:
+    void push(Waiter* waiter);
+    void unlink(Waiter* waiter);
+
+private:
+    MutexType m_mutex;
+    Waiter* m_head = nullptr;
+    Waiter* m_tail = nullptr;
+    size_t m_size = 0;
+};
+
+/**
+ * @brief 协程互斥量
+ * @details 未竞争时加锁和解锁各一次原子操作. m_state: 0未加锁, 1已加锁,
+ *          2已加锁且可能有等待者; 只有解锁时看到2才进入等待队列唤醒
+ */
+class FiberMutex : Noncopyable
+{
+public:
+    typedef ScopedLockImpl<FiberMutex> LockGuard;
+
+    void lock()
+    {
+        uint32_t expected = 0;
+        if(!m_state.compare_exchange_strong(expected, 1
+                    , std::memory_order_acquire, std::memory_order_relaxed))
+        {
+            lockSlow(FiberWaitQueue::NO_TIMEOUT);
+        }
+    }
+
+    bool tryLock()
+    {
+        uint32_t expected = 0;
+        return m_state.compare_exchange_strong(expected, 1
+                    , std::memory_order_acquire, std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief 最多等待ms毫秒
+     * @return 是否加锁成功
+     */
+    bool tryLockFor(uint64_t ms);
+
+    void unlock()
+    {
+        if(m_state.exchange(0, std::memory_order_release) == 2)
+        {
+            unlockSlow();
+        }
+    }
+
+private:
+    bool lockSlow(uint64_t timeout_us);
+    void unlockSlow();
+
+private:
+    std::atomic<uint32_t> m_state{0};
+    FiberWaitQueue m_waiters;
+};
+
+/**
+ * @brief 协程读写锁, 写优先
+ * @details m_state低30位为读者数, WRITER表示写者持有, WAITERS表示有协程在等待.
+ *          未竞争时加锁和解锁各一次原子操作; 有写者等待时新的读者不再进入
+ */
+class FiberRWMutex : Noncopyable
+{
+public:
+    typedef ReadScopedLockImpl<FiberRWMutex> ReadLock;
+    typedef WriteScopedLockImpl<FiberRWMutex> WriteLock;
+
+    void rdlock()
+    {
+        uint32_t state = m_state.load(std::memory_order_relaxed);
+        if((state & (WRITER | WAITERS))
+            || !m_state.compare_exchange_strong(state, state + 1
+                    , std::memory_order_acquire, std::memory_order_relaxed))
+        {
+            rdlockSlow();
+        }
+    }
+
+    void wrlock()
+    {
+        uint32_t expected = 0;
+        if(!m_state.compare_exchange_strong(expected, WRITER
+                    , std::memory_order_acquire, std::memory_order_relaxed))
+        {
+            wrlockSlow();
+        }
+    }
+
+    void unlock()
+    {
+        uint32_t state = m_state.load(std::memory_order_relaxed);
+        if(state & WRITER)
+        {
+            state = m_state.fetch_and(~WRITER, std::memory_order_release);
+            if(state & WAITERS)
+            {
+                unlockSlow();
+            }
+        }
+        else
+        {
+            state = m_state.fetch_sub(1, std::memory_order_release);
+            if((state & READERS) == 1 && (state & WAITERS))
+            {
+                unlockSlow();
+            }
+        }
+    }
+
+private:
+    static const uint32_t WRITER = 1u << 31;
+    static const uint32_t WAITERS = 1u << 30;
+    static const uint32_t READERS = WAITERS - 1;
+
+    void rdlockSlow();
+    void wrlockSlow();
+    void unlockSlow();
+    /// 持有队列锁时标记有等待者, 失败(状态已变化)返回false
+    bool markWaiters(uint32_t state);
+
+private:
+    std::atomic<uint32_t> m_state{0};
+    /// 两个队列共用m_readers的锁
+    FiberWaitQueue m_readers;
+    FiberWaitQueue m_writers;
+};
+
+/**
+ * @brief 协程条件变量
+ * @details 可以配合FiberMutex、Mutex或它们的LockGuard使用.
+ *          没有等待者时notify只读取一次原子计数
+ */
+class FiberConditionVariable : Noncopyable
+{
+public:
+    /// 调用时持有lock, 返回时重新持有
+    template<class Lock>
+    void wait(Lock& lock)
+    {
+        waitImpl(&Unlock<Lock>, &lock, FiberWaitQueue::NO_TIMEOUT);
+        lock.lock();
+    }
+
+    /**
+     * @brief 最多等待ms毫秒
+     * @return 被唤醒返回true, 超时返回false
+     */
+    template<class Lock>
+    bool waitFor(Lock& lock, uint64_t ms)
+    {
+        bool rt = waitImpl(&Unlock<Lock>, &lock, ms * 1000);
+        lock.lock();
+        return rt;
+    }
+
+    void notifyOne();
+    void notifyAll();
+
+private:
+    template<class Lock>
+    static void Unlock(void* lock) { static_cast<Lock*>(lock)->unlock(); }
+
+    bool waitImpl(void (*unlock)(void*), void* lock, uint64_t timeout_us);
+
+private:
+    std::atomic<size_t> m_waiterCount{0};
+    FiberWaitQueue m_waiters;
+};
+
+/**
+ * @brief 协程信号量
+ * @details 计数为正时wait一次CAS; 没有等待者时notify一次原子加
+ */
+class FiberSemaphore : Noncopyable
+{
+public:
+    explicit FiberSemaphore(uint32_t count = 0)
+        : m_count(count)
+    {
+    }
+
+    void wait()
+    {
+        if(!tryWait())
+        {
+            waitSlow(FiberWaitQueue::NO_TIMEOUT);
+        }
+    }
+
+    bool tryWait()
+    {
+        int64_t count = m_count.load(std::memory_order_relaxed);
+        while(count > 0)
+        {
+            if(m_count.compare_exchange_weak(count, count - 1
+                        , std::memory_order_acquire, std::memory_order_relaxed))
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /**
+     * @brief 最多等待ms毫秒
+     * @return 是否取得计数
+     */
+    bool waitFor(uint64_t ms);
+
+    /// 同waitFor, 最多等待us微秒
+    bool waitForUs(uint64_t us);
+
+    void notify();
+
+    int64_t getCount() const { return m_count.load(std::memory_order_relaxed); }
+
+private:
+    bool waitSlow(uint64_t timeout_us);
+
+private:
+    std::atomic<int64_t> m_count;
+    std::atomic<uint32_t> m_waiterCount{0};
+    FiberWaitQueue m_waiters;
+};
+
+} // namespace Global
+
+#endif
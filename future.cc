@@ -0,0 +1,106 @@
+#include "future.h"
+#include "fiber_sync.h"
+#include "mutex.h"
+
+namespace Global
+{
+
+/**
+ * @brief wait()的等待者, 一般放在栈上
+ */
+struct ParkWaiter : public FutureStateBase::Waiter
+{
+    /// 为空时在sem上阻塞线程
+    Scheduler* scheduler = nullptr;
+    Fiber::ptr fiber;
+    Semaphore sem;
+
+    static void Notify(FutureStateBase::Waiter* waiter)
+    {
+        ParkWaiter* self = static_cast<ParkWaiter*>(waiter);
+        if(self->scheduler)
+        {
+            // 在等待者自己的调度器上恢复; 对方可能还未让出, 调度器会在它让出后重新入队
+            Scheduler* scheduler = self->scheduler;
+            Fiber::ptr fiber = std::move(self->fiber);
+            scheduler->schedule(std::move(fiber));
+        }
+        else
+        {
+            self->sem.notify();
+        }
+    }
+};
+
+FutureStateBase::~FutureStateBase()
+{
+    GLOBAL_ASSERT2(m_waiters.load(std::memory_order_relaxed) == nullptr || isReady()
+                , "Future state destroyed with waiters");
+}
+
+bool FutureStateBase::addWaiter(Waiter* waiter)
+{
+    Waiter* head = m_waiters.load(std::memory_order_acquire);
+    do
+    {
+        if(head == ReadyTag())
+        {
+            return false;
+        }
+        waiter->next = head;
+    } while(!m_waiters.compare_exchange_weak(head, waiter
+                    , std::memory_order_acq_rel, std::memory_order_acquire));
+    return true;
+}
+
+void FutureStateBase::markReady()
+{
+    Waiter* waiters = m_waiters.exchange(ReadyTag(), std::memory_order_acq_rel);
+    while(waiters)
+    {
+        Waiter* next = waiters->next;
+        waiters->notify(waiters);
+        waiters = next;
+    }
+}
+
+void FutureStateBase::wait()
+{
+    if(isReady())
+    {
+        return;
+    }
+    auto park = [this](ParkWaiter& waiter){
+        waiter.notify = &ParkWaiter::Notify;
+        if(FiberWaitQueue::CanYield())
+        {
+            waiter.scheduler = Scheduler::GetThis();
+            waiter.fiber = Fiber::GetThis();
+        }
+        if(!addWaiter(&waiter))
+        {
+            return;
+        }
+        if(waiter.scheduler)
+        {
+            Fiber::YieldToHold();
+        }
+        else
+        {
+            waiter.sem.wait();
+        }
+    };
+    if(FiberWaitQueue::CanYield() && Fiber::GetCurrent()->isSharedStack())
+    {
+        // 共享栈协程让出后栈被同一共享栈上的其他协程覆盖, 完成方访问的等待者放在堆上
+        std::unique_ptr<ParkWaiter> waiter(new ParkWaiter);
+        park(*waiter);
+    }
+    else
+    {
+        ParkWaiter waiter;
+        park(waiter);
+    }
+}
+
+} // namespace Global
@@ -0,0 +1,410 @@
+#ifndef __FUTURE_H__
+#define __FUTURE_H__
+
+#include "scheduler.h"
+#include "macro.h"
+
+#include <stddef.h>
+#include <atomic>
+#include <exception>
+#include <future>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace Global
+{
+
+/**
+ * @brief Future/Promise共享状态中与结果类型无关的部分
+ * @details 等待者组成无锁链表, 完成时一次exchange取出全部等待者并逐个通知.
+ *          协程等待者由其所属调度器的schedule恢复, 线程等待者阻塞在信号量上,
+ *          完成方和等待方之间没有互斥量
+ */
+class FutureStateBase : Noncopyable
+{
+public:
+    struct Waiter
+    {
+        Waiter* next = nullptr;
+        /// 完成时调用, 之后完成方不再访问该等待者
+        void (*notify)(Waiter* waiter) = nullptr;
+    };
+
+    FutureStateBase() { }
+    ~FutureStateBase();
+
+    bool isReady() const { return m_waiters.load(std::memory_order_acquire) == ReadyTag(); }
+
+    /// 挂起当前执行流直到完成
+    void wait();
+
+    /**
+     * @brief 完成时调用cb, 已完成时立即在当前执行流调用
+     * @details cb在完成方的执行流中运行, 应该尽量短
+     */
+    template<class F>
+    void onReady(F&& cb)
+    {
+        CallbackWaiter<typename std::decay<F>::type>* waiter
+                = new CallbackWaiter<typename std::decay<F>::type>(std::forward<F>(cb));
+        if(!addWaiter(waiter))
+        {
+            waiter->notify(waiter);
+        }
+    }
+
+    void setException(std::exception_ptr e)
+    {
+        markSatisfied();
+        m_exception = e;
+        markReady();
+    }
+
+protected:
+    /// 结果只能设置一次
+    void markSatisfied()
+    {
+        GLOBAL_ASSERT2(!m_satisfied.exchange(true, std::memory_order_relaxed)
+                    , "Promise already satisfied");
+    }
+
+    /// 发布结果并通知所有等待者
+    void markReady();
+
+    /// 完成后抛出保存的异常
+    void rethrowIfFailed()
+    {
+        if(m_exception)
+        {
+            std::rethrow_exception(m_exception);
+        }
+    }
+
+private:
+    template<class F>
+    struct CallbackWaiter : public Waiter
+    {
+        explicit CallbackWaiter(F&& f)
+            : cb(std::move(f))
+        {
+            notify = &CallbackWaiter::Notify;
+        }
+
+        explicit CallbackWaiter(const F& f)
+            : cb(f)
+        {
+            notify = &CallbackWaiter::Notify;
+        }
+
+        static void Notify(Waiter* waiter)
+        {
+            CallbackWaiter* self = static_cast<CallbackWaiter*>(waiter);
+            self->cb();
+            delete self;
+        }
+
+        F cb;
+    };
+
+    static Waiter* ReadyTag() { return reinterpret_cast<Waiter*>(1); }
+
+    /// 登记等待者, 已完成时返回false
+    bool addWaiter(Waiter* waiter);
+
+private:
+    /// 等待者链表, 完成后为ReadyTag()
+    std::atomic<Waiter*> m_waiters{nullptr};
+    std::atomic<bool> m_satisfied{false};
+    std::exception_ptr m_exception;
+};
+
+template<class T>
+class FutureState : public FutureStateBase
+{
+public:
+    typedef std::shared_ptr<FutureState> ptr;
+
+    ~FutureState()
+    {
+        if(m_hasValue)
+        {
+            reinterpret_cast<T*>(&m_storage)->~T();
+        }
+    }
+
+    template<class U>
+    void setValue(U&& value)
+    {
+        markSatisfied();
+        new (&m_storage) T(std::forward<U>(value));
+        m_hasValue = true;
+        markReady();
+    }
+
+    /// 取走结果, 失败时抛出异常
+    T take()
+    {
+        wait();
+        rethrowIfFailed();
+        return std::move(*reinterpret_cast<T*>(&m_storage));
+    }
+
+private:
+    typename std::aligned_storage<sizeof(T), alignof(T)>::type m_storage;
+    bool m_hasValue = false;
+};
+
+template<>
+class FutureState<void> : public FutureStateBase
+{
+public:
+    typedef std::shared_ptr<FutureState> ptr;
+
+    void setValue()
+    {
+        markSatisfied();
+        markReady();
+    }
+
+    void take()
+    {
+        wait();
+        rethrowIfFailed();
+    }
+};
+
+/**
+ * @brief 异步结果, 只能移动
+ * @details get()在协程中让出而不是阻塞线程, 在普通线程中阻塞
+ */
+template<class T>
+class Future
+{
+public:
+    Future() { }
+
+    explicit Future(typename FutureState<T>::ptr state)
+        : m_state(std::move(state))
+    {
+    }
+
+    Future(Future&& rhs) = default;
+    Future& operator=(Future&& rhs) = default;
+    Future(const Future&) = delete;
+    Future& operator=(const Future&) = delete;
+
+    /// 是否关联了共享状态, get()之后为false
+    bool valid() const { return m_state != nullptr; }
+
+    bool isReady() const
+    {
+        GLOBAL_ASSERT(valid());
+        return m_state->isReady();
+    }
+
+    void wait() const
+    {
+        GLOBAL_ASSERT(valid());
+        m_state->wait();
+    }
+
+    /**
+     * @brief 等待并取走结果, 之后valid()为false
+     * @exception 重新抛出回调中的异常; Promise未设置结果就析构时抛出std::future_error
+     */
+    T get()
+    {
+        GLOBAL_ASSERT(valid());
+        typename FutureState<T>::ptr state = std::move(m_state);
+        return state->take();
+    }
+
+    /// 完成时调用cb, 用于组合多个Future
+    template<class F>
+    void onReady(F&& cb) const
+    {
+        GLOBAL_ASSERT(valid());
+        m_state->onReady(std::forward<F>(cb));
+    }
+
+private:
+    typename FutureState<T>::ptr m_state;
+};
+
+/**
+ * @brief 设置Future的结果, 只能移动
+ * @details 没有设置结果就析构时, Future得到std::future_errc::broken_promise
+ */
+template<class T>
+class Promise
+{
+public:
+    Promise()
+        : m_state(std::make_shared<FutureState<T> >())
+    {
+    }
+
+    Promise(Promise&& rhs) = default;
+    Promise& operator=(Promise&& rhs)
+    {
+        if(this != &rhs)
+        {
+            abandon();
+            m_state = std::move(rhs.m_state);
+            m_retrieved = rhs.m_retrieved;
+        }
+        return *this;
+    }
+
+    Promise(const Promise&) = delete;
+    Promise& operator=(const Promise&) = delete;
+
+    ~Promise() { abandon(); }
+
+    /// 只能获取一次
+    Future<T> getFuture()
+    {
+        GLOBAL_ASSERT2(!m_retrieved, "Future already retrieved");
+        m_retrieved = true;
+        return Future<T>(m_state);
+    }
+
+    template<class... Args>
+    void setValue(Args&&... args)
+    {
+        m_state->setValue(std::forward<Args>(args)...);
+        m_state.reset();
+    }
+
+    void setException(std::exception_ptr e)
+    {
+        m_state->setException(e);
+        m_state.reset();
+    }
+
+private:
+    void abandon()
+    {
+        if(m_state && m_retrieved)
+        {
+            m_state->setException(std::make_exception_ptr(
+                        std::future_error(std::future_errc::broken_promise)));
+        }
+        m_state.reset();
+    }
+
+private:
+    typename FutureState<T>::ptr m_state;
+    bool m_retrieved = false;
+};
+
+/// 执行cb并把返回值或异常交给promise
+template<class R, class F>
+typename std::enable_if<!std::is_void<R>::value>::type
+FulfillPromise(Promise<R>& promise, F& cb)
+{
+    try
+    {
+        promise.setValue(cb());
+    }
+    catch(...)
+    {
+        promise.setException(std::current_exception());
+    }
+}
+
+template<class R, class F>
+typename std::enable_if<std::is_void<R>::value>::type
+FulfillPromise(Promise<R>& promise, F& cb)
+{
+    try
+    {
+        cb();
+        promise.setValue();
+    }
+    catch(...)
+    {
+        promise.setException(std::current_exception());
+    }
+}
+
+/**
+ * @brief 在scheduler上调度cb, 返回其结果的Future
+ * @details 与Scheduler::schedule相同的调度方式, 只是多了一个共享状态的分配.
+ *          调度器停止时未执行的cb被销毁, Future得到broken_promise
+ * @param[in] thread 指定执行线程, -1为任意线程
+ */
+template<class F, class R = decltype(std::declval<typename std::decay<F>::type&>()())>
+Future<R> Async(Scheduler* scheduler, F&& cb, int thread = -1)
+{
+    Promise<R> promise;
+    Future<R> future = promise.getFuture();
+    scheduler->schedule([promise = std::move(promise), cb = std::forward<F>(cb)]() mutable {
+        FulfillPromise<R>(promise, cb);
+    }, thread);
+    return future;
+}
+
+/**
+ * @brief 所有futures完成时完成
+ * @details futures仍然有效, 之后逐个get()不会再等待; 个别失败不影响返回的Future
+ */
+template<class T>
+Future<void> WhenAll(const std::vector<Future<T> >& futures)
+{
+    struct Context
+    {
+        std::atomic<size_t> remaining;
+        Promise<void> promise;
+    };
+    std::shared_ptr<Context> ctx = std::make_shared<Context>();
+    Future<void> future = ctx->promise.getFuture();
+    ctx->remaining.store(futures.size() + 1, std::memory_order_relaxed);
+    auto done = [ctx](){
+        if(ctx->remaining.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        {
+            ctx->promise.setValue();
+        }
+    };
+    for(auto& f : futures)
+    {
+        f.onReady(done);
+    }
+    // 最后一份计数在登记完成后释放, 全部已完成时在这里设置结果
+    done();
+    return future;
+}
+
+/**
+ * @brief 任一future完成时完成, 结果是它在futures中的下标
+ * @details futures仍然有效; 其余future完成时的回调不再有作用
+ */
+template<class T>
+Future<size_t> WhenAny(const std::vector<Future<T> >& futures)
+{
+    GLOBAL_ASSERT2(!futures.empty(), "WhenAny without futures");
+    struct Context
+    {
+        std::atomic<bool> done{false};
+        Promise<size_t> promise;
+    };
+    std::shared_ptr<Context> ctx = std::make_shared<Context>();
+    Future<size_t> future = ctx->promise.getFuture();
+    for(size_t i = 0; i < futures.size(); i++)
+    {
+        futures[i].onReady([ctx, i](){
+            if(!ctx->done.exchange(true, std::memory_order_acq_rel))
+            {
+                ctx->promise.setValue(i);
+            }
+        });
+    }
+    return future;
+}
+
+} // namespace Global
+
+#endif
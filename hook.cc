@@ -2,10 +2,15 @@
 #include "fiber.h"
 #include "iomanager.h"
 #include "fd_manager.h"
+#include "cancel_scope.h"
 #include "macro.h"
+#include "utils.h"
 
 #include <stdarg.h> 
 #include <dlfcn.h>
+#include <linux/io_uring.h>
+
+static Global::Logger::ptr g_logger = GLOBAL_LOG_NAME("system");
 
 namespace Global
 {
@@ -70,9 +75,67 @@ void set_hook_enable(bool flag)
 
 } // namespace Global
 
-struct time_info
+/**
+ * @brief IO等待期间登记到协程所在的取消域, 取消时像超时一样取消事件把协程唤醒
+ * @details 共享栈协程挂起后栈内容会被其他协程覆盖, 登记的节点这时放在堆上
+ */
+struct IoCancelHook
 {
-    bool canceled = false;
+    struct Node : public Global::CancelScope::Hook
+    {
+        Global::IOManager* manager;
+        Global::FdCtx* ctx;
+        Global::IOManager::Event event;
+    };
+
+    IoCancelHook(Global::IOManager* m, Global::FdCtx* c, uint32_t e)
+        : scope(Global::CancelScope::GetThis())
+        , node(&local)
+    {
+        if(scope && Global::Fiber::GetCurrent()->isSharedStack())
+        {
+            heap.reset(new Node);
+            node = heap.get();
+        }
+        node->cancel = &IoCancelHook::Cancel;
+        node->manager = m;
+        node->ctx = c;
+        node->event = (Global::IOManager::Event)e;
+    }
+
+    ~IoCancelHook()
+    {
+        if(scope)
+        {
+            scope->detach(node);
+        }
+    }
+
+    /// 已取消时返回false
+    bool attach() { return !scope || scope->attach(node); }
+
+    /// addEvent之后调用: 取消发生在登记和addEvent之间时没有事件可取消, 这里补上
+    void armed()
+    {
+        if(reason())
+        {
+            node->manager->cancelEvent(node->ctx, node->event);
+        }
+    }
+
+    /// 已取消时返回取消原因, 否则返回0
+    int reason() const { return scope ? scope->getReason() : 0; }
+
+    static void Cancel(Global::CancelScope::Hook* hook)
+    {
+        Node* self = static_cast<Node*>(hook);
+        self->manager->cancelEvent(self->ctx, self->event);
+    }
+
+    Global::CancelScope* scope;
+    Node local;
+    std::unique_ptr<Node> heap;
+    Node* node;
 };
 
 
@@ -85,7 +148,7 @@ static ssize_t do_io(int fd, OriginFun fun, const char* hook_fun_name,
     {
         return fun(fd, std::forward<Args>(args)...);
     }
-    Global::FdCtx::ptr ctx = Global::FdMgr::GetInstance()->get(fd);
+    Global::FdCtx* ctx = Global::FdMgr::GetInstance()->get(fd);
     if(!ctx)
     {
         return fun(fd, std::forward<Args>(args)...);
@@ -101,54 +164,73 @@ static ssize_t do_io(int fd, OriginFun fun, const char* hook_fun_name,
     }
 
     uint64_t to = ctx->getTimeout(timeout_so);      // timeout_so 是类型
-    std::shared_ptr<time_info> tinfo(new time_info);
+    // 超时状态和定时器放在fd上复用, 等待路径不分配内存
+    Global::FdCtx::IoWait& wait = ctx->getWait(timeout_so);
 
     ssize_t n = -1;
+    // 挂起后可能在另一个线程上恢复, 循环中经由GetErrno/SetErrno访问errno
     while(true)
     {
         n = fun(fd, std::forward<Args>(args)...);
-        while(n == -1 && errno == EINTR)
+        while(n == -1 && Global::GetErrno() == EINTR)
         {
             n = fun(fd, std::forward<Args>(args)...);
         }
-        if(n == -1 && errno == EAGAIN)
+        if(n == -1 && Global::GetErrno() == EAGAIN)
         {   // 超時 加定時器
             Global::IOManager* manager = Global::IOManager::GetThis();
-            std::weak_ptr<time_info> info(tinfo);
-            Global::Timer::ptr timer;
-            if(to != (uint64_t)-1) // timeout有值
+            IoCancelHook cancel_hook(manager, ctx, event);
+            if(!cancel_hook.attach())
             {
-                timer = manager->addConditionTimer(to, [info, fd, manager, event](){
-                    auto t = info.lock();
-                    if(!t || t->canceled)
+                Global::SetErrno(cancel_hook.reason());
+                return -1;
+            }
+            uint64_t seq = ++wait.seq;
+            bool has_timer = to != (uint64_t)-1;
+            if(has_timer) // timeout有值
+            {
+                // FdCtx不会释放, 直接捕获指针; 捕获的内容放得进Task的内联缓冲区
+                Global::FdCtx* pctx = ctx;
+                Global::FdCtx::IoWait* pwait = &wait;
+                manager->armTimer(wait.timer, to * 1000, [pctx, pwait, manager, event, seq](){
+                    Global::FdCtx::IoWait& wait = *pwait;
+                    if(wait.seq != seq)
                     {
+                        // 对应的等待已经结束
                         return;
                     }
-                    t->canceled = ETIMEDOUT;
-                    manager->cancelEvent(fd, (Global::IOManager::Event)event);
-                }, info);
+                    wait.timedOut = seq;
+                    manager->cancelEvent(pctx, (Global::IOManager::Event)event);
+                }, &wait.spare);
             }
-            int res = manager->addEvent(fd, (Global::IOManager::Event)event);
+            int res = manager->addEvent(ctx, (Global::IOManager::Event)event);
             if(res)
             {
-                std::cout << hook_fun_name << "addEvent(" << fd << "," << event << ")";
-                if(timer)
+                GLOBAL_LOG_ERROR(g_logger) << hook_fun_name << " addEvent("
+                    << fd << ", " << event << ")";
+                if(has_timer)
                 {
-                    timer->cancel();
+                    wait.timer->cancel();
                 }
                 return -1;
             }
             else
             {
+                cancel_hook.armed();
                 Global::Fiber::YieldToHold();
 
-                if(timer)   // 正常的事件触发
+                if(has_timer)   // 正常的事件触发
+                {
+                    wait.timer->cancel();
+                }
+                if(wait.timedOut == seq) // 超时
                 {
-                    timer->cancel();
+                    Global::SetErrno(ETIMEDOUT);
+                    return -1;
                 }
-                if(tinfo->canceled) // 超时
+                if(cancel_hook.reason())    // 所在的TaskGroup已取消
                 {
-                    errno = tinfo->canceled;
+                    Global::SetErrno(cancel_hook.reason());
                     return -1;
                 }
                 continue;
@@ -161,6 +243,52 @@ static ssize_t do_io(int fd, OriginFun fun, const char* hook_fun_name,
     
 }
 
+/**
+ * @brief io_uring后端下由内核完成IO
+ * @param[in] timeout_so 超时类型, 为0时使用timeout_ms
+ * @return 是否已通过io_uring执行, false时调用方走do_io
+ */
+static bool do_uring(int fd, uint8_t opcode, int timeout_so, const void* addr
+                    , uint32_t len, uint64_t off, uint32_t flags, ssize_t& n
+                    , uint64_t timeout_ms = (uint64_t)-1)
+{
+    if(!Global::t_hook_enable)
+    {
+        return false;
+    }
+    Global::IOManager* manager = Global::IOManager::GetThis();
+    if(!manager || manager->getBackend() != Global::IOManager::IO_URING)
+    {
+        return false;
+    }
+    // 共享栈协程的缓冲区可能在栈上, 挂起后栈被换出, 不能交给内核异步访问
+    Global::Fiber* fiber = Global::Fiber::GetCurrent();
+    if(!fiber || fiber->isSharedStack())
+    {
+        return false;
+    }
+    Global::FdCtx* ctx = Global::FdMgr::GetInstance()->get(fd);
+    if(!ctx || ctx->isClose() || !ctx->isSocket() || ctx->getUserNonblock())
+    {
+        return false;
+    }
+    if(timeout_so)
+    {
+        timeout_ms = ctx->getTimeout(timeout_so);
+    }
+    Global::CancelScope* scope = Global::CancelScope::GetThis();
+    if(scope && scope->isCancelled())
+    {
+        // 已提交给内核的请求不响应取消, 只在发起前检查
+        n = -1;
+        errno = scope->getReason();
+        return true;
+    }
+    n = manager->submitIo(opcode, fd, addr, len, off, flags, timeout_ms);
+    // 内核对该fd不支持异步等待, 或提交队列暂时腾不出空位时, 仍由epoll等待就绪
+    return !(n == -1 && Global::GetErrno() == EAGAIN);
+}
+
 // 声明
 extern "C"
 {
@@ -193,7 +321,7 @@ int usleep(useconds_t usec)
     Global::Fiber::ptr fiber = Global::Fiber::GetThis();
     Global::IOManager* manager = Global::IOManager::GetThis();
     // manager->addTimer(usec / 1000, std::bind(&Global::IOManager::schedule, manager, fiber, -1));
-    manager->addTimer(usec/1000, [manager, fiber](){
+    manager->addTimerUs(usec, [manager, fiber](){
         manager->schedule(fiber);       // 返回继续
     });
     Global::Fiber::YieldToHold();       // 让出cpu
@@ -204,15 +332,22 @@ int nanosleep(const struct timespec *req, struct timespec *rem)
 {
     if(!Global::t_hook_enable)
     {
-        return nanosleep(req, rem);
+        return nanosleep_f(req, rem);
     }
-    int timeout_ms = req->tv_sec * 1000 + req->tv_nsec / 1000 / 1000;
+    if(req->tv_nsec < 0 || req->tv_nsec >= 1000000000)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    // 定时器精度为微秒, 不足1us的部分向上取整, 不会提前返回
+    uint64_t timeout_us = req->tv_sec * 1000000ull + (req->tv_nsec + 999) / 1000;
     Global::Fiber::ptr fiber = Global::Fiber::GetThis();
     Global::IOManager* manager = Global::IOManager::GetThis();
-    manager->addTimer(timeout_ms, [manager, fiber](){
+    manager->addTimerUs(timeout_us, [manager, fiber](){
         manager->schedule(fiber);
     });
     Global::Fiber::YieldToHold();
+    return 0;
 }
 
 int socket(int domain, int type, int protocol)
@@ -236,7 +371,7 @@ int connect_with_timeout(int sockfd, const struct sockaddr *addr, socklen_t addr
     {
         return connect_f(sockfd, addr, addrlen);
     }
-    Global::FdCtx::ptr ctx = Global::FdMgr::GetInstance()->get(sockfd);
+    Global::FdCtx* ctx = Global::FdMgr::GetInstance()->get(sockfd);
     if(!ctx || ctx->isClose())
     {
         errno = EBADF;
@@ -252,66 +387,86 @@ int connect_with_timeout(int sockfd, const struct sockaddr *addr, socklen_t addr
         return connect_f(sockfd, addr, addrlen);
     }
 
+    ssize_t rt = 0;
+    if(do_uring(sockfd, IORING_OP_CONNECT, 0, addr, 0, addrlen, 0, rt, timeout_ms))
+    {
+        return rt;
+    }
+
     int n = connect_f(sockfd, addr, addrlen);
     if(n == 0) {
         return 0;
-    } else if(n != -1 || errno != EINPROGRESS) {
+    } else if(n != -1 || Global::GetErrno() != EINPROGRESS) {
         return n;
     }
 
     Global::IOManager* manager = Global::IOManager::GetThis();
-    Global::Timer::ptr timer;
-    std::shared_ptr<time_info> tinfo(new time_info);
-    std::weak_ptr<time_info> winfo(tinfo);
-    if(timeout_ms != (uint64_t)-1)
+    IoCancelHook cancel_hook(manager, ctx, Global::IOManager::WRITE);
+    if(!cancel_hook.attach())
     {
-        timer = manager->addConditionTimer(timeout_ms, [winfo, sockfd, manager]()
-        {
-            auto t = winfo.lock();
-            if(!t || t->canceled)
+        Global::SetErrno(cancel_hook.reason());
+        return -1;
+    }
+    // 连接中只等待WRITE, 和send共用一个方向的等待状态
+    Global::FdCtx::IoWait& wait = ctx->getWait(SO_SNDTIMEO);
+    uint64_t seq = ++wait.seq;
+    bool has_timer = timeout_ms != (uint64_t)-1;
+    if(has_timer)
+    {
+        Global::FdCtx* pctx = ctx;
+        Global::FdCtx::IoWait* pwait = &wait;
+        manager->armTimer(wait.timer, timeout_ms * 1000, [pctx, pwait, manager, seq](){
+            Global::FdCtx::IoWait& wait = *pwait;
+            if(wait.seq != seq)
             {
                 return;
             }
-            t->canceled = ETIMEDOUT;
-            manager->cancelEvent(sockfd, Global::IOManager::WRITE);
-        }, winfo);
+            wait.timedOut = seq;
+            manager->cancelEvent(pctx, Global::IOManager::WRITE);
+        }, &wait.spare);
     }
     
-    int res = manager->addEvent(sockfd, Global::IOManager::WRITE);
+    int res = manager->addEvent(ctx, Global::IOManager::WRITE);
     if(!res)
     {
+        cancel_hook.armed();
         Global::Fiber::YieldToHold();
-        if(timer)
+        if(has_timer)
+        {
+            wait.timer->cancel();
+        }
+        if(wait.timedOut == seq)
         {
-            timer->cancel();
+            Global::SetErrno(ETIMEDOUT);
+            return -1;
         }
-        if(tinfo->canceled)
+        if(cancel_hook.reason())
         {
-            errno = tinfo->canceled;
+            Global::SetErrno(cancel_hook.reason());
             return -1;
         }
     }
     else
     {
-        if(timer)
+        if(has_timer)
         {
-            timer->cancel();
+            wait.timer->cancel();
         }
-        std::cout << "connect addEvent(" << sockfd << ", WRITE) error";
+        GLOBAL_LOG_ERROR(g_logger) << "connect addEvent(" << sockfd << ", WRITE) error";
     }
     int error = 0;
     socklen_t len = sizeof(int);
-    if(-1 == getsockopt(sockfd, SOL_SOCKET, SO_ERROR, &errno, &len))
+    if(-1 == getsockopt(sockfd, SOL_SOCKET, SO_ERROR, &error, &len))
     {
         return -1;
     }
-    if(!errno)
+    if(!error)
     {
         return 0;
     }
     else
     {
-        errno = errno;
+        Global::SetErrno(error);
         return -1;
     }
 }
@@ -322,8 +477,11 @@ int connect(int sockfd, const struct sockaddr *addr, socklen_t addrlen) {
 
 int accept(int s, struct sockaddr *addr, socklen_t *addrlen)
 {
-    // TODO: 
-    int fd = do_io(s, accept_f, "accept", Global::IOManager::READ, SO_RCVTIMEO, addr, addrlen);
+    ssize_t fd = -1;
+    if(!do_uring(s, IORING_OP_ACCEPT, SO_RCVTIMEO, addr, 0, (uint64_t)(uintptr_t)addrlen, 0, fd))
+    {
+        fd = do_io(s, accept_f, "accept", Global::IOManager::READ, SO_RCVTIMEO, addr, addrlen);
+    }
     if(fd >= 0)
     {
         Global::FdMgr::GetInstance()->get(fd, true);
@@ -332,6 +490,12 @@ int accept(int s, struct sockaddr *addr, socklen_t *addrlen)
 }
 
 ssize_t read(int fd, void *buf, size_t count) {
+    ssize_t n;
+    // do_uring只处理socket, read等价于flags为0的recv
+    if(do_uring(fd, IORING_OP_RECV, SO_RCVTIMEO, buf, count, 0, 0, n))
+    {
+        return n;
+    }
     return do_io(fd, read_f, "read", Global::IOManager::READ, SO_RCVTIMEO, buf, count);
 }
 
@@ -340,6 +504,11 @@ ssize_t readv(int fd, const struct iovec *iov, int iovcnt) {
 }
 
 ssize_t recv(int sockfd, void *buf, size_t len, int flags) {
+    ssize_t n;
+    if(do_uring(sockfd, IORING_OP_RECV, SO_RCVTIMEO, buf, len, 0, flags, n))
+    {
+        return n;
+    }
     return do_io(sockfd, recv_f, "recv", Global::IOManager::READ, SO_RCVTIMEO, buf, len, flags);
 }
 
@@ -352,6 +521,11 @@ ssize_t recvmsg(int sockfd, struct msghdr *msg, int flags) {
 }
 
 ssize_t write(int fd, const void *buf, size_t count) {
+    ssize_t n;
+    if(do_uring(fd, IORING_OP_SEND, SO_SNDTIMEO, buf, count, 0, 0, n))
+    {
+        return n;
+    }
     return do_io(fd, write_f, "write", Global::IOManager::WRITE, SO_SNDTIMEO, buf, count);
 }
 
@@ -360,6 +534,11 @@ ssize_t writev(int fd, const struct iovec *iov, int iovcnt) {
 }
 
 ssize_t send(int s, const void *msg, size_t len, int flags) {
+    ssize_t n;
+    if(do_uring(s, IORING_OP_SEND, SO_SNDTIMEO, msg, len, 0, flags, n))
+    {
+        return n;
+    }
     return do_io(s, send_f, "send", Global::IOManager::WRITE, SO_SNDTIMEO, msg, len, flags);
 }
 
@@ -376,7 +555,7 @@ int close(int fd) {
         return close_f(fd);
     }
 
-    Global::FdCtx::ptr ctx = Global::FdMgr::GetInstance()->get(fd);
+    Global::FdCtx* ctx = Global::FdMgr::GetInstance()->get(fd);
     if(ctx) {
         auto iom = Global::IOManager::GetThis();
         if(iom) {
@@ -387,15 +566,6 @@ int close(int fd) {
     return close_f(fd);
 }
 
-ssize_t send(int s, const void *msg, size_t len, int flags) {
-    return do_io(s, send_f, "send", Global::IOManager::WRITE, SO_SNDTIMEO, msg, len, flags);
-}
-
-ssize_t recv(int sockfd, void *buf, size_t len, int flags) {
-    return do_io(sockfd, recv_f, "recv", Global::IOManager::READ, SO_RCVTIMEO, buf, len, flags);
-}
-
-
 int fcntl(int fd, int cmd, ... /* arg */ )
 {
     va_list va;
@@ -406,7 +576,7 @@ int fcntl(int fd, int cmd, ... /* arg */ )
         {
             int arg = va_arg(va, int);
             va_end(va);
-            Global::FdCtx::ptr ctx = Global::FdMgr::GetInstance()->get(fd);
+            Global::FdCtx* ctx = Global::FdMgr::GetInstance()->get(fd);
             if(!ctx || ctx->isClose() || !ctx->isSocket())
             {
                 return fcntl_f(fd, cmd, arg);
@@ -428,7 +598,7 @@ int fcntl(int fd, int cmd, ... /* arg */ )
         {
             va_end(va);
             int arg = fcntl_f(fd, cmd);
-            Global::FdCtx::ptr ctx = Global::FdMgr::GetInstance()->get(fd);
+            Global::FdCtx* ctx = Global::FdMgr::GetInstance()->get(fd);
             if(!ctx || ctx->isClose() || !ctx->isSocket()) {
                 return arg;
             }
@@ -500,7 +670,7 @@ int ioctl(int d, unsigned long int request, ...)
     if(FIONBIO == request)
     {
         bool user_nonblock= !!*(int*)arg;
-        Global::FdCtx::ptr ctx =  Global::FdMgr::GetInstance()->get(d);
+        Global::FdCtx* ctx = Global::FdMgr::GetInstance()->get(d);
         if(!ctx || ctx->isClose() || !ctx->isSocket())
         {
             return ioctl_f(d, request, arg);
@@ -520,7 +690,7 @@ int setsockopt(int sockfd, int level, int optname, const void *optval, socklen_t
     }
     if(level == SOL_SOCKET) {
         if(optname == SO_RCVTIMEO || optname == SO_SNDTIMEO) {
-            Global::FdCtx::ptr ctx = Global::FdMgr::GetInstance()->get(sockfd);
+            Global::FdCtx* ctx = Global::FdMgr::GetInstance()->get(sockfd);
             if(ctx) {
                 const timeval* v = (const timeval*)optval;
                 ctx->setTimeout(optname, v->tv_sec * 1000 + v->tv_usec / 1000);
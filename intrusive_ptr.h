@@ -0,0 +1,147 @@
+#ifndef __INTRUSIVE_PTR_H__
+#define __INTRUSIVE_PTR_H__
+
+#include <atomic>
+#include <cstddef>
+#include <utility>
+#include <stdint.h>
+
+namespace Global
+{
+
+#ifdef GLOBAL_REFCOUNT_STATS
+/**
+ * @brief 当前线程引用计数原子操作次数, 仅用于测试
+ */
+inline uint64_t& RefCountOps()
+{
+    static thread_local uint64_t s_ops = 0;
+    return s_ops;
+}
+#endif
+
+/**
+ * @brief 侵入式引用计数基类, 计数为0时delete派生类对象
+ */
+template<class T>
+class RefCounted
+{
+public:
+    RefCounted() = default;
+    RefCounted(const RefCounted&) = delete;
+    RefCounted& operator=(const RefCounted&) = delete;
+
+    void addRef() const
+    {
+#ifdef GLOBAL_REFCOUNT_STATS
+        ++RefCountOps();
+#endif
+        m_refs.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void release() const
+    {
+#ifdef GLOBAL_REFCOUNT_STATS
+        ++RefCountOps();
+#endif
+        if(m_refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        {
+            delete static_cast<const T*>(this);
+        }
+    }
+
+    uint32_t refCount() const { return m_refs.load(std::memory_order_relaxed); }
+
+protected:
+    ~RefCounted() = default;
+
+private:
+    mutable std::atomic<uint32_t> m_refs{0};
+};
+
+/**
+ * @brief 侵入式智能指针, 接口与std::shared_ptr的常用部分一致, 不需要额外的控制块
+ */
+template<class T>
+class IntrusivePtr
+{
+public:
+    IntrusivePtr() : m_ptr(nullptr) { }
+    IntrusivePtr(std::nullptr_t) : m_ptr(nullptr) { }
+
+    explicit IntrusivePtr(T* p)
+        : m_ptr(p)
+    {
+        if(m_ptr) m_ptr->addRef();
+    }
+
+    IntrusivePtr(const IntrusivePtr& rhs)
+        : m_ptr(rhs.m_ptr)
+    {
+        if(m_ptr) m_ptr->addRef();
+    }
+
+    IntrusivePtr(IntrusivePtr&& rhs) noexcept
+        : m_ptr(rhs.m_ptr)
+    {
+        rhs.m_ptr = nullptr;
+    }
+
+    ~IntrusivePtr()
+    {
+        if(m_ptr) m_ptr->release();
+    }
+
+    IntrusivePtr& operator=(const IntrusivePtr& rhs)
+    {
+        IntrusivePtr(rhs).swap(*this);
+        return *this;
+    }
+
+    IntrusivePtr& operator=(IntrusivePtr&& rhs) noexcept
+    {
+        IntrusivePtr(std::move(rhs)).swap(*this);
+        return *this;
+    }
+
+    IntrusivePtr& operator=(std::nullptr_t)
+    {
+        reset();
+        return *this;
+    }
+
+    void reset()
+    {
+        IntrusivePtr().swap(*this);
+    }
+
+    void reset(T* p)
+    {
+        IntrusivePtr(p).swap(*this);
+    }
+
+    void swap(IntrusivePtr& rhs) noexcept
+    {
+        T* tmp = m_ptr;
+        m_ptr = rhs.m_ptr;
+        rhs.m_ptr = tmp;
+    }
+
+    T* get() const { return m_ptr; }
+    T* operator->() const { return m_ptr; }
+    T& operator*() const { return *m_ptr; }
+    explicit operator bool() const { return m_ptr != nullptr; }
+    long use_count() const { return m_ptr ? m_ptr->refCount() : 0; }
+
+    bool operator==(const IntrusivePtr& rhs) const { return m_ptr == rhs.m_ptr; }
+    bool operator!=(const IntrusivePtr& rhs) const { return m_ptr != rhs.m_ptr; }
+    bool operator==(std::nullptr_t) const { return m_ptr == nullptr; }
+    bool operator!=(std::nullptr_t) const { return m_ptr != nullptr; }
+
+private:
+    T* m_ptr;
+};
+
+} // namespace Global
+
+#endif
@@ -1,8 +1,14 @@
 #include "macro.h"
 #include "iomanager.h"
 #include "timer.h"
+#include "uring.h"
+#include "utils.h"
 
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
+#include <poll.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <vector>
@@ -10,57 +16,156 @@
 namespace Global
 {
 
-IOManager::IOManager(size_t threads, bool use_caller, const std::string& name)
+static Logger::ptr g_logger = GLOBAL_LOG_NAME("system");
+
+/// 提交队列长度
+static const unsigned URING_ENTRIES = 256;
+/// 未提交的sqe达到该数量时不等空闲循环, 立即提交
+static const unsigned URING_BATCH = 32;
+/// 上次GetThis()转换的调度器及结果, 调度器不变时省去dynamic_cast
+static thread_local Scheduler* t_cached_scheduler = nullptr;
+static thread_local IOManager* t_cached_iomanager = nullptr;
+
+/// 分配IOManager实例编号, 见m_id
+static std::atomic<uint64_t> s_iomanager_id{0};
+
+/// 空闲等待的最长时间(微秒)
+static const uint64_t MAX_TIMEOUT_US = 3000 * 1000;
+
+static int epoll_pwait2_us(int epfd, epoll_event* events, int maxevents, uint64_t timeout_us)
+{
+#ifdef SYS_epoll_pwait2
+    struct timespec ts;
+    ts.tv_sec = timeout_us / 1000000;
+    ts.tv_nsec = (timeout_us % 1000000) * 1000;
+    return syscall(SYS_epoll_pwait2, epfd, events, maxevents, &ts, NULL, 0);
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+IOManager::IOManager(size_t threads, bool use_caller, const std::string& name, bool sharded
+                    , Backend backend, bool persistent)
     : Scheduler(threads, use_caller, name)
+    , TimerManager(threads)
+    , m_sharded(sharded)
+    , m_persistent(persistent)
+    , m_id(++s_iomanager_id)
 {
     m_epollfd = epoll_create(5000);
     GLOBAL_ASSERT(m_epollfd > 0);
 
-    int res = pipe(m_tickleFds);
-    GLOBAL_ASSERT(!res);
+    if(backend == IO_URING)
+    {
+        m_uring.reset(new IoUring);
+        if(m_uring->init(URING_ENTRIES))
+        {
+            // ring的完成事件通过共享epoll通知轮询线程, 水平触发直到cqe被取完
+            epoll_event event;
+            memset(&event, 0, sizeof(epoll_event));
+            event.events = EPOLLIN;
+            event.data.ptr = m_uring.get();
+            int res = epoll_ctl(m_epollfd, EPOLL_CTL_ADD, m_uring->getFd(), &event);
+            GLOBAL_ASSERT(!res);
+            m_sharded = false;
+        }
+        else
+        {
+            GLOBAL_LOG_WARN(g_logger) << "io_uring unavailable (" << strerror(errno)
+                      << "), fallback to epoll";
+            m_uring.reset();
+        }
+    }
 
-    epoll_event event;
-    memset(&event, 0, sizeof(epoll_event));
-    event.events = EPOLLIN | EPOLLET;
-    event.data.fd = m_tickleFds[0];
+    // epoll_pwait2需要5.11以上内核, 否则用timerfd提供微秒超时
+    {
+        int epfd = epoll_create1(EPOLL_CLOEXEC);
+        GLOBAL_ASSERT(epfd >= 0);
+        epoll_event event;
+        m_pwait2 = epoll_pwait2_us(epfd, &event, 1, 0) >= 0;
+        close(epfd);
+    }
 
-    res = fcntl(m_tickleFds[0], F_SETFL, O_NONBLOCK);
-    GLOBAL_ASSERT(!res);
+    for(size_t i = 0; i < getWorkerCount(); i++)
+    {
+        Waker* waker = new Waker;
+        m_wakers.emplace_back(waker);
+        waker->eventfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        GLOBAL_ASSERT(waker->eventfd >= 0);
+        waker->epfd = epoll_create1(EPOLL_CLOEXEC);
+        GLOBAL_ASSERT(waker->epfd >= 0);
+
+        // data.ptr区分: Waker为eventfd, nullptr为共享epoll, 其余为FdCtx
+        epoll_event event;
+        memset(&event, 0, sizeof(epoll_event));
+        event.events = EPOLLIN;
+        event.data.ptr = waker;
+        int res = epoll_ctl(waker->epfd, EPOLL_CTL_ADD, waker->eventfd, &event);
+        GLOBAL_ASSERT(!res);
+
+        if(!m_pwait2)
+        {
+            waker->timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+            GLOBAL_ASSERT(waker->timerfd >= 0);
+            event.events = EPOLLIN;
+            event.data.ptr = &waker->timerfd;
+            res = epoll_ctl(waker->epfd, EPOLL_CTL_ADD, waker->timerfd, &event);
+            GLOBAL_ASSERT(!res);
+        }
 
-    res = epoll_ctl(m_epollfd, EPOLL_CTL_ADD, m_tickleFds[0], &event);
-    GLOBAL_ASSERT(!res);
+        if(!m_sharded)
+        {
+            // 只有持有轮询权的线程阻塞在私有epoll上, 共享epoll就绪不会惊群
+            event.events = EPOLLIN;
+            event.data.ptr = nullptr;
+            res = epoll_ctl(waker->epfd, EPOLL_CTL_ADD, m_epollfd, &event);
+            GLOBAL_ASSERT(!res);
+        }
+    }
 
-    contextResize(64);
     start();
 }
 
 IOManager::~IOManager()
 {
     stop();
-    close(m_epollfd);
-    close(m_tickleFds[0]);
-    close(m_tickleFds[1]);
-    for(size_t i = 0; i < m_fdContexts.size(); i++)
+    // 之后在同一地址构造的调度器不能命中缓存
+    t_cached_scheduler = nullptr;
+    t_cached_iomanager = nullptr;
+    m_uring.reset();
+    for(auto& i : m_wakers)
     {
-        if(m_fdContexts[i]) delete m_fdContexts[i];
+        close(i->epfd);
+        close(i->eventfd);
+        if(i->timerfd >= 0)
+        {
+            close(i->timerfd);
+        }
     }
-
+    close(m_epollfd);
 }
 
 IOManager* IOManager::GetThis() {
-    return dynamic_cast<IOManager*>(Scheduler::GetThis());
+    Scheduler* scheduler = Scheduler::GetThis();
+    if(scheduler != t_cached_scheduler)
+    {
+        t_cached_scheduler = scheduler;
+        t_cached_iomanager = dynamic_cast<IOManager*>(scheduler);
+    }
+    return t_cached_iomanager;
 }
 
 
-IOManager::FdContext::EventContext& IOManager::FdContext::getEvent(Event event)
+FdCtx::EventContext& IOManager::getEvent(FdCtx* ctx, Event event)
 {
     switch (event)
     {
     case IOManager::READ:
-        return read;
+        return ctx->m_read;
         break;
     case IOManager::WRITE:
-        return write;
+        return ctx->m_write;
         break;
     default:
         GLOBAL_ASSERT2(false, "getEvent")
@@ -68,219 +173,304 @@ IOManager::FdContext::EventContext& IOManager::FdContext::getEvent(Event event)
     throw std::invalid_argument("getContext invalid event");
 }
 
-void IOManager::FdContext::resetContext(EventContext& ctx) {
-    ctx.scheduler = nullptr;
-    ctx.fiber.reset();
-    ctx.cb = nullptr;
+Task& IOManager::getCallback(FdCtx* ctx, Event event)
+{
+    return event == READ ? ctx->m_readCb : ctx->m_writeCb;
+}
+
+void IOManager::resetContext(FdCtx* ctx, Event event) {
+    FdCtx::EventContext& event_ctx = getEvent(ctx, event);
+    event_ctx.scheduler = nullptr;
+    event_ctx.fiber.reset();
+    getCallback(ctx, event) = nullptr;
 }
 
-void IOManager::FdContext::triggerEvent(Event event)
+void IOManager::triggerEvent(FdCtx* ctx, Event event, int thread)
 {
-    GLOBAL_ASSERT(events & event);
-    events = (Event)(events & ~event);
-    EventContext& event_ctx = getEvent(event);
-    if(event_ctx.cb)
+    GLOBAL_ASSERT(ctx->m_events & event);
+    ctx->m_events &= ~event;
+    FdCtx::EventContext& event_ctx = getEvent(ctx, event);
+    Task& cb = getCallback(ctx, event);
+    if(cb)
     {
-        event_ctx.scheduler->schedule(&event_ctx.cb);
+        event_ctx.scheduler->schedule(&cb, thread);
     }
     else if(event_ctx.fiber)
     {
-        event_ctx.scheduler->schedule(&event_ctx.fiber);
+        event_ctx.scheduler->schedule(&event_ctx.fiber, thread);
     }
     event_ctx.scheduler = nullptr;
     return;
 }
 
-void IOManager::contextResize(size_t size)
+int IOManager::addEvent(int fd, Event event, Task cb)
 {
-    m_fdContexts.resize(size);
-    for(size_t i = 0; i < m_fdContexts.size(); i++)
+    FdCtx* context = FdMgr::GetInstance()->get(fd, true);
+    if(!context)
     {
-        if(!m_fdContexts[i])
-        {
-            m_fdContexts[i] = new FdContext;
-            m_fdContexts[i]->fd = i;
-        }
+        GLOBAL_LOG_ERROR(g_logger) << "addEvent fd=" << fd << " out of range";
+        return -1;
     }
+    return addEvent(context, event, std::move(cb));
 }
 
-int IOManager::addEvent(int fd, Event event, std::function<void()> cb)
+int IOManager::addEvent(FdCtx* context, Event event, Task cb)
 {
-    FdContext* context = nullptr;
-    RWMutexType::ReadLock Lock(m_mutex);
-    
-    // 是否越界
-    if(fd < (int)m_fdContexts.size())
+    int fd = context->m_fd;
+    FdCtx::MutexType::LockGuard lock2(context->m_mutex);
+    if(context->m_owner != m_id)
     {
-        context = m_fdContexts[fd];
-        Lock.unlock();
+        // 上一个IOManager的注册状态对本实例无效
+        GLOBAL_ASSERT(context->m_events == NONE);
+        context->m_owner = m_id;
+        context->m_registered = false;
+        context->m_ready = NONE;
+        context->m_reactor = -1;
     }
-    else if(fd >= (int)m_fdContexts.size())
+    if(m_sharded && context->m_events == NONE && !context->m_registered)
     {
-        Lock.unlock();
-        RWMutexType::WriteLock lock2(m_mutex);
-        contextResize(fd * 1.5);
-        context = m_fdContexts[fd];
+        // 没有注册任何事件时才能更换reactor, 优先选择当前工作线程
+        int index = getWorkerIndex();
+        if(index >= 0)
+        {
+            context->m_reactor = index;
+        }
+        else if(context->m_reactor < 0)
+        {
+            context->m_reactor = m_nextReactor++ % m_wakers.size();
+        }
     }
-
-    FdContext::MutexType::LockGuard lock2(context->mutex);
-    if(context->events & event)         // 已经存在
+    if(context->m_events & event)         // 已经存在
     {
-         std::cout << "addEvent assert fd=" << fd
+        GLOBAL_LOG_ERROR(g_logger) << "addEvent assert fd=" << fd
                     << " event=" << (EPOLL_EVENTS)event
-                    << " context.event=" << (EPOLL_EVENTS)context->events;
-        GLOBAL_ASSERT(!(context->events & event));
+                    << " context.event=" << (EPOLL_EVENTS)context->m_events;
+        GLOBAL_ASSERT(!(context->m_events & event));
     }
-    int op = context->events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
-    epoll_event epv;
-    epv.events = EPOLLET | context->events | event;
-    epv.data.ptr = context;
-    int res = epoll_ctl(m_epollfd, op, fd, &epv);
-    if(res)
+    if(!m_persistent || !context->m_registered)
     {
-        std::cout << "epoll_ctl(" << m_epollfd << ", "
-            << ", " << fd << ", " << (EPOLL_EVENTS)epv.events << "):"
-            << res << " (" << errno << ") (" << strerror(errno) << ") context->events="
-            << (EPOLL_EVENTS)context->events;
-        return -1;
+        int op = context->m_events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+        epoll_event epv;
+        epv.events = EPOLLET | context->m_events | event;
+        if(m_persistent)
+        {
+            // 整个生命周期只注册一次, 读写两个方向都监听
+            op = EPOLL_CTL_ADD;
+            epv.events = EPOLLET | EPOLLIN | EPOLLOUT;
+        }
+        epv.data.ptr = context;
+        int res = epoll_ctl(epollFd(context), op, fd, &epv);
+        if(res)
+        {
+            GLOBAL_LOG_ERROR(g_logger) << "epoll_ctl(" << epollFd(context) << ", "
+                << ", " << fd << ", " << (EPOLL_EVENTS)epv.events << "):"
+                << res << " (" << errno << ") (" << strerror(errno) << ") context->events="
+                << (EPOLL_EVENTS)context->m_events;
+            return -1;
+        }
+        context->m_registered = m_persistent;
     }
     
     ++m_pendingEventCount;
     
-    context->events = (Event)(context->events | event);
-    FdContext::EventContext& event_ctx = context->getEvent(event);
+    context->m_events |= event;
+    FdCtx::EventContext& event_ctx = getEvent(context, event);
+    Task& event_cb = getCallback(context, event);
     
     GLOBAL_ASSERT(!event_ctx.scheduler
                 &&!event_ctx.fiber
-                &&!event_ctx.cb);
+                &&!event_cb);
 
     event_ctx.scheduler = Scheduler::GetThis();
     
     if(cb)
     {
-        event_ctx.cb.swap(cb);
+        event_cb = std::move(cb);
     } 
     else
     {
         event_ctx.fiber = Fiber::GetThis();
+        // 切出之前可能已被唤醒方置为READY
         GLOBAL_ASSERT2(event_ctx.fiber->getState() == Fiber::EXEC
+                    || event_ctx.fiber->getState() == Fiber::READY
                     , "state = " << event_ctx.fiber->getState());
     }
+
+    if(context->m_ready & event)
+    {
+        // 等待前已经到达过边沿, 直接恢复. 锁存的状态可能已过期, 调用方重试后会再次等待
+        context->m_ready &= ~event;
+        triggerEvent(context, event);
+        --m_pendingEventCount;
+    }
     return 0;
 }
 
 bool IOManager::delEvent(int fd, Event event)
 {
-    RWMutexType::ReadLock lock1(m_mutex);
-    if(fd >= (int)m_fdContexts.size()) return false;
-    IOManager::FdContext* fd_ctx = m_fdContexts[fd];
-    lock1.unlock();
+    FdCtx* fd_ctx = FdMgr::GetInstance()->get(fd);
+    if(!fd_ctx) return false;
 
-    FdContext::MutexType::LockGuard lock2(fd_ctx->mutex);
-    if(!(fd_ctx->events & event))
+    FdCtx::MutexType::LockGuard lock2(fd_ctx->m_mutex);
+    if(fd_ctx->m_owner != m_id || !(fd_ctx->m_events & event))
     {
-        std::cout << "event: " << event << "doesn't exist" << std::endl;
+        GLOBAL_LOG_DEBUG(g_logger) << "event: " << event << " doesn't exist";
         return false;
     }
 
-    Event new_event = (Event)(fd_ctx->events & (~event));   // 修改events
-    int op = new_event ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
-    epoll_event epv;
-    epv.events = new_event | EPOLLET;
-    epv.data.ptr = fd_ctx;
-
-    int res = epoll_ctl(m_epollfd, op, fd, &epv);
-    if(res)
+    Event new_event = (Event)(fd_ctx->m_events & (~event));   // 修改events
+    if(!m_persistent)
     {
-        std::cout << "epoll_ctl(" << m_epollfd << ", "
-            << ", " << fd << ", " << (EPOLL_EVENTS)epv.events << "):"
-            << res << " (" << errno << ") (" << strerror(errno) << ") context->events="
-            << (EPOLL_EVENTS)fd_ctx->events;
-        return false;
+        int op = new_event ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
+        epoll_event epv;
+        epv.events = new_event | EPOLLET;
+        epv.data.ptr = fd_ctx;
+
+        int res = epoll_ctl(epollFd(fd_ctx), op, fd, &epv);
+        if(res)
+        {
+            GLOBAL_LOG_ERROR(g_logger) << "epoll_ctl(" << epollFd(fd_ctx) << ", "
+                << ", " << fd << ", " << (EPOLL_EVENTS)epv.events << "):"
+                << res << " (" << errno << ") (" << strerror(errno) << ") context->events="
+                << (EPOLL_EVENTS)fd_ctx->m_events;
+            return false;
+        }
     }
 
     --m_pendingEventCount;
-    fd_ctx->events = new_event;
-    FdContext::EventContext& event_ctx = fd_ctx->getEvent(event);
-    fd_ctx->resetContext(event_ctx);        // 重置对应fd的event事件的上下文
+    fd_ctx->m_events = new_event;
+    resetContext(fd_ctx, event);        // 重置对应fd的event事件的上下文
     return true;
 }
+
 bool IOManager::cancelEvent(int fd, Event event)
 {
-    RWMutexType::ReadLock lock1(m_mutex);
-    if(fd >= (int)m_fdContexts.size()) return false;
-    FdContext* fd_ctx = m_fdContexts[fd];
-    lock1.unlock();
+    FdCtx* fd_ctx = FdMgr::GetInstance()->get(fd);
+    if(!fd_ctx) return false;
+    return cancelEvent(fd_ctx, event);
+}
 
-    FdContext::MutexType::LockGuard lock2(fd_ctx->mutex);
-    if(!(fd_ctx->events & event))
+bool IOManager::cancelEvent(FdCtx* fd_ctx, Event event)
+{
+    FdCtx::MutexType::LockGuard lock2(fd_ctx->m_mutex);
+    if(fd_ctx->m_owner != m_id || !(fd_ctx->m_events & event))
     {
         return false;
     }
-    Event new_events = (Event)(fd_ctx->events & ~event);
-    int op = new_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
-    epoll_event epv;
-    epv.events = new_events | EPOLLET;
-    epv.data.ptr = fd_ctx;
-
-    int res = epoll_ctl(m_epollfd, op, fd, &epv);
-    if(res)
+    int fd = fd_ctx->m_fd;
+    if(!m_persistent)
     {
-        std::cout << "epoll_ctl(" << m_epollfd << ", "
-            << ", " << fd << ", " << (EPOLL_EVENTS)epv.events << "):"
-            << res << " (" << errno << ") (" << strerror(errno) << ") context->events="
-            << (EPOLL_EVENTS)fd_ctx->events;
-        return false;
+        Event new_events = (Event)(fd_ctx->m_events & ~event);
+        int op = new_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
+        epoll_event epv;
+        epv.events = new_events | EPOLLET;
+        epv.data.ptr = fd_ctx;
+
+        int res = epoll_ctl(epollFd(fd_ctx), op, fd, &epv);
+        if(res)
+        {
+            GLOBAL_LOG_ERROR(g_logger) << "epoll_ctl(" << epollFd(fd_ctx) << ", "
+                << ", " << fd << ", " << (EPOLL_EVENTS)epv.events << "):"
+                << res << " (" << errno << ") (" << strerror(errno) << ") context->events="
+                << (EPOLL_EVENTS)fd_ctx->m_events;
+            return false;
+        }
     }
-    fd_ctx->triggerEvent(event);
+    triggerEvent(fd_ctx, event);
     --m_pendingEventCount;
     return true;
 }
 
 bool IOManager::cancelAll(int fd)
 {
-    RWMutexType::ReadLock lock(m_mutex);
-    if(fd >= (int)m_fdContexts.size()) return false;
-    FdContext* fd_ctx = m_fdContexts[fd];
-    lock.unlock();
+    FdCtx* fd_ctx = FdMgr::GetInstance()->get(fd);
+    if(!fd_ctx) return false;
     
-    FdContext::MutexType::LockGuard lock2(fd_ctx->mutex);
-    if(!fd_ctx->events) return false;
+    FdCtx::MutexType::LockGuard lock2(fd_ctx->m_mutex);
+    if(fd_ctx->m_owner != m_id) return false;
+    bool registered = fd_ctx->m_registered;
+    // 持久注册在fd关闭前移除, 避免复用fd号时沿用旧的注册和就绪状态
+    fd_ctx->m_registered = false;
+    fd_ctx->m_ready = NONE;
+    if(!fd_ctx->m_events && !registered) return false;
 
     int op = EPOLL_CTL_DEL;
     epoll_event epv;
     epv.events = 0;
     epv.data.ptr = fd_ctx;
 
-    int res = epoll_ctl(m_epollfd, op, fd, &epv);
+    int res = epoll_ctl(epollFd(fd_ctx), op, fd, &epv);
     if(res)
     {
-        std::cout << "epoll_ctl(" << m_epollfd << ", "
+        GLOBAL_LOG_ERROR(g_logger) << "epoll_ctl(" << epollFd(fd_ctx) << ", "
             << ", " << fd << ", " << (EPOLL_EVENTS)epv.events << "):"
             << res << " (" << errno << ") (" << strerror(errno) << ") context->events="
-            << (EPOLL_EVENTS)fd_ctx->events;
+            << (EPOLL_EVENTS)fd_ctx->m_events;
         return false;
     }
-    if(fd_ctx->events & IOManager::READ)
+    if(fd_ctx->m_events & IOManager::READ)
     {
-        fd_ctx->triggerEvent(READ);
+        triggerEvent(fd_ctx, READ);
         --m_pendingEventCount;
     }
-    if(fd_ctx->events & IOManager::WRITE)
+    if(fd_ctx->m_events & IOManager::WRITE)
     {
-        fd_ctx->triggerEvent(WRITE);
+        triggerEvent(fd_ctx, WRITE);
         --m_pendingEventCount;
     }
-    GLOBAL_ASSERT(fd_ctx->events == 0);
+    GLOBAL_ASSERT(fd_ctx->m_events == 0);
+    return true;
+}
+
+int IOManager::epollFd(FdCtx* ctx) const
+{
+    return m_sharded ? m_wakers[ctx->m_reactor]->epfd : m_epollfd;
+}
+
+bool IOManager::wake(Waker& waker)
+{
+    if(waker.notified.exchange(true))
+    {
+        return false;
+    }
+    uint64_t one = 1;
+    int writed = ::write(waker.eventfd, &one, sizeof(one));
+    GLOBAL_ASSERT(writed == sizeof(one));
     return true;
 }
 
 void IOManager::tickle()
 {
-    if(!hasIdleThreads()) return;
-    std::cout << "tickle" << std::endl;
-    int writed = ::write(m_tickleFds[1], "t", 1);
-    GLOBAL_ASSERT(writed == 1);
+    // 与idle()中设置parked后的检查配对, 保证不会丢失唤醒
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    size_t count = m_wakers.size();
+    size_t start = m_nextWake++;
+    for(size_t i = 0; i < count; i++)
+    {
+        Waker& waker = *m_wakers[(start + i) % count];
+        if(!waker.parked)
+        {
+            continue;
+        }
+        if(waker.notified)
+        {
+            return;     // 已有线程被唤醒但尚未醒来, 它会继续唤醒其他线程
+        }
+        if(wake(waker))
+        {
+            return;
+        }
+    }
+}
+
+void IOManager::tickleWorker(size_t index)
+{
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    Waker& waker = *m_wakers[index];
+    if(waker.parked)
+    {
+        wake(waker);
+    }
 }
 
 bool IOManager::stopping()
@@ -293,57 +483,115 @@ bool IOManager::stopping(uint64_t& timeout)
 {
     timeout = getNextTimer();
 
-    return timeout == ~0ull
+    return !hasTimer()
         && Scheduler::stopping()
         && m_pendingEventCount == 0;
 }
 
 void IOManager::idle()
 {
-    std::cout << "idle" << std::endl;
+    GLOBAL_LOG_DEBUG(g_logger) << "idle";
     const uint64_t MAX_EVENT = 256;
     epoll_event* events = new epoll_event[MAX_EVENT]();
     std::shared_ptr<epoll_event> shared_events(events, [](epoll_event* ptr){
         delete[] ptr;
     });
+    int index = getWorkerIndex();
+    GLOBAL_ASSERT(index >= 0);
+    Waker& waker = *m_wakers[index];
+    // 分片模式下协程在观察到事件的reactor线程上恢复
+    int resume_thread = m_sharded ? Global::GetThreadId() : -1;
 
     while (true)
     {
+        // 每轮等待前后各刷新一次缓存时间, 本轮内的到期扫描不再读时钟
+        Global::RefreshCachedTime();
         uint64_t next_timeout = 0;
         if(stopping(next_timeout))
         {
-            std::cout << "name = " << getName()
-            << "idle stopping exit"<< std::endl;
+            GLOBAL_LOG_DEBUG(g_logger) << "name = " << getName()
+                << " idle stopping exit";
             break;
         }
+
+        if(m_uring)
+        {
+            // 本轮之前各协程准备的sqe一次提交
+            submitUring();
+        }
+
+        // 先标记挂起再检查任务, 与tickle()先放任务再检查parked配对
+        waker.parked = true;
+        std::atomic_thread_fence(std::memory_order_seq_cst);
         int count = 0;
-        do
+        if(!hasRunnableWork() && !stopping())
         {
-            static const int MAX_TIMEOUT = 3000;
-            if(next_timeout != ~0ull){
-                next_timeout = (int)next_timeout > MAX_TIMEOUT ? MAX_TIMEOUT : next_timeout;
-            }
-            else{
-                next_timeout = MAX_TIMEOUT;
+            // 共享模式下轮询线程负责共享epoll的IO
+            bool poller = !m_polling.exchange(true);
+            // 每个线程按自己队列中的定时器等待. 挂起标记之后再取, 与onTimerInsertedAtFront()配对
+            next_timeout = getNextTimerUs();
+            uint64_t timeout = next_timeout > MAX_TIMEOUT_US ? MAX_TIMEOUT_US : next_timeout;
+            if(poller || m_sharded)
+            {
+                count = waitEvents(waker, events, MAX_EVENT, timeout);
             }
-            // std::cout << "timeout: " << next_timeout <<std::endl;
-            count = epoll_wait(m_epollfd, events, MAX_EVENT, next_timeout);
-            // std::cout << "epoll_wait count: " << count << std::endl;
-            // std::cout << "pending event: " << m_pendingEventCount <<std::endl;
-            if(count < 0 && errno == EINTR)
-            { }
             else
             {
-                break;
+                // 其他线程只等待自己的eventfd, 超时后尝试接手轮询
+                pollfd pfd;
+                pfd.fd = waker.eventfd;
+                pfd.events = POLLIN;
+                pfd.revents = 0;
+                struct timespec ts;
+                ts.tv_sec = timeout / 1000000;
+                ts.tv_nsec = (timeout % 1000000) * 1000;
+                while(ppoll(&pfd, 1, &ts, NULL) < 0 && errno == EINTR);
+            }
+            if(poller)
+            {
+                m_polling = false;
+                if(!m_sharded)
+                {
+                    // 离开轮询去处理事件, 唤醒一个挂起的线程接手共享epoll,
+                    // 否则其他线程要等到各自的超时或下一次tickle才会有人轮询
+                    waker.parked = false;
+                    tickle();
+                }
             }
-        } while (true);
+        }
+        waker.parked = false;
+        Global::RefreshCachedTime();
+        if(waker.notified.exchange(false))
+        {
+            uint64_t dummy;
+            while(read(waker.eventfd, &dummy, sizeof(dummy)) > 0);
+        }
+
+        if(!m_sharded)
+        {
+            // 私有epoll只报告共享epoll是否可读, 再从共享epoll取出事件
+            bool poll_shared = false;
+            for(int i = 0; i < count; i++)
+            {
+                if(events[i].data.ptr == nullptr)
+                {
+                    poll_shared = true;
+                }
+            }
+            count = 0;
+            if(poll_shared)
+            {
+                do
+                {
+                    count = epoll_wait(m_epollfd, events, MAX_EVENT, 0);
+                } while(count < 0 && errno == EINTR);
+            }
+        }
         
-        std::vector<std::function<void()> > cbs;
+        std::vector<Task> cbs;
         listExpiredCb(cbs);
-        // std::cout << "cbs size = " << cbs.size() << std::endl;
         if(!cbs.empty())
         {
-            // std::cout << "on timer cbs size=" << cbs.size();
             schedule(cbs.begin(), cbs.end());
             cbs.clear();
         }
@@ -351,14 +599,17 @@ void IOManager::idle()
         for(int i = 0; i < count; i++)
         {
             epoll_event& event = events[i];
-            if(event.data.fd == m_tickleFds[0])
+            if(event.data.ptr == &waker || event.data.ptr == &waker.timerfd)
             {
-                uint8_t dummy;
-                while(read(m_tickleFds[0], &dummy, sizeof(dummy)) > 0);
                 continue;
             }
-            FdContext* fd_ctx = (FdContext*)event.data.ptr;
-            FdContext::MutexType::LockGuard lock(fd_ctx->mutex);
+            if(m_uring && event.data.ptr == m_uring.get())
+            {
+                reapUring();
+                continue;
+            }
+            FdCtx* fd_ctx = (FdCtx*)event.data.ptr;
+            FdCtx::MutexType::LockGuard lock(fd_ctx->m_mutex);
             if(event.events & (EPOLLERR | EPOLLHUP))
             {
                 event.events |= EPOLLIN | EPOLLOUT;
@@ -373,43 +624,187 @@ void IOManager::idle()
                 real_event |= WRITE;
             }
 
-            if((fd_ctx->events & real_event) == NONE)
+            if(m_persistent)
             {
-                continue;
+                // 没有等待者的方向锁存起来, 留给之后的addEvent
+                fd_ctx->m_ready |= real_event & ~fd_ctx->m_events;
             }
-            int left_event = (fd_ctx->events & ~real_event);
-            int op = left_event ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
-            event.events = EPOLLET | left_event;
-
-            int res = epoll_ctl(m_epollfd, op, fd_ctx->fd, &event);
-            if(res)
+            // EPOLLERR/EPOLLHUP会同时带上读写, 只处理已注册的事件
+            real_event &= fd_ctx->m_events;
+            if(real_event == NONE)
             {
-                std::cout << "epoll_ctl(" << m_epollfd << ", "
-                << ", " << fd_ctx->fd << ", " << (EPOLL_EVENTS)event.events << "):"
-                << res << " (" << errno << ") (" << strerror(errno) << std::endl;
                 continue;
             }
+            if(!m_persistent)
+            {
+                int left_event = (fd_ctx->m_events & ~real_event);
+                int op = left_event ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
+                event.events = EPOLLET | left_event;
+
+                int res = epoll_ctl(epollFd(fd_ctx), op, fd_ctx->m_fd, &event);
+                if(res)
+                {
+                    GLOBAL_LOG_ERROR(g_logger) << "epoll_ctl(" << epollFd(fd_ctx) << ", "
+                    << ", " << fd_ctx->m_fd << ", " << (EPOLL_EVENTS)event.events << "):"
+                    << res << " (" << errno << ") (" << strerror(errno) << ")";
+                    continue;
+                }
+            }
             if(real_event & READ)
             {
-                fd_ctx->triggerEvent(READ);
+                triggerEvent(fd_ctx, READ, resume_thread);
                 --m_pendingEventCount;
             }
             if(real_event & WRITE)
             {
-                fd_ctx->triggerEvent(WRITE);
+                triggerEvent(fd_ctx, WRITE, resume_thread);
                 --m_pendingEventCount;
             }
         }
-        Fiber::ptr cur = Fiber::GetThis();
-        auto raw_ptr = cur.get();
-        cur.reset();
-        raw_ptr->swapOut();
+        Fiber::GetCurrent()->swapOut();
+    }
+    Global::ResetCachedTime();
+}
+
+int IOManager::waitEvents(Waker& waker, epoll_event* events, int max_events, uint64_t timeout_us)
+{
+    int count;
+    if(m_pwait2)
+    {
+        do
+        {
+            count = epoll_pwait2_us(waker.epfd, events, max_events, timeout_us);
+        } while(count < 0 && errno == EINTR);
+        return count;
+    }
+    // 每次重新设置都会清除上次的到期计数, 不需要读timerfd. 超时为0时停止定时器, 非阻塞等待
+    itimerspec its;
+    memset(&its, 0, sizeof(its));
+    its.it_value.tv_sec = timeout_us / 1000000;
+    its.it_value.tv_nsec = (timeout_us % 1000000) * 1000;
+    int res = timerfd_settime(waker.timerfd, 0, &its, NULL);
+    GLOBAL_ASSERT(!res);
+    do
+    {
+        count = epoll_wait(waker.epfd, events, max_events, timeout_us ? -1 : 0);
+    } while(count < 0 && errno == EINTR);
+    return count;
+}
+
+ssize_t IOManager::submitIo(uint8_t opcode, int fd, const void* addr, uint32_t len
+                            , uint64_t off, uint32_t flags, uint64_t timeout_ms)
+{
+    GLOBAL_ASSERT(m_uring);
+    GLOBAL_ASSERT(!Fiber::GetCurrent()->isSharedStack());
+    UringRequest req;
+    req.fiber = Fiber::GetThis();
+    // 在提交前由内核拷贝, 协程挂起期间栈保持有效
+    __kernel_timespec ts;
+    ts.tv_sec = timeout_ms / 1000;
+    ts.tv_nsec = (timeout_ms % 1000) * 1000000;
+    bool has_timeout = timeout_ms != (uint64_t)-1;
+    {
+        MutexType::LockGuard lock(m_uringMutex);
+        // 带超时时两个sqe必须在同一次提交中
+        if(m_uring->space() < 2)
+        {
+            int res = m_uring->submit();
+            if(res == -EBUSY || res == -EAGAIN)
+            {
+                // 完成队列积压时内核拒收, 先收割完成事件再重试一次
+                lock.unlock();
+                reapUring();
+                lock.lock();
+                res = m_uring->submit();
+            }
+            if(res < 0 && res != -EBUSY && res != -EAGAIN)
+            {
+                GLOBAL_LOG_ERROR(g_logger) << "io_uring_enter error: " << strerror(-res);
+            }
+            if(m_uring->space() < 2)
+            {
+                // 仍然腾不出sqe, 由调用方改用epoll等待就绪
+                SetErrno(EAGAIN);
+                return -1;
+            }
+        }
+        io_uring_sqe* sqe = m_uring->getSqe();
+        GLOBAL_ASSERT(sqe);
+        sqe->opcode = opcode;
+        sqe->fd = fd;
+        sqe->addr = (uint64_t)(uintptr_t)addr;
+        sqe->len = len;
+        sqe->off = off;
+        sqe->msg_flags = flags;
+        sqe->user_data = (uint64_t)(uintptr_t)&req;
+        if(has_timeout)
+        {
+            sqe->flags |= IOSQE_IO_LINK;
+            io_uring_sqe* tsqe = m_uring->getSqe();
+            GLOBAL_ASSERT(tsqe);
+            tsqe->opcode = IORING_OP_LINK_TIMEOUT;
+            tsqe->fd = -1;
+            tsqe->addr = (uint64_t)(uintptr_t)&ts;
+            tsqe->len = 1;
+            tsqe->user_data = 0;
+        }
+        ++m_pendingEventCount;
+        if(m_uring->pending() >= URING_BATCH)
+        {
+            m_uring->submit();
+        }
+    }
+    // 本线程下一次进入空闲循环时提交
+    Fiber::YieldToHold();
+
+    if(req.res < 0)
+    {
+        SetErrno((req.res == -ECANCELED && has_timeout) ? ETIMEDOUT : -req.res);
+        return -1;
+    }
+    return req.res;
+}
+
+void IOManager::submitUring()
+{
+    MutexType::LockGuard lock(m_uringMutex);
+    if(m_uring->pending())
+    {
+        int res = m_uring->submit();
+        if(res < 0 && res != -EBUSY && res != -EAGAIN)
+        {
+            GLOBAL_LOG_ERROR(g_logger) << "io_uring_enter error: " << strerror(-res);
+        }
     }
-    
 }
 
-void IOManager::onTimerInsertedAtFront() {
-    tickle();
+void IOManager::reapUring()
+{
+    MutexType::LockGuard lock(m_uringMutex);
+    m_uring->reap([this](const io_uring_cqe& cqe){
+        // LINK_TIMEOUT的完成事件没有对应的协程
+        if(!cqe.user_data)
+        {
+            return;
+        }
+        UringRequest* req = (UringRequest*)(uintptr_t)cqe.user_data;
+        req->res = cqe.res;
+        // 协程恢复后req随栈失效, 先取出协程再调度
+        Fiber::ptr fiber;
+        fiber.swap(req->fiber);
+        --m_pendingEventCount;
+        schedule(&fiber);
+    });
+}
+
+void IOManager::onTimerInsertedAtFront(size_t queue) {
+    // 定时器队列与工作线程一一对应, 唤醒队列所属线程重新计算超时
+    tickleWorker(queue);
+}
+
+int IOManager::getTimerQueue()
+{
+    return getWorkerIndex();
 }
 
 } // namespace Global
@@ -2,10 +2,14 @@
 #define __IOMANAGER_H__
 #include "timer.h"
 #include "scheduler.h"
+#include "fd_manager.h"
 #include <memory>
 #include <functional>
+#include <sys/epoll.h>
 namespace Global
 {
+class IoUring;
+
 class IOManager : public Scheduler
                 , public TimerManager
 {
@@ -20,53 +24,141 @@ public:
         WRITE = 0x4
     };
 
-    IOManager(size_t threads = 1, bool use_caller = true, const std::string& name="");
+    /**
+     * @brief IO后端
+     */
+    enum Backend
+    {
+        /// 就绪通知: 等待fd可读写后由协程自己发起系统调用
+        EPOLL    = 0,
+        /// 完成通知: 由内核执行IO, 完成后恢复协程
+        IO_URING = 1
+    };
+
+    /**
+     * @param[in] sharded 是否为每个工作线程使用独立的epoll(多reactor模式),
+     *            fd在第一次addEvent时分配给当前工作线程, 事件触发后协程在该线程上恢复
+     * @param[in] backend IO后端, 内核不支持io_uring时回退到EPOLL.
+     *            IO_URING只使用一个共享的ring, 忽略sharded
+     * @param[in] persistent 是否持久注册: fd第一次addEvent时以EPOLLIN|EPOLLOUT|EPOLLET加入epoll,
+     *            直到cancelAll才移除, 没有等待者时到达的就绪状态锁存在FdCtx中,
+     *            之后的addEvent直接恢复, 不再调用epoll_ctl
+     */
+    IOManager(size_t threads = 1, bool use_caller = true, const std::string& name=""
+            , bool sharded = false, Backend backend = EPOLL, bool persistent = false);
     ~IOManager();
 
 public:
-    int addEvent(int fd, Event event, std::function<void()> cb = nullptr);
+    int addEvent(int fd, Event event, Task cb = nullptr);
     bool delEvent(int fd, Event event);
     bool cancelEvent(int fd, Event event);
     bool cancelAll(int fd);
+    /// 调用方已查到fd状态时使用, 省去再次查找
+    int addEvent(FdCtx* ctx, Event event, Task cb = nullptr);
+    bool cancelEvent(FdCtx* ctx, Event event);
     static IOManager* GetThis();
+    bool isSharded() const { return m_sharded; }
+    bool isPersistent() const { return m_persistent; }
+    /// 实际使用的后端
+    Backend getBackend() const { return m_uring ? IO_URING : EPOLL; }
+
+    /**
+     * @brief io_uring后端下提交一次IO, 挂起当前协程直到完成
+     * @details sqe在空闲循环开始时批量提交, 积累到URING_BATCH个时立即提交.
+     *          内核异步访问addr, 调用方不能是共享栈协程
+     * @param[in] opcode IORING_OP_*
+     * @param[in] addr, len, off 对应sqe中的同名字段
+     * @param[in] flags 对应sqe中的msg_flags/accept_flags
+     * @param[in] timeout_ms 超时时间, -1为不超时, 超时后errno为ETIMEDOUT
+     * @return 与对应的系统调用相同, 失败返回-1并设置errno;
+     *         提交队列满且内核暂时不接收时返回-1, errno为EAGAIN, 调用方应改用epoll等待
+     */
+    ssize_t submitIo(uint8_t opcode, int fd, const void* addr, uint32_t len
+                    , uint64_t off, uint32_t flags, uint64_t timeout_ms);
 
 protected:
     void tickle() override;
+    void tickleWorker(size_t index) override;
     bool stopping() override;
     void idle() override;
-    void onTimerInsertedAtFront() override;
+    void onTimerInsertedAtFront(size_t queue) override;
+    int getTimerQueue() override;
     bool stopping(uint64_t& timeout);
-    void contextResize(size_t size);
 
 private:
-    struct FdContext
+    FdCtx::EventContext& getEvent(FdCtx* ctx, Event event);
+    Task& getCallback(FdCtx* ctx, Event event);
+    void resetContext(FdCtx* ctx, Event event);
+    /**
+     * @brief 触发事件, 调度等待的协程或回调, 调用方持有ctx->m_mutex
+     * @param[in] thread 指定恢复的线程, -1为任意线程
+     */
+    void triggerEvent(FdCtx* ctx, Event event, int thread = -1);
+    
+private:
+
+    /**
+     * @brief 每个工作线程的唤醒器
+     * @details 同一时刻只有一个空闲线程持有轮询权, 阻塞在私有epoll(自己的eventfd + 共享的m_epollfd)上
+     *          处理共享IO, 其余空闲线程只阻塞在自己的eventfd上, 因此可以单独唤醒某个线程且IO不会惊群.
+     *          持有者醒来去处理事件时唤醒一个空闲线程接手轮询.
+     *          每个线程都按自己定时器队列的最近到期时间设置超时
+     */
+    struct Waker
     {
-        typedef Mutex MutexType;
-        struct EventContext
-        {
-            Scheduler* scheduler = nullptr;     // 所在调度器
-            Fiber::ptr fiber;                   // 所在协程
-            std::function<void()> cb;
-        };
-        
-        EventContext& getEvent(Event event);
-        void triggerEvent(Event event);
-        void resetContext(EventContext& ctx);
-        
-        int fd = 0;
-        EventContext read;                      // 读事件
-        EventContext write;                     // 写事件
-        Event events = NONE;                    // 事件类型
-        MutexType mutex;                        
+        int eventfd = -1;
+        int epfd = -1;
+        /// 内核不支持epoll_pwait2时提供微秒超时
+        int timerfd = -1;
+        /// 是否阻塞在epoll_wait中(或即将进入)
+        std::atomic<bool> parked = {false};
+        /// 是否已有未处理的唤醒, 避免重复write
+        std::atomic<bool> notified = {false};
     };
-    
+
+    bool wake(Waker& waker);
+    /**
+     * @brief 在waker的私有epoll上等待, 超时精确到微秒
+     * @details 优先用epoll_pwait2, 否则设置timerfd后无超时地epoll_wait
+     */
+    int waitEvents(Waker& waker, epoll_event* events, int max_events, uint64_t timeout_us);
+    /// fd所在的epoll实例
+    int epollFd(FdCtx* ctx) const;
+
+    /**
+     * @brief 一次io_uring请求, 位于发起协程的栈上, 地址作为user_data
+     */
+    struct UringRequest
+    {
+        Fiber::ptr fiber;
+        int res = 0;
+    };
+
+    /// 提交所有待提交的sqe
+    void submitUring();
+    /// 取出完成事件并调度对应协程
+    void reapUring();
+
 private:
 
     int m_epollfd = 0;
-    int m_tickleFds[2];
+    bool m_sharded = false;
+    bool m_persistent = false;
+    /// 实例编号, 从1开始不重复, 用于识别FdCtx中的注册状态属于哪个实例
+    uint64_t m_id;
+    /// 内核是否支持epoll_pwait2
+    bool m_pwait2 = false;
+    /// 非工作线程注册fd时轮转选择reactor
+    std::atomic<size_t> m_nextReactor = {0};
+    std::vector<std::unique_ptr<Waker> > m_wakers;
+    /// tickle()选择唤醒线程的起点, 轮转分散负载
+    std::atomic<size_t> m_nextWake = {0};
+    /// 是否已有线程持有轮询权
+    std::atomic<bool> m_polling = {false};
     std::atomic<size_t> m_pendingEventCount = {0};
-    RWMutexType m_mutex;    /// IOManager的Mutex
-    std::vector<FdContext*> m_fdContexts;
+    /// io_uring后端, 为空时使用epoll
+    std::unique_ptr<IoUring> m_uring;
+    Mutex m_uringMutex;
 };
 
 
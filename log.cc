@@ -0,0 +1,475 @@
+#include "log.h"
+#include "macro.h"
+#include "fiber.h"
+#include "thread.h"
+#include "utils.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+namespace Global
+{
+
+/// 每个线程环形缓冲的槽位数, 必须是2的幂
+static const size_t RING_SIZE = 1024;
+/// 后台线程没有被唤醒时的轮询间隔
+static const uint64_t FLUSH_INTERVAL_MS = 10;
+
+/**
+ * @brief 环形缓冲中的一条日志, 固定256字节
+ */
+struct LogRecord
+{
+    static const size_t HEADER_SIZE = 48;
+    static const size_t MSG_CAP = 256 - HEADER_SIZE;
+
+    uint64_t time;          // 微秒时间戳
+    uint64_t fiber;         // 协程id
+    Logger* logger;
+    const char* file;
+    std::string* spill;     // 超出msg容量时的完整内容
+    uint32_t line;
+    uint16_t len;
+    uint8_t level;
+    char msg[MSG_CAP];
+};
+
+static_assert(sizeof(LogRecord) == 256, "LogRecord should be 256 bytes");
+
+/**
+ * @brief 单生产者单消费者的环形缓冲
+ * @details 所属线程写tail, 消费方(持有LogWriter的锁)写head, 分别位于不同的cache line
+ */
+struct LogRing
+{
+    LogRing()
+        : tid(GetThreadId())
+        , name(Thread::GetName())
+    {
+    }
+
+    alignas(64) std::atomic<uint64_t> head{0};
+    alignas(64) std::atomic<uint64_t> tail{0};
+    /// 正在格式化一条日志
+    bool writing = false;
+    pid_t tid;
+    std::string name;
+    LogRecord records[RING_SIZE];
+};
+
+/**
+ * @brief 管理所有线程的环形缓冲, 由后台线程批量输出到标准输出
+ */
+class LogWriter
+{
+public:
+    typedef Mutex MutexType;
+
+    static LogWriter* GetInstance()
+    {
+        // 不析构, 静态对象析构期间仍可写日志(退化为同步输出)
+        static LogWriter* s_writer = new LogWriter;
+        return s_writer;
+    }
+
+    LogRing* createRing()
+    {
+        LogRing* ring = new LogRing;
+        MutexType::LockGuard lock(m_mutex);
+        m_rings.push_back(ring);
+        if(!m_thread && !m_stopped)
+        {
+            m_thread.reset(new Thread(std::bind(&LogWriter::run, this), "log"));
+            atexit(&LogWriter::Stop);
+        }
+        return ring;
+    }
+
+    /// 线程退出时输出剩余的日志并释放缓冲
+    void retireRing(LogRing* ring)
+    {
+        MutexType::LockGuard lock(m_mutex);
+        drain(ring);
+        flushBuffer();
+        for(auto it = m_rings.begin(); it != m_rings.end(); ++it)
+        {
+            if(*it == ring)
+            {
+                m_rings.erase(it);
+                break;
+            }
+        }
+        delete ring;
+    }
+
+    void flush()
+    {
+        MutexType::LockGuard lock(m_mutex);
+        drainAll();
+    }
+
+    /// 输出一条不经过缓冲的日志, 之前已提交的日志先输出
+    void writeSync(LogRing* owner, const LogRecord& record)
+    {
+        MutexType::LockGuard lock(m_mutex);
+        for(auto ring : m_rings)
+        {
+            drain(ring);
+        }
+        format(owner, record);
+        flushBuffer();
+    }
+
+    void wakeup() { m_semaphore.notify(); }
+
+    bool isRunning() const { return m_running.load(std::memory_order_acquire); }
+
+private:
+    LogWriter()
+    {
+        m_buffer.reserve(64 * 1024);
+    }
+
+    static void Stop()
+    {
+        LogWriter* writer = GetInstance();
+        Thread::ptr thread;
+        {
+            MutexType::LockGuard lock(writer->m_mutex);
+            writer->m_stopped = true;
+            thread = writer->m_thread;
+        }
+        if(thread)
+        {
+            writer->wakeup();
+            thread->join();
+        }
+        writer->flush();
+    }
+
+    void run()
+    {
+        m_running.store(true, std::memory_order_release);
+        while(true)
+        {
+            m_semaphore.waitFor(FLUSH_INTERVAL_MS);
+            MutexType::LockGuard lock(m_mutex);
+            drainAll();
+            if(m_stopped)
+            {
+                break;
+            }
+        }
+        m_running.store(false, std::memory_order_release);
+    }
+
+    void drainAll()
+    {
+        for(auto ring : m_rings)
+        {
+            drain(ring);
+        }
+        flushBuffer();
+    }
+
+    /// 取出ring中已提交的日志, 调用方持有m_mutex
+    void drain(LogRing* ring)
+    {
+        uint64_t head = ring->head.load(std::memory_order_relaxed);
+        uint64_t tail = ring->tail.load(std::memory_order_acquire);
+        for(; head != tail; ++head)
+        {
+            LogRecord& record = ring->records[head & (RING_SIZE - 1)];
+            format(ring, record);
+            delete record.spill;
+            record.spill = nullptr;
+            if(m_buffer.size() >= 60 * 1024)
+            {
+                flushBuffer();
+            }
+        }
+        ring->head.store(head, std::memory_order_release);
+    }
+
+    /**
+     * @brief 格式化一条日志到m_buffer
+     * @details 时间 线程id 线程名 协程id [级别] [日志器] 文件:行号 内容
+     */
+    void format(LogRing* ring, const LogRecord& record)
+    {
+        time_t sec = record.time / 1000000;
+        if(sec != m_lastSec)
+        {
+            struct tm tm;
+            localtime_r(&sec, &tm);
+            strftime(m_secBuf, sizeof(m_secBuf), "%Y-%m-%d %H:%M:%S", &tm);
+            m_lastSec = sec;
+        }
+        char head[128];
+        int n = snprintf(head, sizeof(head), "%s.%06u\t%d\t"
+                    , m_secBuf, (unsigned)(record.time % 1000000), ring ? (int)ring->tid : 0);
+        m_buffer.append(head, n);
+        if(ring)
+        {
+            m_buffer.append(ring->name);
+        }
+        n = snprintf(head, sizeof(head), "\t%llu\t[%s]\t["
+                    , (unsigned long long)record.fiber, LogLevel::ToString((LogLevel::Level)record.level));
+        m_buffer.append(head, n);
+        m_buffer.append(record.logger->getName());
+        m_buffer.append("]\t", 2);
+        m_buffer.append(record.file);
+        n = snprintf(head, sizeof(head), ":%u\t", record.line);
+        m_buffer.append(head, n);
+        if(record.spill)
+        {
+            m_buffer.append(*record.spill);
+        }
+        else
+        {
+            m_buffer.append(record.msg, record.len);
+        }
+        m_buffer.push_back('\n');
+    }
+
+    void flushBuffer()
+    {
+        size_t offset = 0;
+        while(offset < m_buffer.size())
+        {
+            ssize_t rt = ::write(STDOUT_FILENO, m_buffer.data() + offset, m_buffer.size() - offset);
+            if(rt < 0)
+            {
+                if(errno == EINTR) continue;
+                break;
+            }
+            offset += rt;
+        }
+        m_buffer.clear();
+    }
+
+private:
+    MutexType m_mutex;
+    std::vector<LogRing*> m_rings;
+    Thread::ptr m_thread;
+    Semaphore m_semaphore;
+    std::atomic<bool> m_running{false};
+    bool m_stopped = false;
+    std::string m_buffer;
+    time_t m_lastSec = 0;
+    char m_secBuf[32] = {0};
+};
+
+/**
+ * @brief 线程退出时归还缓冲
+ */
+struct LogRingHolder
+{
+    ~LogRingHolder()
+    {
+        if(ring)
+        {
+            LogWriter::GetInstance()->retireRing(ring);
+            ring = nullptr;
+        }
+        dead = true;
+    }
+
+    LogRing* ring = nullptr;
+    bool dead = false;
+};
+
+static thread_local LogRingHolder t_ring;
+
+/// 当前线程可用的缓冲, 不可用时返回nullptr
+static LogRing* AcquireRing()
+{
+    LogRing* ring = t_ring.ring;
+    if(GLOBAL_UNLIKELY(!ring))
+    {
+        if(t_ring.dead)
+        {
+            return nullptr;
+        }
+        ring = t_ring.ring = LogWriter::GetInstance()->createRing();
+    }
+    if(GLOBAL_UNLIKELY(ring->writing))
+    {
+        return nullptr;
+    }
+    uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+    if(GLOBAL_UNLIKELY(tail - ring->head.load(std::memory_order_acquire) >= RING_SIZE))
+    {
+        // 缓冲已满, 同步输出而不是丢弃
+        LogWriter::GetInstance()->flush();
+    }
+    ring->writing = true;
+    return ring;
+}
+
+static LogRecord* ReserveRecord(LogRing* ring)
+{
+    if(ring)
+    {
+        uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+        return &ring->records[tail & (RING_SIZE - 1)];
+    }
+    LogRecord* record = new LogRecord;
+    record->spill = nullptr;
+    return record;
+}
+
+const char* LogLevel::ToString(Level level)
+{
+    switch(level)
+    {
+#define XX(name) \
+    case LogLevel::name: \
+        return #name;
+    XX(DEBUG);
+    XX(INFO);
+    XX(WARN);
+    XX(ERROR);
+    XX(FATAL);
+#undef XX
+    default:
+        return "UNKNOW";
+    }
+}
+
+Logger::Logger(const std::string& name, LogLevel::Level level)
+    : m_name(name)
+    , m_level(level)
+{
+}
+
+LoggerManager::LoggerManager()
+{
+    m_root.reset(new Logger("root"));
+    m_loggers[m_root->getName()] = m_root;
+}
+
+Logger::ptr LoggerManager::getLogger(const std::string& name)
+{
+    MutexType::LockGuard lock(m_mutex);
+    auto it = m_loggers.find(name);
+    if(it != m_loggers.end())
+    {
+        return it->second;
+    }
+    Logger::ptr logger(new Logger(name));
+    m_loggers[name] = logger;
+    return logger;
+}
+
+LogStream& LogStream::operator<<(double v)
+{
+    char buf[32];
+    int n = snprintf(buf, sizeof(buf), "%g", v);
+    append(buf, n);
+    return *this;
+}
+
+LogStream& LogStream::operator<<(const void* v)
+{
+    char buf[2 + 16];
+    char* end = buf + sizeof(buf);
+    char* p = end;
+    uintptr_t value = (uintptr_t)v;
+    do
+    {
+        *--p = "0123456789abcdef"[value & 0xf];
+        value >>= 4;
+    } while(value);
+    *--p = 'x';
+    *--p = '0';
+    append(p, end - p);
+    return *this;
+}
+
+void LogStream::appendSigned(long long v)
+{
+    if(v < 0)
+    {
+        append("-", 1);
+        appendUnsigned(0ull - (unsigned long long)v);
+    }
+    else
+    {
+        appendUnsigned(v);
+    }
+}
+
+void LogStream::appendUnsigned(unsigned long long v)
+{
+    char buf[20];
+    char* end = buf + sizeof(buf);
+    char* p = end;
+    do
+    {
+        *--p = '0' + v % 10;
+        v /= 10;
+    } while(v);
+    append(p, end - p);
+}
+
+void LogStream::appendSlow(const char* data, size_t len)
+{
+    if(!m_spill)
+    {
+        m_spill = new std::string(m_buf, m_len);
+    }
+    m_spill->append(data, len);
+}
+
+LogLine::LogLine(Logger& logger, LogLevel::Level level, const char* file, int line)
+    : m_ring(AcquireRing())
+    , m_record(ReserveRecord(m_ring))
+    , m_stream(m_record->msg, LogRecord::MSG_CAP)
+{
+    m_record->logger = &logger;
+    m_record->file = file;
+    m_record->line = line;
+    m_record->level = level;
+}
+
+LogLine::~LogLine()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    m_record->time = ts.tv_sec * 1000000ul + ts.tv_nsec / 1000;
+    m_record->fiber = Fiber::GetFiberId();
+    m_record->len = m_stream.size();
+    m_record->spill = m_stream.releaseSpill();
+    LogWriter* writer = LogWriter::GetInstance();
+    if(!m_ring)
+    {
+        writer->writeSync(t_ring.dead ? nullptr : t_ring.ring, *m_record);
+        delete m_record->spill;
+        delete m_record;
+        return;
+    }
+    uint64_t tail = m_ring->tail.load(std::memory_order_relaxed) + 1;
+    m_ring->tail.store(tail, std::memory_order_release);
+    m_ring->writing = false;
+    if(m_record->level >= LogLevel::FATAL || !writer->isRunning())
+    {
+        writer->flush();
+    }
+    else if(tail - m_ring->head.load(std::memory_order_relaxed) == RING_SIZE / 2)
+    {
+        // 过半时提前唤醒后台线程
+        writer->wakeup();
+    }
+}
+
+void LogFlush()
+{
+    LogWriter::GetInstance()->flush();
+}
+
+} // namespace Global
@@ -0,0 +1,210 @@
+#ifndef __LOG_H__
+#define __LOG_H__
+
+#include "mutex.h"
+#include "singleton.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <type_traits>
+
+/**
+ * @brief 编译期日志级别, 低于该级别的日志语句条件为常量, 整条语句(包括参数求值)被编译器删除
+ * @details 0 DEBUG, 1 INFO, 2 WARN, 3 ERROR, 4 FATAL, 5 全部关闭
+ */
+#ifndef GLOBAL_LOG_ACTIVE_LEVEL
+#define GLOBAL_LOG_ACTIVE_LEVEL 1
+#endif
+
+/**
+ * @brief 使用流式方式写日志
+ * @details 先做编译期过滤, 再检查logger的运行时级别, 都通过才构造LogLine
+ */
+#define GLOBAL_LOG_LEVEL(logger, level) \
+    if((int)(level) < GLOBAL_LOG_ACTIVE_LEVEL || !(logger)->isEnabled(level)) {} \
+    else Global::LogLine(*(logger), level, __FILE__, __LINE__).stream()
+
+#define GLOBAL_LOG_DEBUG(logger) GLOBAL_LOG_LEVEL(logger, Global::LogLevel::DEBUG)
+#define GLOBAL_LOG_INFO(logger) GLOBAL_LOG_LEVEL(logger, Global::LogLevel::INFO)
+#define GLOBAL_LOG_WARN(logger) GLOBAL_LOG_LEVEL(logger, Global::LogLevel::WARN)
+#define GLOBAL_LOG_ERROR(logger) GLOBAL_LOG_LEVEL(logger, Global::LogLevel::ERROR)
+/// FATAL日志写入后同步刷出所有线程的缓冲
+#define GLOBAL_LOG_FATAL(logger) GLOBAL_LOG_LEVEL(logger, Global::LogLevel::FATAL)
+
+/// 获取主日志器
+#define GLOBAL_LOG_ROOT() Global::LoggerMgr::GetInstance()->getRoot()
+
+/// 获取name的日志器, 不存在时创建
+#define GLOBAL_LOG_NAME(name) Global::LoggerMgr::GetInstance()->getLogger(name)
+
+namespace Global
+{
+
+/**
+ * @brief 日志级别
+ */
+class LogLevel
+{
+public:
+    enum Level
+    {
+        DEBUG = 0,
+        INFO = 1,
+        WARN = 2,
+        ERROR = 3,
+        FATAL = 4,
+    };
+
+    static const char* ToString(Level level);
+};
+
+/**
+ * @brief 日志器, 只保存名称和运行时级别, 输出统一由后台线程完成
+ */
+class Logger : Noncopyable
+{
+public:
+    typedef std::shared_ptr<Logger> ptr;
+
+    Logger(const std::string& name, LogLevel::Level level = LogLevel::DEBUG);
+
+    const std::string& getName() const { return m_name; }
+    LogLevel::Level getLevel() const { return m_level.load(std::memory_order_relaxed); }
+    void setLevel(LogLevel::Level level) { m_level.store(level, std::memory_order_relaxed); }
+    bool isEnabled(LogLevel::Level level) const { return level >= getLevel(); }
+
+private:
+    std::string m_name;
+    std::atomic<LogLevel::Level> m_level;
+};
+
+/**
+ * @brief 日志器管理
+ * @details 日志器创建后不会释放, 缓冲中的日志可以直接引用它
+ */
+class LoggerManager
+{
+public:
+    typedef Mutex MutexType;
+
+    LoggerManager();
+    const Logger::ptr& getRoot() const { return m_root; }
+    Logger::ptr getLogger(const std::string& name);
+
+private:
+    MutexType m_mutex;
+    Logger::ptr m_root;
+    std::map<std::string, Logger::ptr> m_loggers;
+};
+
+typedef Singleton<LoggerManager> LoggerMgr;
+
+/**
+ * @brief 一条日志的格式化输出
+ * @details 直接格式化到调用线程环形缓冲的槽位中, 不经过std::ostream, 不分配内存;
+ *          超出槽位容量时才转存到堆上的字符串
+ */
+class LogStream : Noncopyable
+{
+public:
+    LogStream(char* buf, size_t cap)
+        : m_buf(buf)
+        , m_cap(cap)
+    {
+    }
+
+    ~LogStream() { delete m_spill; }
+
+    LogStream& operator<<(const char* v)
+    {
+        if(v) append(v, strlen(v));
+        else append("(null)", 6);
+        return *this;
+    }
+    LogStream& operator<<(const std::string& v) { append(v.data(), v.size()); return *this; }
+    LogStream& operator<<(char v) { append(&v, 1); return *this; }
+    LogStream& operator<<(bool v) { append(v ? "1" : "0", 1); return *this; }
+    LogStream& operator<<(int v) { appendSigned(v); return *this; }
+    LogStream& operator<<(long v) { appendSigned(v); return *this; }
+    LogStream& operator<<(long long v) { appendSigned(v); return *this; }
+    LogStream& operator<<(unsigned v) { appendUnsigned(v); return *this; }
+    LogStream& operator<<(unsigned long v) { appendUnsigned(v); return *this; }
+    LogStream& operator<<(unsigned long long v) { appendUnsigned(v); return *this; }
+    LogStream& operator<<(double v);
+    LogStream& operator<<(const void* v);
+
+    /// 其余类型通过其operator<<(std::ostream&)输出, 较慢
+    template<class T>
+    typename std::enable_if<!std::is_arithmetic<T>::value
+                && !std::is_enum<T>::value
+                && !std::is_pointer<T>::value, LogStream&>::type
+    operator<<(const T& v)
+    {
+        std::ostringstream ss;
+        ss << v;
+        return *this << ss.str();
+    }
+
+    void append(const char* data, size_t len)
+    {
+        if(!m_spill && m_len + len <= m_cap)
+        {
+            memcpy(m_buf + m_len, data, len);
+            m_len += len;
+            return;
+        }
+        appendSlow(data, len);
+    }
+
+    /// 取出内容, 超出槽位时返回堆上的完整字符串, 所有权交给调用方
+    size_t size() const { return m_len; }
+    std::string* releaseSpill() { std::string* s = m_spill; m_spill = nullptr; return s; }
+
+private:
+    void appendSigned(long long v);
+    void appendUnsigned(unsigned long long v);
+    void appendSlow(const char* data, size_t len);
+
+private:
+    char* m_buf;
+    size_t m_cap;
+    size_t m_len = 0;
+    std::string* m_spill = nullptr;
+};
+
+struct LogRecord;
+struct LogRing;
+
+/**
+ * @brief 一条日志语句, 析构时提交到当前线程的环形缓冲
+ * @details 每个线程一个单生产者单消费者的环形缓冲, 写入只有一次release store;
+ *          后台线程定期批量取出, 格式化时间等字段后一次write输出
+ */
+class LogLine : Noncopyable
+{
+public:
+    LogLine(Logger& logger, LogLevel::Level level, const char* file, int line);
+    ~LogLine();
+
+    LogStream& stream() { return m_stream; }
+
+private:
+    /// 为空时同步输出: 线程的缓冲已销毁, 或格式化参数时又写了日志
+    LogRing* m_ring;
+    LogRecord* m_record;
+    LogStream m_stream;
+};
+
+/**
+ * @brief 同步刷出所有线程已提交的日志
+ */
+void LogFlush();
+
+} // namespace Global
+
+#endif
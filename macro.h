@@ -1,8 +1,8 @@
 #ifndef __MACRO_H__
 #define __MACRO_H__
 #include "utils.h"
+#include "log.h"
 
-#include <iostream>
 #include <assert.h>
 #include <string.h>
 namespace Global
@@ -18,9 +18,10 @@ namespace Global
 #   define GLOBAL_UNLIKELY(X)   __builtin_expect(X)
 #endif
 
+/// 断言失败以FATAL级别写日志, 在abort之前同步刷出所有线程的日志
 #define GLOBAL_ASSERT(x) \
     if(!(x)) { \
-        std::cout << "ASSERTINO:" #x \
+        GLOBAL_LOG_FATAL(GLOBAL_LOG_ROOT()) << "ASSERTINO:" #x \
         << "\nbacktrace: \n" \
         << Global::BacktraceToString(100, 2, "       "); \
         assert(x); \
@@ -29,7 +30,7 @@ namespace Global
 
 #define GLOBAL_ASSERT2(x, w) \
     if(!(x)) { \
-        std::cout << "ASSERTINO:" #x \
+        GLOBAL_LOG_FATAL(GLOBAL_LOG_ROOT()) << "ASSERTINO:" #x \
         << "\n" << w \
         << "\nbacktrace: \n" \
         << Global::BacktraceToString(100, 2, "       "); \
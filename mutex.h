@@ -23,6 +23,8 @@ public:
     Semaphore(uint32_t count = 0);
     ~Semaphore();
     void wait();
+    /// 最多等待ms毫秒, 超时返回false
+    bool waitFor(uint64_t ms);
     void notify();
 
 private:
@@ -42,7 +44,7 @@ public:
     
     ~ScopedLockImpl()
     {
-        m_mutex.unlock();
+        unlock();
     }
 
     void lock()
@@ -50,7 +52,7 @@ public:
         if(!m_locked)
         {
             m_mutex.lock();
-            m_locked = false;
+            m_locked = true;
         }
     }
 
@@ -80,7 +82,7 @@ public:
     
     ~ReadScopedLockImpl()
     {
-        m_mutex.unlock();
+        unlock();
     }
 
     void lock()
@@ -118,7 +120,7 @@ public:
     
     ~WriteScopedLockImpl()
     {
-        m_mutex.unlock();
+        unlock();
     }
 
     void lock()
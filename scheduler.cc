@@ -5,8 +5,85 @@
 namespace Global
 {
 
+static Logger::ptr g_logger = GLOBAL_LOG_NAME("system");
+
+
 static thread_local Fiber* t_scheduler_fiber = nullptr;
 static thread_local Scheduler* t_scheduler = nullptr;
+/// 当前线程作为工作线程所属的调度器及其本地队列下标
+static thread_local Scheduler* t_worker_owner = nullptr;
+static thread_local size_t t_worker_index = 0;
+
+static std::atomic<size_t> s_fiber_pool_size{64};
+static std::atomic<uint64_t> s_fiber_created{0};
+static std::atomic<uint64_t> s_fiber_reused{0};
+
+/**
+ * @brief 每个线程缓存已结束的协程, 栈保持挂载, 复用时只需reset
+ */
+struct FiberPool
+{
+    /// [0]私有栈 [1]共享栈
+    std::vector<Fiber::ptr> fibers[2];
+};
+
+static thread_local FiberPool t_fiber_pool;
+
+static Fiber::ptr AcquireFiber(Task& cb, bool shared_stack)
+{
+    std::vector<Fiber::ptr>& pool = t_fiber_pool.fibers[shared_stack];
+    if(!pool.empty())
+    {
+        Fiber::ptr fiber;
+        fiber.swap(pool.back());
+        pool.pop_back();
+        fiber->reset(std::move(cb));
+        ++s_fiber_reused;
+        return fiber;
+    }
+    ++s_fiber_created;
+    return Fiber::ptr(new Fiber(std::move(cb), 0, false, shared_stack));
+}
+
+// 只回收没有其他持有者且栈为默认大小的协程
+static void ReleaseFiber(Fiber::ptr& fiber)
+{
+    if(fiber.use_count() != 1)
+    {
+        return;
+    }
+    if(!fiber->isSharedStack()
+        && fiber->getStackSize() != Fiber::GetDefaultStackSize())
+    {
+        return;
+    }
+    std::vector<Fiber::ptr>& pool = t_fiber_pool.fibers[fiber->isSharedStack()];
+    if(pool.size() >= s_fiber_pool_size)
+    {
+        return;
+    }
+    fiber->reset(nullptr);
+    pool.push_back(fiber);
+}
+
+/**
+ * @brief 每个线程缓存本地队列节点的内存, 避免每次schedule都分配
+ */
+struct ItemCache
+{
+    static const size_t MAX_SIZE = 1024;
+    std::vector<void*> blocks;
+
+    ~ItemCache()
+    {
+        for(auto p : blocks)
+        {
+            ::operator delete(p);
+        }
+    }
+};
+
+static thread_local ItemCache t_item_cache;
 
 
 Scheduler::Scheduler(size_t threads, bool use_caller, const std::string& name)
@@ -14,7 +91,7 @@ Scheduler::Scheduler(size_t threads, bool use_caller, const std::string& name)
     assert(threads > 0);
     if(use_caller)
     {
-        Global::Fiber::GetThis();
+        Global::Fiber::GetCurrent();
         --threads;
         assert(GetThis() == nullptr);   // 目前线程在初始化前不存在Scheduler
         t_scheduler = this;
@@ -30,6 +107,12 @@ Scheduler::Scheduler(size_t threads, bool use_caller, const std::string& name)
          m_rootThread = -1;         // 任意线程
     }
     m_threadCount = threads;
+
+    size_t count = m_threadCount + (use_caller ? 1 : 0);
+    for(size_t i = 0; i < count; i++)
+    {
+        m_workers.emplace_back(new Worker(2654435761u * (i + 1)));
+    }
 }
 
 Scheduler::~Scheduler()
@@ -55,6 +138,338 @@ Fiber* Scheduler::GetMainFiber()
     return t_scheduler_fiber;
 }
 
+void Scheduler::SetFiberPoolSize(size_t size)
+{
+    s_fiber_pool_size = size;
+}
+
+Scheduler::FiberPoolStats Scheduler::GetFiberPoolStats()
+{
+    FiberPoolStats stats;
+    stats.created = s_fiber_created;
+    stats.reused = s_fiber_reused;
+    return stats;
+}
+
+Scheduler::FiberAndThread* Scheduler::NewItem(FiberAndThread&& ft)
+{
+    std::vector<void*>& blocks = t_item_cache.blocks;
+    void* p = nullptr;
+    if(!blocks.empty())
+    {
+        p = blocks.back();
+        blocks.pop_back();
+    }
+    else
+    {
+        p = ::operator new(sizeof(FiberAndThread));
+    }
+    return new (p) FiberAndThread(std::move(ft));
+}
+
+void Scheduler::DeleteItem(FiberAndThread* item)
+{
+    item->~FiberAndThread();
+    std::vector<void*>& blocks = t_item_cache.blocks;
+    if(blocks.size() < ItemCache::MAX_SIZE)
+    {
+        blocks.push_back(item);
+    }
+    else
+    {
+        ::operator delete(item);
+    }
+}
+
+int Scheduler::getWorkerIndex() const
+{
+    return t_worker_owner == this ? (int)t_worker_index : -1;
+}
+
+bool Scheduler::hasRunnableWork()
+{
+    Worker* worker = currentWorker();
+    if(worker && (worker->mailboxCount > 0 || !worker->yielded.empty()))
+    {
+        return true;
+    }
+    if(m_globalCount > 0)
+    {
+        return true;
+    }
+    for(auto& i : m_workers)
+    {
+        if(!i->queue.empty())
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+Scheduler::Worker* Scheduler::currentWorker()
+{
+    if(t_worker_owner != this)
+    {
+        return nullptr;
+    }
+    return m_workers[t_worker_index].get();
+}
+
+int Scheduler::findWorker(int thread) const
+{
+    for(size_t i = 0; i < m_workers.size(); i++)
+    {
+        if(m_workers[i]->threadId == thread)
+        {
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+void Scheduler::postToMailbox(size_t index, FiberAndThread&& ft)
+{
+    Worker* worker = m_workers[index].get();
+    bool need_tickle = false;
+    {
+        MutexType::LockGuard Lock(worker->mutex);
+        need_tickle = worker->mailbox.empty();
+        worker->mailbox.push_back(std::move(ft));
+        ++worker->mailboxCount;
+    }
+    // 只唤醒目标线程, 目标是自己时不需要唤醒
+    if(need_tickle && worker != currentWorker())
+    {
+        tickleWorker(index);
+    }
+}
+
+void Scheduler::registerWorker(size_t index)
+{
+    std::deque<FiberAndThread> pinned;
+    {
+        MutexType::LockGuard Lock(m_mutex);
+        m_workers[index]->threadId = Global::GetThreadId();
+        auto it = m_pinned.begin();
+        while(it != m_pinned.end())
+        {
+            if(it->thread == Global::GetThreadId())
+            {
+                pinned.push_back(std::move(*it));
+                it = m_pinned.erase(it);
+            }
+            else
+            {
+                ++it;
+            }
+        }
+    }
+    for(auto& i : pinned)
+    {
+        postToMailbox(index, std::move(i));
+    }
+}
+
+bool Scheduler::MarkReady(Fiber* fiber)
+{
+    Fiber::State state = fiber->m_state.load(std::memory_order_acquire);
+    while(state == Fiber::EXEC || state == Fiber::HOLD)
+    {
+        if(fiber->m_state.compare_exchange_weak(state, Fiber::READY
+                    , std::memory_order_acq_rel, std::memory_order_acquire))
+        {
+            // 已切出的由唤醒方放入队列; 还在执行的由执行它的线程在切出后放入, 不在队列里空转
+            return state == Fiber::HOLD;
+        }
+    }
+    // READY已在队列中, 不重复放入; INIT/TERM/EXCEPT照常放入
+    return state != Fiber::READY;
+}
+
+void Scheduler::switchedOut(Fiber::ptr& fiber)
+{
+    Fiber::State state = fiber->m_state.load(std::memory_order_relaxed);
+    if(state == Fiber::EXEC)
+    {
+        // 上下文已经保存, 这时才以release发布HOLD
+        if(fiber->m_state.compare_exchange_strong(state, Fiber::HOLD
+                    , std::memory_order_acq_rel, std::memory_order_relaxed))
+        {
+            return;
+        }
+        // 切出之前已被唤醒, 唤醒方把放入队列留给了本线程
+        if(enqueue(FiberAndThread(std::move(fiber), -1)))
+        {
+            tickle();
+        }
+    }
+    else if(state == Fiber::READY)
+    {
+        if(enqueue(FiberAndThread(std::move(fiber), -1), true))
+        {
+            tickle();
+        }
+    }
+    else
+    {
+        ReleaseFiber(fiber);
+    }
+}
+
+bool Scheduler::enqueue(FiberAndThread&& ft, bool yield)
+{
+    if(!ft.fiber && !ft.cb)
+    {
+        return false;
+    }
+    if(ft.fiber && ft.fiber->getBoundThread() != -1)
+    {
+        ft.thread = ft.fiber->getBoundThread();     // 共享栈协程只能回到原线程
+    }
+    ++m_taskCount;
+    if(ft.thread != -1)
+    {
+        int index = findWorker(ft.thread);
+        if(index == -1)
+        {
+            MutexType::LockGuard Lock(m_mutex);
+            // 加锁后再查一次, 与registerWorker互斥
+            index = findWorker(ft.thread);
+            if(index == -1)
+            {
+                m_pinned.push_back(std::move(ft));
+                return false;
+            }
+        }
+        postToMailbox(index, std::move(ft));
+        return false;
+    }
+    Worker* worker = currentWorker();
+    if(worker && yield)
+    {
+        worker->yielded.push_back(std::move(ft));
+        return false;
+    }
+    if(worker)
+    {
+        FiberAndThread* item = NewItem(std::move(ft));
+        if(worker->queue.push(item))
+        {
+            return hasIdleThreads();    // 唤醒空闲线程来窃取
+        }
+        ft = std::move(*item);          // 本地队列已满, 转入全局队列
+        DeleteItem(item);
+    }
+    MutexType::LockGuard Lock(m_mutex);
+    bool need_tickle = m_fibers.empty();
+    m_fibers.push_back(std::move(ft));
+    ++m_globalCount;
+    return need_tickle;
+}
+
+bool Scheduler::dequeueMailbox(Worker* worker, FiberAndThread& ft)
+{
+    if(worker->mailboxCount == 0)
+    {
+        return false;
+    }
+    MutexType::LockGuard Lock(worker->mutex);
+    if(worker->mailbox.empty())
+    {
+        return false;
+    }
+    ft = std::move(worker->mailbox.front());
+    worker->mailbox.pop_front();
+    --worker->mailboxCount;
+    return true;
+}
+
+bool Scheduler::dequeueGlobal(FiberAndThread& ft, bool& tickle_me)
+{
+    if(m_globalCount == 0)
+    {
+        return false;
+    }
+    MutexType::LockGuard Lock(m_mutex);
+    if(m_fibers.empty())
+    {
+        return false;
+    }
+    ft = std::move(m_fibers.front());
+    m_fibers.pop_front();
+    --m_globalCount;
+    tickle_me |= !m_fibers.empty();     // 发出信号通知其他线程处理
+    return true;
+}
+
+bool Scheduler::stealFrom(Worker* self, FiberAndThread& ft)
+{
+    size_t count = m_workers.size();
+    if(count <= 1)
+    {
+        return false;
+    }
+    // xorshift随机选择起始受害者, 避免所有线程同时窃取同一个队列
+    uint32_t& seed = self->seed;
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    size_t start = seed % count;
+    for(size_t i = 0; i < count; i++)
+    {
+        Worker* victim = m_workers[(start + i) % count].get();
+        if(victim == self)
+        {
+            continue;
+        }
+        // CAS失败说明元素已被其他线程取走, 换下一个受害者, 不在同一个队列上自旋
+        FiberAndThread* item = nullptr;
+        if(victim->queue.steal(item))
+        {
+            ft = std::move(*item);
+            DeleteItem(item);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool Scheduler::dequeue(FiberAndThread& ft, bool& tickle_me)
+{
+    Worker* worker = currentWorker();
+    if(!worker)
+    {
+        return dequeueGlobal(ft, tickle_me);
+    }
+    if(dequeueMailbox(worker, ft))
+    {
+        return true;
+    }
+    if(++worker->tick % GLOBAL_QUEUE_INTERVAL == 0
+        && dequeueGlobal(ft, tickle_me))
+    {
+        return true;
+    }
+    // 所属线程从尾部取(LIFO), 只有最后一个元素才与窃取者竞争
+    FiberAndThread* item = nullptr;
+    if(worker->queue.pop(item))
+    {
+        ft = std::move(*item);
+        DeleteItem(item);
+        tickle_me |= !worker->queue.empty() && hasIdleThreads();
+        return true;
+    }
+    // 让出的协程排在本地队列之后, 不会饿死其他任务, 也不会落到全局队列积压的任务之后
+    if(!worker->yielded.empty())
+    {
+        ft = std::move(worker->yielded.front());
+        worker->yielded.pop_front();
+        return true;
+    }
+    return dequeueGlobal(ft, tickle_me) || stealFrom(worker, ft);
+}
+
 void Scheduler::start()
 {
     MutexType::LockGuard Lock(m_mutex);
@@ -83,7 +498,7 @@ void Scheduler::stop()
             && (m_rootFiber->getState() == Fiber::TERM
                 || m_rootFiber->getState() == Fiber::INIT))
     {
-        std::cout << "stop" << std::endl;
+        GLOBAL_LOG_DEBUG(g_logger) << "stop";
         m_stopping = true;
         if(stopping())
         {
@@ -100,13 +515,9 @@ void Scheduler::stop()
     }
     m_stopping = true;
 
-    for(size_t i = 0; i < m_threadCount; i++)
-    {
-        tickle();   // 唤醒线程自行结束
-    }
-    if(m_rootFiber)
+    for(size_t i = 0; i < m_workers.size(); i++)
     {
-        tickle();
+        tickleWorker(i);    // 唤醒线程自行结束
     }
     if(m_rootFiber)
     {
@@ -129,15 +540,21 @@ void Scheduler::stop()
 
 void Scheduler::run()
 {
-    std::cout << m_name << "run" << std::endl;
+    GLOBAL_LOG_DEBUG(g_logger) << m_name << " run";
     setThis();      // 多线程设置thread_local
     set_hook_enable(true);
     if(m_rootThread != Global::GetThreadId())
     {
-        t_scheduler_fiber = Fiber::GetThis().get();     //Fiber里的threadFiber
+        t_scheduler_fiber = Fiber::GetCurrent();     //Fiber里的threadFiber
+    }
+    size_t index = m_nextWorker++;
+    if(index < m_workers.size())
+    {
+        t_worker_owner = this;
+        t_worker_index = index;
+        registerWorker(index);
     }
     Fiber::ptr idle_fiber(new Fiber(std::bind(&Scheduler::idle, this)));
-    Fiber::ptr cb_fiber;
     FiberAndThread ft;
 
     while(true)
@@ -145,31 +562,11 @@ void Scheduler::run()
         ft.reset();
         bool tickle_me = false;
         bool is_active = false;
+        if(dequeue(ft, tickle_me))
         {
-            MutexType::LockGuard Lock(m_mutex);
-            auto it = m_fibers.begin();
-            while(it != m_fibers.end())
-            {
-                // 指定thread挂载的fiber或者cb
-                if(it->thread != -1 && it->thread != Global::GetThreadId())
-                {
-                    ++it;
-                    tickle_me = true;   // 发出信号通知其他线程处理
-                    continue;
-                }
-                assert(it->cb || it->fiber);
-                if(it->fiber && it->fiber->getState() == Fiber::EXEC)
-                {
-                    ++it;
-                    continue;
-                }
-                ft = *it;
-                m_fibers.erase(it++);
-                ++m_activeThreadCount;  // 拿到直接工作线程+1 防止idle提前结束
-                is_active = true;   //当前线程是否激活
-                break;
-            }
-            tickle_me |= (it != m_fibers.end());
+            ++m_activeThreadCount;  // 拿到直接工作线程+1 防止idle提前结束
+            --m_taskCount;
+            is_active = true;   //当前线程是否激活
         }
         if(tickle_me)
         {
@@ -180,40 +577,17 @@ void Scheduler::run()
         {
             ft.fiber->swapIn();
             --m_activeThreadCount;
-            if(ft.fiber->getState() == Fiber::READY)
-            {
-                schedule(ft.fiber);
-            }
-            else if(ft.fiber->getState() != Fiber::TERM
-                    && ft.fiber->getState() != Fiber::EXCEPT)
-            {
-                ft.fiber->m_state = Fiber::HOLD;
-            }
+            switchedOut(ft.fiber);
             ft.reset();
         }
         else if(ft.cb)
         {
-            // 创建一个协程用于执行回调
-            if(cb_fiber) cb_fiber->reset(ft.cb);
-            else cb_fiber.reset(new Fiber(ft.cb));
+            // 从协程池取出或新建一个协程用于执行回调
+            Fiber::ptr fiber = AcquireFiber(ft.cb, ft.shared_stack);
             ft.reset();
-            cb_fiber->swapIn();
+            fiber->swapIn();
             --m_activeThreadCount;
-            if(cb_fiber->getState() == Fiber::READY)
-            {
-                schedule(cb_fiber);
-                cb_fiber.reset();
-            }
-            else if(cb_fiber->getState() == Fiber::EXCEPT
-                 || cb_fiber->getState() == Fiber::TERM)
-            {
-                cb_fiber->reset(nullptr);
-            }
-            else
-            {
-                cb_fiber->m_state = Fiber::HOLD;
-                cb_fiber.reset();
-            }
+            switchedOut(fiber);
         }
         else
         {
@@ -224,7 +598,13 @@ void Scheduler::run()
             }
             if(idle_fiber->getState() == Fiber::TERM)
             {
-                std::cout << "idle fiber term" << std::endl;
+                GLOBAL_LOG_DEBUG(g_logger) << "idle fiber term";
+                t_worker_owner = nullptr;
+                // 最后一个任务结束时其他线程可能仍在挂起, 通知它们退出
+                for(size_t i = 0; i < m_workers.size(); i++)
+                {
+                    tickleWorker(i);
+                }
                 break;
             }
             ++m_idleThreadCount;
@@ -233,7 +613,7 @@ void Scheduler::run()
             if(idle_fiber->getState() != Fiber::TERM
             && idle_fiber->getState() != Fiber::EXCEPT)
             {
-                idle_fiber->m_state = Fiber::HOLD;
+                idle_fiber->m_state.store(Fiber::HOLD, std::memory_order_relaxed);
             }
         }
 
@@ -242,21 +622,20 @@ void Scheduler::run()
 
 void Scheduler::tickle()
 {
-    std::cout << "tickle" << std::endl;
+    GLOBAL_LOG_DEBUG(g_logger) << "tickle";
 }
 
 bool Scheduler::stopping()
 {
-    MutexType::LockGuard Lokc(m_mutex);
     return m_autoStop 
     && m_stopping 
-    && m_fibers.empty() 
+    && m_taskCount == 0 
     && m_activeThreadCount == 0;
 }
 
 void Scheduler::idle()
 {
-    std::cout << "idle" << std::endl;
+    GLOBAL_LOG_DEBUG(g_logger) << "idle";
     while(!stopping()) {
         Global::Fiber::YieldToHold();
     }
@@ -2,7 +2,9 @@
 #define __SCHEDULER_H__
 #include "fiber.h"
 #include "thread.h"
+#include "work_stealing_queue.h"
 
+#include <deque>
 #include <memory>
 #include <vector>
 #include <functional>
@@ -26,15 +28,21 @@ public:
     void start();
     void stop();
 
+    /**
+     * @brief 调度协程或回调
+     * @param[in] thread 指定执行线程, -1为任意线程
+     * @param[in] shared_stack 回调是否在共享栈协程上执行, 对已有协程无效
+     */
     template<class FiberOrCb>
-    void schedule(FiberOrCb f, int thread = -1)
+    void schedule(FiberOrCb f, int thread = -1, bool shared_stack = false)
     {
-        bool need_tickle = false;
+        FiberAndThread ft(std::move(f), thread);
+        ft.shared_stack = shared_stack;
+        if(ft.fiber && !MarkReady(ft.fiber.get()))
         {
-            MutexType::LockGuard Lock(m_mutex);
-            need_tickle = scheduleNoLock(f, thread);
+            return;
         }
-        if(need_tickle)
+        if(enqueue(std::move(ft)))
         {
             tickle();
         }
@@ -44,13 +52,14 @@ public:
     void schedule(InputIterator begin, InputIterator end)
     {
         bool need_tickle = false;
+        while(begin != end)     // 用于批量处理超时定时器
         {
-            MutexType::LockGuard Lock(m_mutex);
-            while(begin != end)     // 用于批量处理超时定时器
+            FiberAndThread ft(&*begin, -1);
+            if(!ft.fiber || MarkReady(ft.fiber.get()))
             {
-                need_tickle = scheduleNoLock(&*begin, -1) || need_tickle;
-                ++begin;
+                need_tickle = enqueue(std::move(ft)) || need_tickle;
             }
+            ++begin;
         }
         if(need_tickle) tickle();
     }
@@ -59,6 +68,20 @@ public:
     static Scheduler* GetThis();
     static Fiber* GetMainFiber();
 
+    struct FiberPoolStats
+    {
+        /// 新建的回调协程数
+        uint64_t created;
+        /// 从协程池复用的次数
+        uint64_t reused;
+    };
+
+    /**
+     * @brief 设置每个线程缓存的已结束协程上限, 0表示不缓存
+     */
+    static void SetFiberPoolSize(size_t size);
+    static FiberPoolStats GetFiberPoolStats();
+
 protected:
     virtual void tickle();
     virtual bool stopping();
@@ -67,25 +90,25 @@ protected:
     void run();
     void setThis();
     bool hasIdleThreads() { return m_idleThreadCount > 0; }
+    /**
+     * @brief 唤醒指定的工作线程, 默认与tickle()相同
+     * @param[in] index 工作线程下标
+     */
+    virtual void tickleWorker(size_t index) { tickle(); }
+    /// 当前线程在本调度器中的工作线程下标, 不是本调度器的工作线程返回-1
+    int getWorkerIndex() const;
+    size_t getWorkerCount() const { return m_workers.size(); }
+    /**
+     * @brief 是否有当前线程可以执行的任务, 工作线程挂起前用来避免丢失唤醒
+     */
+    bool hasRunnableWork();
     
-private:
-    template<class FiberOrCb>
-    bool scheduleNoLock(FiberOrCb f, int thread)
-    {
-        bool need_tickle = m_fibers.empty();
-        FiberAndThread ft(f, thread);
-        if(ft.fiber || ft.cb)
-        {
-            m_fibers.push_back(ft);
-        }
-        return need_tickle;
-    }
 private:
     struct FiberAndThread
     {
 
         FiberAndThread(Fiber::ptr f, int thr)
-            : fiber(f), thread(thr) { }
+            : fiber(std::move(f)), thread(thr) { }
 
         FiberAndThread(Fiber::ptr* f, int thr)
             : thread(thr)
@@ -93,14 +116,11 @@ private:
             this->fiber.swap(*f);
         }
 
-        FiberAndThread(std::function<void()> c, int thr)
-            : thread(thr), cb(c) { }
+        FiberAndThread(Task c, int thr)
+            : cb(std::move(c)), thread(thr) { }
 
-        FiberAndThread(std::function<void()>* c, int thr)
-            : thread(thr) 
-        { 
-            this->cb.swap(*c);
-        }
+        FiberAndThread(Task* c, int thr)
+            : cb(std::move(*c)), thread(thr) { }
         FiberAndThread()
             : thread(-1) { }
 
@@ -109,13 +129,84 @@ private:
             thread = -1;
             fiber = nullptr;
             cb = nullptr;
+            shared_stack = false;
         }
 
-        std::function<void()> cb;
+        Task cb;
         Fiber::ptr fiber; 
         int thread;
+        bool shared_stack = false;
     };
 
+    /**
+     * @brief 工作线程的本地队列
+     */
+    struct Worker
+    {
+        WorkStealingQueue<FiberAndThread*> queue;
+        /// 窃取时选择受害者的随机数状态
+        uint32_t seed;
+        /// 取任务次数, 用于定期检查全局队列
+        uint32_t tick = 0;
+        /// 工作线程id, 线程进入run()前为-1
+        std::atomic<int> threadId = {-1};
+
+        /// 指定在本线程执行的任务, 不会被窃取
+        MutexType mutex;
+        std::deque<FiberAndThread> mailbox;
+        std::atomic<size_t> mailboxCount = {0};
+
+        /// 本线程上让出的协程, 本地队列取空后按FIFO恢复, 只由本线程访问
+        std::deque<FiberAndThread> yielded;
+
+        explicit Worker(uint32_t s) : queue(LOCAL_QUEUE_SIZE), seed(s) { }
+    };
+
+    /// 每个工作线程本地队列容量, 满了转入全局队列
+    static const size_t LOCAL_QUEUE_SIZE = 256;
+    /// 本地队列连续取多少次后检查一次全局队列, 防止全局队列饿死
+    static const uint32_t GLOBAL_QUEUE_INTERVAL = 61;
+
+    /**
+     * @brief 放入队列
+     * @details 指定线程的任务直接投递到该线程的信箱并只唤醒该线程;
+     *          当前线程是本调度器的工作线程时放入本地队列, 否则放入全局队列
+     * @param[in] yield 主动让出的协程, 放到本线程的让出队列尾部而不是本地队列:
+     *                  本地队列后进先出, 否则会一直先于其他任务被取出
+     * @return 是否需要tickle
+     */
+    bool enqueue(FiberAndThread&& ft, bool yield = false);
+    /**
+     * @brief 唤醒方把已有协程标记为READY
+     * @return 需要放入队列返回true; 协程尚未切出(由执行它的线程切出后放入)
+     *         或已经在队列中时返回false
+     */
+    static bool MarkReady(Fiber* fiber);
+    /**
+     * @brief 协程切出后由执行它的线程调用: 挂起的发布为HOLD, 让出的和切出前已被唤醒的放回队列,
+     *        结束的回收
+     */
+    void switchedOut(Fiber::ptr& fiber);
+    /**
+     * @brief 取出一个任务: 信箱 -> 本地队列 -> 让出队列 -> 全局队列 -> 窃取
+     * @param[out] tickle_me 是否还有任务需要通知其他线程
+     */
+    bool dequeue(FiberAndThread& ft, bool& tickle_me);
+    bool dequeueGlobal(FiberAndThread& ft, bool& tickle_me);
+    bool dequeueMailbox(Worker* worker, FiberAndThread& ft);
+    /// 投递到指定线程的信箱
+    void postToMailbox(size_t index, FiberAndThread&& ft);
+    /// 按线程id查找工作线程下标, 未找到返回-1
+    int findWorker(int thread) const;
+    /// 工作线程进入run()时登记线程id, 并领取之前暂存的任务
+    void registerWorker(size_t index);
+    bool stealFrom(Worker* self, FiberAndThread& ft);
+    /// 当前线程在本调度器中的本地队列, 非工作线程返回nullptr
+    Worker* currentWorker();
+
+    static FiberAndThread* NewItem(FiberAndThread&& ft);
+    static void DeleteItem(FiberAndThread* item);
+
 protected:
     std::vector<int> m_threadIds;
     size_t m_threadCount;
@@ -129,7 +220,17 @@ private:
     MutexType m_mutex;
     Fiber::ptr m_rootFiber;
     std::vector<Thread::ptr> m_threads;     // thread pool
-    std::list<FiberAndThread> m_fibers;
+    /// 全局注入队列, 非工作线程提交以及本地队列溢出的任务, 不含指定线程的任务
+    std::deque<FiberAndThread> m_fibers;
+    /// 指定线程尚未进入run()时暂存的任务
+    std::deque<FiberAndThread> m_pinned;
+    /// 全局队列长度, 用于无锁判断是否为空
+    std::atomic<size_t> m_globalCount = {0};
+    /// 各工作线程的队列, 构造时创建, 之后不再改变
+    std::vector<std::unique_ptr<Worker> > m_workers;
+    std::atomic<size_t> m_nextWorker = {0};
+    /// 所有队列中的任务总数
+    std::atomic<size_t> m_taskCount = {0};
     std::string m_name;
 };
 
@@ -1,5 +1,5 @@
 #ifndef __SINGLETON_H__
-#define __SINGELTON_H__
+#define __SINGLETON_H__
 
 #include <memory>
 
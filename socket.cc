@@ -10,6 +10,8 @@
 namespace Global
 {
 
+static Logger::ptr g_logger = GLOBAL_LOG_NAME("system");
+
 Socket::ptr Socket::CreateTCP(sylar::Address::ptr address) {
     Socket::ptr sock(new Socket(address->getFamily(), TCP, 0));
     return sock;
@@ -69,7 +71,7 @@ Socket::~Socket() {
 }
 
 int64_t Socket::getSendTimeout() {
-    FdCtx::ptr ctx = FdMgr::GetInstance()->get(m_sock);
+    FdCtx* ctx = FdMgr::GetInstance()->get(m_sock);
     if(ctx) {
         return ctx->getTimeout(SO_SNDTIMEO);
     }
@@ -82,7 +84,7 @@ void Socket::setSendTimeout(int64_t v) {
 }
 
 int64_t Socket::getRecvTimeout() {
-    FdCtx::ptr ctx = FdMgr::GetInstance()->get(m_sock);
+    FdCtx* ctx = FdMgr::GetInstance()->get(m_sock);
     if(ctx) {
         return ctx->getTimeout(SO_RCVTIMEO);
     }
@@ -97,7 +99,7 @@ void Socket::setRecvTimeout(int64_t v) {
 bool Socket::getOption(int level, int option, void* result, socklen_t* len) {
     int rt = getsockopt(m_sock, level, option, result, (socklen_t*)len);
     if(rt) {
-        std::cerr << "getOption sock=" << m_sock
+        GLOBAL_LOG_ERROR(g_logger) << "getOption sock=" << m_sock
             << " level=" << level << " option=" << option
             << " errno=" << errno << " errstr=" << strerror(errno);
         return false;
@@ -107,7 +109,7 @@ bool Socket::getOption(int level, int option, void* result, socklen_t* len) {
 
 bool Socket::setOption(int level, int option, const void* result, socklen_t len) {
     if(setsockopt(m_sock, level, option, result, (socklen_t)len)) {
-        std::cerr << "setOption sock=" << m_sock
+        GLOBAL_LOG_ERROR(g_logger) << "setOption sock=" << m_sock
             << " level=" << level << " option=" << option
             << " errno=" << errno << " errstr=" << strerror(errno);
         return false;
@@ -119,7 +121,7 @@ Socket::ptr Socket::accept() {
     Socket::ptr sock(new Socket(m_family, m_type, m_protocol));
     int newsock = ::accept(m_sock, nullptr, nullptr);       // hook fdcxt
     if(newsock == -1) {
-        std::cerr << "accept(" << m_sock << ") errno="
+        GLOBAL_LOG_ERROR(g_logger) << "accept(" << m_sock << ") errno="
             << errno << " errstr=" << strerror(errno);
         return nullptr;
     }
@@ -130,7 +132,7 @@ Socket::ptr Socket::accept() {
 }
 
 bool Socket::init(int sock) {
-    FdCtx::ptr ctx = FdMgr::GetInstance()->get(sock);
+    FdCtx* ctx = FdMgr::GetInstance()->get(sock);
     if(ctx && ctx->isSocket() && !ctx->isClose()) {
         m_sock = sock;
         m_isConnected = true;
@@ -151,15 +153,15 @@ bool Socket::bind(const Address::ptr addr) {
         }
     }
 
-    if(SYLAR_UNLIKELY(addr->getFamily() != m_family)) {
-        std::cerr << "bind sock.family("
+    if(GLOBAL_UNLIKELY(addr->getFamily() != m_family)) {
+        GLOBAL_LOG_ERROR(g_logger) << "bind sock.family("
             << m_family << ") addr.family(" << addr->getFamily()
             << ") not equal, addr=" << addr->toString();
         return false;
     }
 
     if(::bind(m_sock, addr->getAddr(), addr->getAddrLen())) {
-        std::cerr << "bind error errrno=" << errno
+        GLOBAL_LOG_ERROR(g_logger) << "bind error errrno=" << errno
             << " errstr=" << strerror(errno);
         return false;
     }
@@ -177,7 +179,7 @@ bool Socket::connect(const Address::ptr addr, uint64_t timeout_ms) {
     }
 
     if(GLOBAL_UNLIKELY(addr->getFamily() != m_family)) {
-        std::cerr << "connect sock.family("
+        GLOBAL_LOG_ERROR(g_logger) << "connect sock.family("
             << m_family << ") addr.family(" << addr->getFamily()
             << ") not equal, addr=" << addr->toString();
         return false;
@@ -185,14 +187,14 @@ bool Socket::connect(const Address::ptr addr, uint64_t timeout_ms) {
 
     if(timeout_ms == (uint64_t)-1) {
         if(::connect(m_sock, addr->getAddr(), addr->getAddrLen())) {
-            std::cerr << "sock=" << m_sock << " connect(" << addr->toString()
+            GLOBAL_LOG_ERROR(g_logger) << "sock=" << m_sock << " connect(" << addr->toString()
                 << ") error errno=" << errno << " errstr=" << strerror(errno);
             close();
             return false;
         }
     } else {
         if(::connect_with_timeout(m_sock, addr->getAddr(), addr->getAddrLen(), timeout_ms)) {
-            std::cerr << "sock=" << m_sock << " connect(" << addr->toString()
+            GLOBAL_LOG_ERROR(g_logger) << "sock=" << m_sock << " connect(" << addr->toString()
                 << ") timeout=" << timeout_ms << " error errno="
                 << errno << " errstr=" << strerror(errno);
             close();
@@ -207,11 +209,11 @@ bool Socket::connect(const Address::ptr addr, uint64_t timeout_ms) {
 
 bool Socket::listen(int backlog) {
     if(!isValid()) {
-        std::cerr << "listen error sock=-1";
+        GLOBAL_LOG_ERROR(g_logger) << "listen error sock=-1";
         return false;
     }
     if(::listen(m_sock, backlog)) {
-        std::cerr << "listen error errno=" << errno
+        GLOBAL_LOG_ERROR(g_logger) << "listen error errno=" << errno
             << " errstr=" << strerror(errno);
         return false;
     }
@@ -316,7 +318,7 @@ if(m_localAddress) {
     }
     socklen_t addrlen = result->getAddrLen();
     if(getsockname(m_sock, result->getAddr(), &addrlen)) {
-        SYLAR_LOG_ERROR(g_logger) << "getsockname error sock=" << m_sock
+        GLOBAL_LOG_ERROR(g_logger) << "getsockname error sock=" << m_sock
             << " errno=" << errno << " errstr=" << strerror(errno);
         return Address::ptr(new UnknownAddress(m_family));
     }
@@ -392,7 +394,7 @@ void Socket::newSock() {
     if(GLOBAL_LIKELY(m_sock != -1)) {
         initSock();
     } else {
-        std::cerr << "socket(" << m_family
+        GLOBAL_LOG_ERROR(g_logger) << "socket(" << m_family
             << ", " << m_type << ", " << m_protocol << ") errno="
             << errno << " errstr=" << strerror(errno);
     }
@@ -0,0 +1,245 @@
+#include "stack_allocator.h"
+#include "mutex.h"
+
+#include <new>
+#include <vector>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace Global
+{
+
+static size_t PageSize()
+{
+    static size_t s_page_size = sysconf(_SC_PAGESIZE);
+    return s_page_size;
+}
+
+void* MmapStackAllocator::Alloc(size_t size)
+{
+    size_t page = PageSize();
+    size = (size + page - 1) & ~(page - 1);
+    char* base = (char*)mmap(nullptr, size + page, PROT_READ | PROT_WRITE
+                        , MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK
+                        , -1, 0);
+    if(base == MAP_FAILED)
+    {
+        perror("mmap stack");
+        throw std::bad_alloc();
+    }
+    // 栈向低地址增长, 保护页放在最低处
+    if(mprotect(base, page, PROT_NONE))
+    {
+        perror("mprotect guard page");
+    }
+    return base + page;
+}
+
+void MmapStackAllocator::Dealloc(void* vp, size_t size)
+{
+    size_t page = PageSize();
+    size = (size + page - 1) & ~(page - 1);
+    munmap((char*)vp - page, size + page);
+}
+
+#ifdef GLOBAL_FIBER_MALLOC_STACK
+typedef MallocStackAllocator RawStackAllocator;
+#else
+typedef MmapStackAllocator RawStackAllocator;
+#endif
+
+static const size_t s_min_shift = 12;      // 4KB
+static const size_t s_max_shift = 24;      // 16MB
+static const size_t s_bucket_count = s_max_shift - s_min_shift + 1;
+
+static std::atomic<size_t> s_high_watermark{16};
+static std::atomic<size_t> s_low_watermark{8};
+static std::atomic<size_t> s_global_limit{256};
+static std::atomic<size_t> s_trim_threshold{0};
+
+static std::atomic<uint64_t> s_hits{0};
+static std::atomic<uint64_t> s_misses{0};
+static std::atomic<uint64_t> s_outstanding{0};
+
+// 大小向上取整到2的幂, 返回桶下标, 超出范围返回-1
+static int BucketIndex(size_t size)
+{
+    size_t shift = s_min_shift;
+    while(((size_t)1 << shift) < size)
+    {
+        if(++shift > s_max_shift)
+        {
+            return -1;
+        }
+    }
+    return shift - s_min_shift;
+}
+
+static size_t BucketSize(int idx)
+{
+    return (size_t)1 << (idx + s_min_shift);
+}
+
+struct GlobalStackList
+{
+    Mutex mutex;
+    std::vector<void*> buckets[s_bucket_count];
+};
+
+// 不析构, 线程本地缓存在进程退出时仍可归还
+static GlobalStackList* GetGlobalList()
+{
+    static GlobalStackList* s_list = new GlobalStackList;
+    return s_list;
+}
+
+// 线程退出时缓存可能先于其他thread_local对象析构, 之后直接走底层分配器
+static thread_local bool t_cache_destroyed = false;
+
+struct LocalStackCache
+{
+    std::vector<void*> buckets[s_bucket_count];
+
+    ~LocalStackCache()
+    {
+        t_cache_destroyed = true;
+        for(size_t i = 0; i < s_bucket_count; i++)
+        {
+            release(i, 0);
+        }
+    }
+
+    // 将本地缓存削减到keep个, 多余的放入全局链表, 全局链表满则释放
+    void release(size_t idx, size_t keep)
+    {
+        std::vector<void*>& local = buckets[idx];
+        if(local.size() <= keep) return;
+        GlobalStackList* global = GetGlobalList();
+        size_t limit = s_global_limit;
+        Mutex::LockGuard lock(global->mutex);
+        std::vector<void*>& list = global->buckets[idx];
+        while(local.size() > keep)
+        {
+            void* vp = local.back();
+            local.pop_back();
+            if(list.size() < limit)
+            {
+                list.push_back(vp);
+            }
+            else
+            {
+                RawStackAllocator::Dealloc(vp, BucketSize(idx));
+            }
+        }
+    }
+
+    // 从全局链表取回至多low个
+    bool refill(size_t idx)
+    {
+        GlobalStackList* global = GetGlobalList();
+        size_t want = s_low_watermark;
+        if(want == 0) want = 1;
+        Mutex::LockGuard lock(global->mutex);
+        std::vector<void*>& list = global->buckets[idx];
+        while(!list.empty() && buckets[idx].size() < want)
+        {
+            buckets[idx].push_back(list.back());
+            list.pop_back();
+        }
+        return !buckets[idx].empty();
+    }
+};
+
+static thread_local LocalStackCache t_stack_cache;
+
+void* PoolStackAllocator::Alloc(size_t size)
+{
+    int idx = BucketIndex(size);
+    void* vp = nullptr;
+    if(idx < 0 || t_cache_destroyed)
+    {
+        ++s_misses;
+        vp = RawStackAllocator::Alloc(idx < 0 ? size : BucketSize(idx));
+    }
+    else
+    {
+        std::vector<void*>& local = t_stack_cache.buckets[idx];
+        if(!local.empty() || t_stack_cache.refill(idx))
+        {
+            ++s_hits;
+            vp = local.back();
+            local.pop_back();
+        }
+        else
+        {
+            ++s_misses;
+            vp = RawStackAllocator::Alloc(BucketSize(idx));
+        }
+    }
+    // 底层分配失败时已抛出std::bad_alloc, 不计入outstanding
+    ++s_outstanding;
+    return vp;
+}
+
+// 栈顶之下第一个超出阈值的页已驻留, 说明本次使用较深, 释放超出部分
+static void TrimStack(void* vp, size_t size)
+{
+#ifndef GLOBAL_FIBER_MALLOC_STACK
+    size_t keep = s_trim_threshold;
+    size_t page = PageSize();
+    keep = (keep + page - 1) & ~(page - 1);
+    if(keep == 0 || keep >= size) return;
+    char* trim_end = (char*)vp + size - keep;
+    unsigned char resident = 0;
+    if(mincore(trim_end - page, page, &resident) == 0 && (resident & 1))
+    {
+        madvise(vp, size - keep, MADV_DONTNEED);
+    }
+#endif
+}
+
+void PoolStackAllocator::Dealloc(void* vp, size_t size)
+{
+    --s_outstanding;
+    int idx = BucketIndex(size);
+    if(idx < 0 || t_cache_destroyed)
+    {
+        RawStackAllocator::Dealloc(vp, idx < 0 ? size : BucketSize(idx));
+        return;
+    }
+    TrimStack(vp, BucketSize(idx));
+    std::vector<void*>& local = t_stack_cache.buckets[idx];
+    local.push_back(vp);
+    if(local.size() > s_high_watermark)
+    {
+        t_stack_cache.release(idx, s_low_watermark);
+    }
+}
+
+void PoolStackAllocator::SetWatermark(size_t high, size_t low)
+{
+    if(low > high) low = high;
+    s_high_watermark = high;
+    s_low_watermark = low;
+}
+
+void PoolStackAllocator::SetGlobalLimit(size_t limit)
+{
+    s_global_limit = limit;
+}
+
+void PoolStackAllocator::SetTrimThreshold(size_t bytes)
+{
+    s_trim_threshold = bytes;
+}
+
+PoolStackAllocator::Stats PoolStackAllocator::GetStats()
+{
+    Stats stats;
+    stats.hits = s_hits;
+    stats.misses = s_misses;
+    stats.outstanding = s_outstanding;
+    return stats;
+}
+
+} // namespace Global
@@ -0,0 +1,86 @@
+#ifndef __STACK_ALLOCATOR_H__
+#define __STACK_ALLOCATOR_H__
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <new>
+
+namespace Global
+{
+
+class MallocStackAllocator
+{
+public:
+    static void* Alloc(size_t size) {
+        void* vp = malloc(size);
+        if(!vp) {
+            throw std::bad_alloc();
+        }
+        return vp;
+    }
+
+    static void Dealloc(void* vp, size_t size) {
+        return free(vp);
+    }
+};
+
+/**
+ * @brief mmap分配的协程栈
+ * @details 以MAP_NORESERVE|MAP_STACK映射, 只有被访问过的页才占用物理内存,
+ *          栈底额外映射一个PROT_NONE的保护页, 栈溢出时直接SIGSEGV.
+ *          映射失败时抛出std::bad_alloc
+ */
+class MmapStackAllocator
+{
+public:
+    static void* Alloc(size_t size);
+    static void Dealloc(void* vp, size_t size);
+};
+
+/**
+ * @brief 协程栈池
+ * @details 按2的幂大小分桶, 每个线程一组空闲链表, 超过高水位时
+ *          将多余的栈归还到全局链表直到低水位; 线程本地为空时从全局链表批量取回.
+ *          默认以MmapStackAllocator为底层, 定义GLOBAL_FIBER_MALLOC_STACK时使用malloc
+ */
+class PoolStackAllocator
+{
+public:
+    struct Stats
+    {
+        /// 从线程本地或全局链表命中
+        uint64_t hits;
+        /// 新分配
+        uint64_t misses;
+        /// 已分配尚未归还
+        uint64_t outstanding;
+    };
+
+    static void* Alloc(size_t size);
+    static void Dealloc(void* vp, size_t size);
+
+    /**
+     * @brief 设置线程本地每个桶的高低水位
+     * @pre low <= high
+     */
+    static void SetWatermark(size_t high, size_t low);
+
+    /**
+     * @brief 设置全局链表每个桶最多缓存的栈数量
+     */
+    static void SetGlobalLimit(size_t limit);
+
+    /**
+     * @brief 栈归还到池时, 若使用深度超过bytes则MADV_DONTNEED释放超出部分的物理页
+     * @param[in] bytes 保留的栈顶字节数, 0表示不释放(默认)
+     * @attention 仅mmap底层生效
+     */
+    static void SetTrimThreshold(size_t bytes);
+
+    static Stats GetStats();
+};
+
+} // namespace Global
+
+#endif
@@ -0,0 +1,178 @@
+#ifndef __TASK_H__
+#define __TASK_H__
+
+#include <cstddef>
+#include <functional>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace Global
+{
+
+/**
+ * @brief 只能移动的回调类型, 替代调度队列中的std::function<void()>
+ * @details 不超过INLINE_SIZE字节且可无异常移动的可调用对象直接存放在对象内部,
+ *          只有更大的捕获才在堆上分配.
+ */
+class Task
+{
+public:
+    /// 内联存储大小, 足够容纳fd + 管理器指针 + weak_ptr + 协程指针这类捕获
+    static const size_t INLINE_SIZE = 48;
+
+    Task() noexcept : m_ops(nullptr) { }
+    Task(std::nullptr_t) noexcept : m_ops(nullptr) { }
+
+    template<class F, class D = typename std::decay<F>::type
+            , class = typename std::enable_if<!std::is_same<D, Task>::value>::type
+            , class = decltype(std::declval<D&>()())>
+    Task(F&& f)
+        : m_ops(nullptr)
+    {
+        if(IsNull(static_cast<const D&>(f))) return;
+        init<D>(std::forward<F>(f), std::integral_constant<bool, IsInline<D>::value>());
+    }
+
+    Task(Task&& rhs) noexcept
+        : m_ops(rhs.m_ops)
+    {
+        if(m_ops)
+        {
+            m_ops->move(&m_storage, &rhs.m_storage);
+            rhs.m_ops = nullptr;
+        }
+    }
+
+    Task& operator=(Task&& rhs) noexcept
+    {
+        if(this != &rhs)
+        {
+            clear();
+            if(rhs.m_ops)
+            {
+                rhs.m_ops->move(&m_storage, &rhs.m_storage);
+                m_ops = rhs.m_ops;
+                rhs.m_ops = nullptr;
+            }
+        }
+        return *this;
+    }
+
+    Task& operator=(std::nullptr_t) noexcept
+    {
+        clear();
+        return *this;
+    }
+
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+
+    ~Task() { clear(); }
+
+    void operator()() { m_ops->invoke(&m_storage); }
+
+    explicit operator bool() const noexcept { return m_ops != nullptr; }
+
+    void swap(Task& rhs) noexcept
+    {
+        Task tmp(std::move(rhs));
+        rhs = std::move(*this);
+        *this = std::move(tmp);
+    }
+
+private:
+    typedef typename std::aligned_storage<INLINE_SIZE, alignof(std::max_align_t)>::type Storage;
+
+    struct Ops
+    {
+        void (*invoke)(void* storage);
+        /// 从src移动构造到dst并析构src
+        void (*move)(void* dst, void* src);
+        void (*destroy)(void* storage);
+    };
+
+    template<class F>
+    struct IsInline
+    {
+        static const bool value = sizeof(F) <= INLINE_SIZE
+                            && alignof(F) <= alignof(Storage)
+                            && std::is_nothrow_move_constructible<F>::value;
+    };
+
+    template<class F>
+    struct InlineOps
+    {
+        static void invoke(void* s) { (*static_cast<F*>(s))(); }
+        static void move(void* dst, void* src)
+        {
+            new (dst) F(std::move(*static_cast<F*>(src)));
+            static_cast<F*>(src)->~F();
+        }
+        static void destroy(void* s) { static_cast<F*>(s)->~F(); }
+        static const Ops ops;
+    };
+
+    template<class F>
+    struct HeapOps
+    {
+        static F*& ptr(void* s) { return *static_cast<F**>(s); }
+        static void invoke(void* s) { (*ptr(s))(); }
+        static void move(void* dst, void* src)
+        {
+            new (dst) F*(ptr(src));
+        }
+        static void destroy(void* s) { delete ptr(s); }
+        static const Ops ops;
+    };
+
+    template<class D, class F>
+    void init(F&& f, std::true_type)
+    {
+        new (&m_storage) D(std::forward<F>(f));
+        m_ops = &InlineOps<D>::ops;
+    }
+
+    template<class D, class F>
+    void init(F&& f, std::false_type)
+    {
+        new (&m_storage) D*(new D(std::forward<F>(f)));
+        m_ops = &HeapOps<D>::ops;
+    }
+
+    void clear() noexcept
+    {
+        if(m_ops)
+        {
+            m_ops->destroy(&m_storage);
+            m_ops = nullptr;
+        }
+    }
+
+    template<class F>
+    static bool IsNull(const F&) { return false; }
+    static bool IsNull(const std::function<void()>& f) { return !f; }
+    static bool IsNull(void (*f)()) { return f == nullptr; }
+
+private:
+    const Ops* m_ops;
+    Storage m_storage;
+};
+
+template<class F>
+const Task::Ops Task::InlineOps<F>::ops = {
+    &Task::InlineOps<F>::invoke,
+    &Task::InlineOps<F>::move,
+    &Task::InlineOps<F>::destroy
+};
+
+template<class F>
+const Task::Ops Task::HeapOps<F>::ops = {
+    &Task::HeapOps<F>::invoke,
+    &Task::HeapOps<F>::move,
+    &Task::HeapOps<F>::destroy
+};
+
+} // namespace Global
+
+#endif
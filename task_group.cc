@@ -0,0 +1,191 @@
+#include "task_group.h"
+#include "iomanager.h"
+#include "log.h"
+#include "macro.h"
+#include "utils.h"
+
+#include <errno.h>
+#include <system_error>
+
+namespace Global
+{
+
+static Logger::ptr g_logger = GLOBAL_LOG_NAME("system");
+
+static std::exception_ptr DeadlineError()
+{
+    return std::make_exception_ptr(std::system_error(ETIMEDOUT
+                , std::generic_category(), "TaskGroup deadline exceeded"));
+}
+
+void WaitGroup::add(int64_t delta)
+{
+    int64_t count = m_count.load(std::memory_order_relaxed);
+    while(count + delta != 0)
+    {
+        GLOBAL_ASSERT2(count + delta > 0, "WaitGroup count negative: " << count + delta);
+        if(m_count.compare_exchange_weak(count, count + delta
+                    , std::memory_order_acq_rel, std::memory_order_relaxed))
+        {
+            return;
+        }
+    }
+    // 归零在队列锁内完成. 等待方持锁读取计数, 看到0返回后本对象可能随即被销毁,
+    // 这里释放锁之后不能再访问成员
+    FiberWaitQueue::MutexType::LockGuard lock(m_waiters.mutex());
+    count = m_count.fetch_add(delta, std::memory_order_acq_rel) + delta;
+    GLOBAL_ASSERT2(count >= 0, "WaitGroup count negative: " << count);
+    FiberWaitQueue::Waiter* waiters = count == 0 ? m_waiters.popAll() : nullptr;
+    lock.unlock();
+    FiberWaitQueue::Wake(waiters);
+}
+
+bool WaitGroup::waitSlow(uint64_t timeout_us)
+{
+    uint64_t deadline = timeout_us == FiberWaitQueue::NO_TIMEOUT
+                        ? FiberWaitQueue::NO_TIMEOUT : GetMonotonicUs() + timeout_us;
+    FiberWaitQueue::MutexType::LockGuard lock(m_waiters.mutex());
+    while(m_count.load(std::memory_order_acquire) != 0)
+    {
+        uint64_t timeout = FiberWaitQueue::NO_TIMEOUT;
+        if(deadline != FiberWaitQueue::NO_TIMEOUT)
+        {
+            uint64_t now = GetMonotonicUs();
+            if(now >= deadline)
+            {
+                return false;
+            }
+            timeout = deadline - now;
+        }
+        m_waiters.wait(lock, timeout);
+        lock.lock();
+    }
+    return true;
+}
+
+TaskGroup::TaskGroup(Scheduler* scheduler, uint64_t timeout_ms)
+    : m_scheduler(scheduler ? scheduler : Scheduler::GetThis())
+    , m_state(std::make_shared<State>())
+{
+    GLOBAL_ASSERT2(m_scheduler, "TaskGroup without scheduler");
+    State* state = m_state.get();
+    state->parent = CancelScope::GetThis();
+    if(state->parent)
+    {
+        state->parentHook.scope = &state->scope;
+        state->parentHook.parent = state->parent;
+        state->parentHook.cancel = [](CancelScope::Hook* hook){
+            ParentHook* self = static_cast<ParentHook*>(hook);
+            self->scope->cancel(self->parent->getReason());
+        };
+        if(!state->parent->attach(&state->parentHook))
+        {
+            state->scope.cancel(state->parent->getReason());
+        }
+    }
+    if(timeout_ms != NO_DEADLINE)
+    {
+        IOManager* iom = dynamic_cast<IOManager*>(m_scheduler);
+        if(!iom)
+        {
+            iom = IOManager::GetThis();
+        }
+        GLOBAL_ASSERT2(iom, "TaskGroup deadline needs an IOManager");
+        // 回调可能在TaskGroup析构之后才执行, 只持有状态的弱引用
+        std::weak_ptr<State> weak_state(m_state);
+        m_timer = iom->addTimer(timeout_ms, [weak_state](){
+            std::shared_ptr<State> state = weak_state.lock();
+            if(state)
+            {
+                state->scope.cancel(ETIMEDOUT);
+            }
+        });
+    }
+}
+
+TaskGroup::~TaskGroup()
+{
+    m_state->running.wait();
+    if(m_timer)
+    {
+        m_timer->cancel();
+    }
+    if(m_state->parent)
+    {
+        m_state->parent->detach(&m_state->parentHook);
+    }
+    if(m_state->error && !m_state->observed)
+    {
+        try
+        {
+            std::rethrow_exception(m_state->error);
+        }
+        catch(std::exception& e)
+        {
+            GLOBAL_LOG_ERROR(g_logger) << "TaskGroup child failed: " << e.what();
+        }
+        catch(...)
+        {
+            GLOBAL_LOG_ERROR(g_logger) << "TaskGroup child failed with unknown exception";
+        }
+    }
+}
+
+void TaskGroup::wait()
+{
+    m_state->running.wait();
+    std::exception_ptr error;
+    {
+        MutexType::LockGuard lock(m_state->mutex);
+        if(!m_state->error && m_state->scope.getReason() == ETIMEDOUT)
+        {
+            m_state->error = DeadlineError();
+        }
+        m_state->observed = true;
+        error = m_state->error;
+    }
+    if(error)
+    {
+        std::rethrow_exception(error);
+    }
+}
+
+void TaskGroup::cancel()
+{
+    m_state->scope.cancel(ECANCELED);
+}
+
+bool TaskGroup::IsCancelled()
+{
+    CancelScope* scope = CancelScope::GetThis();
+    return scope && scope->isCancelled();
+}
+
+CancelScope* TaskGroup::State::enterChild()
+{
+    Fiber* fiber = Fiber::GetCurrent();
+    CancelScope* prev = fiber->getCancelScope();
+    fiber->setCancelScope(&scope);
+    return prev;
+}
+
+void TaskGroup::State::leaveChild(CancelScope* prev)
+{
+    Fiber::GetCurrent()->setCancelScope(prev);
+    running.done();
+}
+
+void TaskGroup::State::fail(std::exception_ptr e)
+{
+    {
+        MutexType::LockGuard lock(mutex);
+        if(!error)
+        {
+            // 到期之后的失败通常是取消引起的, 记为超时
+            error = scope.getReason() == ETIMEDOUT ? DeadlineError() : e;
+        }
+    }
+    scope.cancel(ECANCELED);
+}
+
+} // namespace Global
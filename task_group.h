@@ -0,0 +1,160 @@
+#ifndef __TASK_GROUP_H__
+#define __TASK_GROUP_H__
+
+#include "cancel_scope.h"
+#include "fiber_sync.h"
+#include "scheduler.h"
+#include "timer.h"
+#include "mutex.h"
+
+#include <stdint.h>
+#include <atomic>
+#include <exception>
+#include <memory>
+#include <utility>
+
+namespace Global
+{
+
+/**
+ * @brief 协程等待组, 等待一组任务全部完成
+ * @details 计数不为0时wait()在协程中让出, 在普通线程中阻塞. add()/done()是一次CAS,
+ *          只有计数归零时才加锁唤醒全部等待者; wait()返回后即可销毁WaitGroup
+ */
+class WaitGroup : Noncopyable
+{
+public:
+    explicit WaitGroup(int64_t count = 0)
+        : m_count(count)
+    {
+    }
+
+    /// 增加计数, 在启动任务之前调用
+    void add(int64_t delta = 1);
+
+    /// 一个任务完成
+    void done() { add(-1); }
+
+    /// 等待计数归零
+    void wait() { waitSlow(FiberWaitQueue::NO_TIMEOUT); }
+
+    /**
+     * @brief 最多等待ms毫秒
+     * @return 计数是否已归零
+     */
+    bool waitFor(uint64_t ms) { return waitSlow(ms * 1000); }
+
+    int64_t getCount() const { return m_count.load(std::memory_order_acquire); }
+
+private:
+    bool waitSlow(uint64_t timeout_us);
+
+private:
+    std::atomic<int64_t> m_count;
+    FiberWaitQueue m_waiters;
+};
+
+/**
+ * @brief 有作用域的任务组
+ * @details spawn()通过Scheduler::schedule启动子任务, 析构时等待所有子任务结束.
+ *          任一子任务抛出异常或到达截止时间时取消整个组: 其余子任务在hook的socket
+ *          IO上等待的立即返回, errno为ECANCELED(到期时为ETIMEDOUT), 也可以用
+ *          IsCancelled()主动检查. 在子任务中创建的TaskGroup随外层一起取消
+ */
+class TaskGroup : Noncopyable
+{
+public:
+    typedef Mutex MutexType;
+
+    /// 不设截止时间
+    static const uint64_t NO_DEADLINE = ~0ull;
+
+    /**
+     * @param[in] scheduler 子任务所在的调度器, 为空时使用当前调度器
+     * @param[in] timeout_ms 截止时间, 到期后取消并视为失败; 需要调度器是IOManager
+     */
+    explicit TaskGroup(Scheduler* scheduler = nullptr, uint64_t timeout_ms = NO_DEADLINE);
+
+    /// 等待所有子任务结束, 不抛出异常; 未被wait()取走的失败写入日志
+    ~TaskGroup();
+
+    /**
+     * @brief 启动一个子任务
+     * @details 已取消时仍会启动, 由子任务自行检查
+     * @param[in] shared_stack 子任务是否在共享栈协程上执行, 见Scheduler::schedule
+     */
+    template<class F>
+    void spawn(F&& cb, bool shared_stack = false)
+    {
+        m_state->running.add(1);
+        m_scheduler->schedule([state = m_state, cb = std::forward<F>(cb)]() mutable {
+            CancelScope* prev = state->enterChild();
+            {
+                // 子任务的捕获在计数减少之前析构, 不会晚于TaskGroup
+                auto task = std::move(cb);
+                try
+                {
+                    task();
+                }
+                catch(...)
+                {
+                    state->fail(std::current_exception());
+                }
+            }
+            state->leaveChild(prev);
+        }, -1, shared_stack);
+    }
+
+    /**
+     * @brief 等待所有子任务结束
+     * @exception 重新抛出第一个失败: 子任务的异常; 到达截止时间时为ETIMEDOUT的std::system_error,
+     *            到期之后子任务因取消抛出的异常不再计入
+     */
+    void wait();
+
+    /// 取消所有子任务
+    void cancel();
+
+    bool isCancelled() const { return m_state->scope.isCancelled(); }
+
+    /// 当前子任务所在的组是否已取消, 不在任何组中时返回false
+    static bool IsCancelled();
+
+private:
+    struct ParentHook : public CancelScope::Hook
+    {
+        CancelScope* parent = nullptr;
+        CancelScope* scope = nullptr;
+    };
+
+    /**
+     * @brief 子任务共享的状态
+     * @details 放在堆上由子任务共同持有: 所属协程使用共享栈时, 它挂起期间栈内容会被覆盖,
+     *          而子任务和外层取消域仍要访问这里的成员
+     */
+    struct State
+    {
+        CancelScope* enterChild();
+        void leaveChild(CancelScope* prev);
+        void fail(std::exception_ptr e);
+
+        CancelScope scope;
+        /// 外层取消域, 外层取消时一起取消
+        CancelScope* parent = nullptr;
+        ParentHook parentHook;
+        WaitGroup running;
+        MutexType mutex;
+        /// 第一个失败
+        std::exception_ptr error;
+        bool observed = false;
+    };
+
+private:
+    Scheduler* m_scheduler;
+    std::shared_ptr<State> m_state;
+    Timer::ptr m_timer;
+};
+
+} // namespace Global
+
+#endif
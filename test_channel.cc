@@ -0,0 +1,215 @@
+#include "channel.h"
+#include "iomanager.h"
+#include "hook.h"
+#include "thread.h"
+
+#include <atomic>
+#include <iostream>
+#include <vector>
+#include <sys/time.h>
+#include <unistd.h>
+
+static uint64_t GetCurrentMs()
+{
+    struct timeval t;
+    gettimeofday(&t, NULL);
+    return t.tv_sec * 1000ul + t.tv_usec / 1000;
+}
+
+// 普通线程和协程同时发送, 多个协程接收, 每个元素恰好收到一次
+void test_mpmc()
+{
+    const int fiber_producers = 4, thread_producers = 2, consumers = 4;
+    const uint64_t items = 20000;
+    Global::Channel<uint64_t> channel(64);
+    std::atomic<uint64_t> sum{0};
+    std::atomic<uint64_t> count{0};
+    std::atomic<int> running{fiber_producers + thread_producers};
+    {
+        Global::IOManager iom(4, false, "mpmc");
+        for(int i = 0; i < consumers; i++)
+        {
+            iom.schedule([&channel, &sum, &count](){
+                uint64_t v;
+                while(channel.recv(v))
+                {
+                    sum += v;
+                    ++count;
+                }
+            });
+        }
+        auto produce = [&channel, &running, items](){
+            for(uint64_t i = 1; i <= items; i++)
+            {
+                channel.send(i);
+            }
+            if(--running == 0)
+            {
+                channel.close();
+            }
+        };
+        for(int i = 0; i < fiber_producers; i++)
+        {
+            iom.schedule(produce);
+        }
+        std::vector<Global::Thread::ptr> thrs;
+        for(int i = 0; i < thread_producers; i++)
+        {
+            thrs.emplace_back(new Global::Thread(produce, "producer"));
+        }
+        for(auto& i : thrs)
+        {
+            i->join();
+        }
+    }
+    uint64_t producers = fiber_producers + thread_producers;
+    std::cout << "test_mpmc count=" << count << " expect=" << producers * items
+              << " sum=" << sum << " expect=" << producers * (items * (items + 1) / 2) << std::endl;
+}
+
+// 缓冲满时发送阻塞, 接收一个之后才能继续
+void test_full()
+{
+    Global::Channel<int> channel(2);
+    Global::IOManager iom(1, false, "full");
+    iom.schedule([&channel, &iom](){
+        channel.send(1);
+        channel.send(2);
+        bool would_block = channel.trySend(3) == Global::ChannelBase::WOULD_BLOCK;
+        uint64_t begin = GetCurrentMs();
+        bool timeout = channel.sendFor(3, 30) == Global::ChannelBase::TIMEOUT;
+        uint64_t t1 = GetCurrentMs() - begin;
+
+        std::atomic<uint64_t> received{0};
+        iom.schedule([&channel, &received](){
+            usleep(20 * 1000);
+            int v;
+            channel.recv(v);
+            received = GetCurrentMs();
+        });
+        begin = GetCurrentMs();
+        channel.send(3);
+        uint64_t sent = GetCurrentMs();
+        std::cout << "test_full would_block=" << would_block << " timeout=" << timeout
+                  << " " << t1 << "ms expect~30ms blocked=" << (sent - begin)
+                  << "ms expect~20ms after_recv=" << (sent >= received && received != 0)
+                  << " size=" << channel.size() << " expect=2" << std::endl;
+    });
+}
+
+// 关闭唤醒所有阻塞的发送方和接收方, 缓冲中剩余的元素仍能收到
+void test_close()
+{
+    Global::Channel<int> full(1);
+    Global::Channel<int> empty(1);
+    std::atomic<int> send_failed{0};
+    std::atomic<int> recv_failed{0};
+    int left = 0;
+    {
+        Global::IOManager iom(2, false, "close");
+        full.send(42);
+        for(int i = 0; i < 3; i++)
+        {
+            iom.schedule([&full, &send_failed](){
+                if(!full.send(1))
+                {
+                    ++send_failed;
+                }
+            });
+            iom.schedule([&empty, &recv_failed](){
+                int v;
+                if(!empty.recv(v))
+                {
+                    ++recv_failed;
+                }
+            });
+        }
+        usleep(20 * 1000);
+        full.close();
+        empty.close();
+    }
+    int v;
+    if(full.recv(v))
+    {
+        left = v;
+    }
+    bool closed = full.tryRecv(v) == Global::ChannelBase::CLOSED;
+    std::cout << "test_close send_failed=" << send_failed << " recv_failed=" << recv_failed
+              << " expect=3 3 left=" << left << " expect=42 closed=" << closed << std::endl;
+}
+
+// select超时, 之后由另一个协程的发送唤醒; 已关闭的通道立即完成
+void test_select()
+{
+    Global::Channel<int> ch1(1);
+    Global::Channel<int> ch2(1);
+    Global::IOManager iom(2, false, "select");
+    iom.schedule([&](){
+        int a = 0, b = 0;
+        Global::ChannelSelector sel;
+        sel.recv(ch1, a);
+        sel.recv(ch2, b);
+        uint64_t begin = GetCurrentMs();
+        int idx = sel.selectFor(30);
+        std::cout << "test_select timeout idx=" << idx << " result="
+                  << (sel.getResult() == Global::ChannelBase::TIMEOUT) << " "
+                  << (GetCurrentMs() - begin) << "ms expect~30ms" << std::endl;
+
+        iom.schedule([&ch2](){
+            usleep(10 * 1000);
+            ch2.send(7);
+        });
+        idx = sel.select();
+        std::cout << "test_select idx=" << idx << " b=" << b << " expect=1 7" << std::endl;
+
+        ch1.close();
+        idx = sel.select();
+        std::cout << "test_select closed idx=" << idx << " result="
+                  << (sel.getResult() == Global::ChannelBase::CLOSED) << " expect=0 1" << std::endl;
+    });
+}
+
+// 共享栈协程阻塞在select和收发上, 通道持有的等待者不能在栈上
+void test_shared_stack()
+{
+    Global::Fiber::SetSharedStack(1, 128 * 1024);
+    Global::Channel<int> ch1(1);
+    Global::Channel<int> ch2(1);
+    std::atomic<int> got{0};
+    {
+        Global::IOManager iom(1, false, "shared");
+        for(int i = 0; i < 3; i++)
+        {
+            iom.schedule([&](){
+                for(int j = 0; j < 100; j++)
+                {
+                    int a, b;
+                    Global::ChannelSelector sel;
+                    sel.recv(ch1, a);
+                    sel.recv(ch2, b);
+                    if(sel.select() >= 0 && sel.getResult() == Global::ChannelBase::OK)
+                    {
+                        ++got;
+                    }
+                }
+            }, -1, true);
+        }
+        iom.schedule([&](){
+            for(int j = 0; j < 300; j++)
+            {
+                (j % 2 ? ch1 : ch2).send(j);
+            }
+        }, -1, true);
+    }
+    std::cout << "test_shared_stack got=" << got << " expect=300" << std::endl;
+}
+
+int main()
+{
+    test_mpmc();
+    test_full();
+    test_close();
+    test_select();
+    test_shared_stack();
+    return 0;
+}
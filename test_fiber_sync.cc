@@ -0,0 +1,257 @@
+#include "fiber_sync.h"
+#include "iomanager.h"
+#include "hook.h"
+#include "thread.h"
+
+#include <iostream>
+#include <deque>
+#include <vector>
+#include <sys/time.h>
+#include <unistd.h>
+
+static uint64_t GetCurrentMs()
+{
+    struct timeval t;
+    gettimeofday(&t, NULL);
+    return t.tv_sec * 1000ul + t.tv_usec / 1000;
+}
+
+// 协程和普通线程同时竞争同一把锁, 持锁期间让出
+void test_mutex()
+{
+    Global::FiberMutex mutex;
+    int count = 0;
+    const int fibers = 50, loops = 200, threads = 2;
+    {
+        Global::IOManager iom(2, false, "mutex");
+        for(int i = 0; i < fibers; i++)
+        {
+            iom.schedule([&mutex, &count](){
+                for(int j = 0; j < loops; j++)
+                {
+                    Global::FiberMutex::LockGuard lock(mutex);
+                    int v = count;
+                    if(j % 50 == 0)
+                    {
+                        usleep(100);
+                    }
+                    count = v + 1;
+                }
+            });
+        }
+        std::vector<Global::Thread::ptr> thrs;
+        for(int i = 0; i < threads; i++)
+        {
+            thrs.emplace_back(new Global::Thread([&mutex, &count](){
+                for(int j = 0; j < loops; j++)
+                {
+                    Global::FiberMutex::LockGuard lock(mutex);
+                    ++count;
+                }
+            }, "locker"));
+        }
+        for(auto& i : thrs)
+        {
+            i->join();
+        }
+    }
+    std::cout << "test_mutex count=" << count
+              << " expect=" << (fibers + threads) * loops << std::endl;
+}
+
+// 有界队列: 条件变量等待非空/非满
+void test_condition()
+{
+    Global::FiberMutex mutex;
+    Global::FiberConditionVariable not_empty;
+    Global::FiberConditionVariable not_full;
+    std::deque<int> queue;
+    const size_t cap = 4;
+    const int producers = 4, items = 500;
+    long sum = 0;
+    {
+        Global::IOManager iom(2, false, "cond");
+        for(int p = 0; p < producers; p++)
+        {
+            iom.schedule([&](){
+                for(int i = 1; i <= items; i++)
+                {
+                    Global::FiberMutex::LockGuard lock(mutex);
+                    while(queue.size() >= cap)
+                    {
+                        not_full.wait(lock);
+                    }
+                    queue.push_back(i);
+                    not_empty.notifyOne();
+                }
+            });
+        }
+        iom.schedule([&](){
+            for(int n = 0; n < producers * items; n++)
+            {
+                Global::FiberMutex::LockGuard lock(mutex);
+                while(queue.empty())
+                {
+                    not_empty.wait(lock);
+                }
+                sum += queue.front();
+                queue.pop_front();
+                not_full.notifyAll();
+            }
+        });
+    }
+    std::cout << "test_condition sum=" << sum
+              << " expect=" << (long)producers * items * (items + 1) / 2 << std::endl;
+}
+
+// 信号量限制并发数
+void test_semaphore()
+{
+    Global::FiberSemaphore sem(3);
+    std::atomic<int> running{0};
+    std::atomic<int> max_running{0};
+    {
+        Global::IOManager iom(2, false, "sem");
+        for(int i = 0; i < 30; i++)
+        {
+            iom.schedule([&](){
+                sem.wait();
+                int cur = ++running;
+                int old = max_running;
+                while(cur > old && !max_running.compare_exchange_weak(old, cur));
+                usleep(1000);
+                --running;
+                sem.notify();
+            });
+        }
+    }
+    std::cout << "test_semaphore max_running=" << max_running << " expect<=3" << std::endl;
+}
+
+void test_rwmutex()
+{
+    Global::FiberRWMutex rwmutex;
+    int a = 0, b = 0;
+    std::atomic<int> bad{0};
+    {
+        Global::IOManager iom(2, false, "rw");
+        for(int i = 0; i < 20; i++)
+        {
+            iom.schedule([&, i](){
+                for(int j = 0; j < 200; j++)
+                {
+                    if(i % 4 == 0)
+                    {
+                        Global::FiberRWMutex::WriteLock lock(rwmutex);
+                        ++a;
+                        if(j % 50 == 0)
+                        {
+                            usleep(100);
+                        }
+                        ++b;
+                    }
+                    else
+                    {
+                        Global::FiberRWMutex::ReadLock lock(rwmutex);
+                        if(a != b)
+                        {
+                            ++bad;
+                        }
+                    }
+                }
+            });
+        }
+    }
+    std::cout << "test_rwmutex a=" << a << " expect=1000 bad=" << bad << std::endl;
+}
+
+// 超时等待: 协程中走IOManager的定时器, 普通线程中阻塞在信号量上
+void test_timeout()
+{
+    Global::FiberMutex mutex;
+    Global::FiberSemaphore sem;
+    Global::FiberConditionVariable cond;
+    mutex.lock();
+    {
+        Global::IOManager iom(1, false, "timeout");
+        iom.schedule([&](){
+            uint64_t begin = GetCurrentMs();
+            bool locked = mutex.tryLockFor(50);
+            uint64_t t1 = GetCurrentMs();
+            bool waited = sem.waitFor(50);
+            uint64_t t2 = GetCurrentMs();
+            Global::FiberMutex m;
+            Global::FiberMutex::LockGuard lock(m);
+            bool notified = cond.waitFor(lock, 50);
+            uint64_t t3 = GetCurrentMs();
+            std::cout << "test_timeout fiber locked=" << locked << " " << (t1 - begin) << "ms"
+                      << " sem=" << waited << " " << (t2 - t1) << "ms"
+                      << " cond=" << notified << " " << (t3 - t2) << "ms" << std::endl;
+        });
+    }
+    Global::Thread thr([&](){
+        uint64_t begin = GetCurrentMs();
+        bool waited = sem.waitFor(50);
+        std::cout << "test_timeout thread sem=" << waited << " "
+                  << (GetCurrentMs() - begin) << "ms" << std::endl;
+    }, "waiter");
+    thr.join();
+    mutex.unlock();
+    // 超时之前被唤醒
+    {
+        Global::IOManager iom(2, false, "notify");
+        iom.schedule([&](){
+            bool waited = sem.waitFor(1000);
+            std::cout << "test_timeout notified sem=" << waited << std::endl;
+        });
+        iom.schedule([&](){
+            usleep(10 * 1000);
+            sem.notify();
+        });
+    }
+}
+
+// 共享栈协程让出后栈被同一共享栈上的其他协程覆盖, 等待者不能留在栈上
+void test_shared_stack()
+{
+    Global::Fiber::SetSharedStack(1, 128 * 1024);
+    Global::FiberMutex mutex;
+    Global::FiberConditionVariable cond;
+    int count = 0;
+    int done = 0;
+    {
+        Global::IOManager iom(1, false, "shared");
+        for(int i = 0; i < 3; i++)
+        {
+            iom.schedule([&](){
+                for(int j = 0; j < 100; j++)
+                {
+                    Global::FiberMutex::LockGuard lock(mutex);
+                    int v = count;
+                    usleep(10);
+                    count = v + 1;
+                }
+                Global::FiberMutex::LockGuard lock(mutex);
+                ++done;
+                cond.notifyAll();
+                while(done < 3)
+                {
+                    cond.wait(lock);
+                }
+            }, -1, true);
+        }
+    }
+    std::cout << "test_shared_stack count=" << count << " expect=300 done=" << done
+              << " expect=3" << std::endl;
+}
+
+int main()
+{
+    test_mutex();
+    test_condition();
+    test_semaphore();
+    test_rwmutex();
+    test_timeout();
+    test_shared_stack();
+    return 0;
+}
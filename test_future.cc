@@ -0,0 +1,122 @@
+#include "future.h"
+#include "iomanager.h"
+#include "hook.h"
+
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+// 协程中扇出再汇总, get()让出而不是阻塞工作线程
+void test_fan_out(Global::IOManager& iom)
+{
+    std::vector<Global::Future<int> > futures;
+    for(int i = 0; i < 100; i++)
+    {
+        futures.push_back(Global::Async(&iom, [i](){
+            if(i % 10 == 0)
+            {
+                usleep(1000);
+            }
+            return i;
+        }));
+    }
+    Global::WhenAll(futures).get();
+    int sum = 0;
+    for(auto& f : futures)
+    {
+        sum += f.get();
+    }
+    std::cout << "test_fan_out sum=" << sum << " expect=4950" << std::endl;
+}
+
+void test_exception(Global::IOManager& iom)
+{
+    Global::Future<std::string> f = Global::Async(&iom, []() -> std::string {
+        throw std::runtime_error("boom");
+    });
+    try
+    {
+        f.get();
+        std::cout << "test_exception no exception" << std::endl;
+    }
+    catch(std::runtime_error& e)
+    {
+        std::cout << "test_exception caught " << e.what() << std::endl;
+    }
+
+    Global::Future<void> broken;
+    {
+        Global::Promise<void> promise;
+        broken = promise.getFuture();
+    }
+    try
+    {
+        broken.get();
+    }
+    catch(std::future_error& e)
+    {
+        std::cout << "test_exception broken_promise " << (e.code() == std::future_errc::broken_promise) << std::endl;
+    }
+}
+
+void test_when_any(Global::IOManager& iom)
+{
+    std::vector<Global::Future<int> > futures;
+    for(int i = 0; i < 3; i++)
+    {
+        futures.push_back(Global::Async(&iom, [i](){
+            usleep((3 - i) * 20 * 1000);
+            return i;
+        }));
+    }
+    size_t idx = Global::WhenAny(futures).get();
+    std::cout << "test_when_any idx=" << idx << " value=" << futures[idx].get() << " expect=2" << std::endl;
+    // 其余的仍然可以等待
+    std::cout << "test_when_any rest=" << futures[0].get() + futures[1].get() << " expect=1" << std::endl;
+}
+
+// 共享栈协程在get()中让出, 等待者不能留在会被覆盖的栈上
+void test_shared_stack(Global::IOManager& iom)
+{
+    Global::Fiber::SetSharedStack(1, 128 * 1024);
+    std::vector<Global::Promise<int> > promises(3);
+    std::vector<Global::Future<int> > results;
+    for(int i = 0; i < 3; i++)
+    {
+        std::shared_ptr<Global::Future<int> > future
+                = std::make_shared<Global::Future<int> >(promises[i].getFuture());
+        Global::Promise<int> result;
+        results.push_back(result.getFuture());
+        iom.schedule([future, result = std::move(result)]() mutable {
+            result.setValue(future->get() * 2);
+        }, -1, true);
+    }
+    usleep(10 * 1000);
+    for(int i = 0; i < 3; i++)
+    {
+        promises[i].setValue(i + 1);
+    }
+    int sum = 0;
+    for(auto& f : results)
+    {
+        sum += f.get();
+    }
+    std::cout << "test_shared_stack sum=" << sum << " expect=12" << std::endl;
+}
+
+int main()
+{
+    Global::IOManager iom(2, false, "future");
+    // 普通线程中get()阻塞线程
+    Global::Async(&iom, [&iom](){
+        test_fan_out(iom);
+        test_exception(iom);
+        test_when_any(iom);
+        test_shared_stack(iom);
+    }).get();
+    Global::Future<int> f = Global::Async(&iom, [](){ return 42; });
+    std::cout << "thread get=" << f.get() << std::endl;
+    return 0;
+}
@@ -1,5 +1,6 @@
 #include "hook.h"
 #include "iomanager.h"
+#include "utils.h"
 
 #include <iostream>
 #include <sys/types.h>
@@ -22,6 +23,20 @@ void test_sleep() {
     std::cout << "test_sleep" << std::endl;
 }
 
+// 长时间占用CPU之后的hook sleep仍要睡足, 到期时间不能从事件循环缓存的旧时间算起
+void test_sleep_after_busy()
+{
+    Global::IOManager iom(1);
+    iom.schedule([](){
+        uint64_t begin = Global::GetMonotonicUs();
+        while(Global::GetMonotonicUs() - begin < 1500 * 1000);
+        begin = Global::GetMonotonicUs();
+        sleep(1);
+        std::cout << "sleep 1 after busy: " << (Global::GetMonotonicUs() - begin) / 1000
+                  << "ms expect=1000ms" << std::endl;
+    });
+}
+
 void test_sock()
 {
     int sock = socket(AF_INET, SOCK_STREAM, 0);
@@ -59,6 +74,7 @@ void test_sock()
 
 int main()
 {
+    test_sleep_after_busy();
     Global::IOManager iom;
     iom.schedule(test_sock);
     return 0;
@@ -0,0 +1,91 @@
+#include "scheduler.h"
+#include "iomanager.h"
+#include "utils.h"
+
+#include <atomic>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+// 取得调度器的线程id, 包括use_caller的调用线程
+template<class S>
+class Pinned : public S
+{
+public:
+    Pinned(size_t threads)
+        : S(threads, true, "pinned")
+    {
+    }
+
+    const std::vector<int>& threadIds() const { return this->m_threadIds; }
+};
+
+// 外部线程按轮转投递指定线程的任务, 任务中再投递指定线程和不指定线程的任务.
+// 不指定线程的任务会被窃取, 指定线程的任务不能在其他线程上运行
+template<class S>
+void test_mailbox(const char* name)
+{
+    const int producers = 2;
+    const int tasks = 30000;
+    std::atomic<int> done{0};
+    std::atomic<int> wrong{0};
+    std::atomic<int> early{0};
+    Pinned<S> sc(3);
+    std::vector<int> tids = sc.threadIds();
+    int caller = Global::GetThreadId();
+    // 调用线程在stop()之前不进入run(), 投递给它的任务先暂存
+    for(int i = 0; i < 100; i++)
+    {
+        sc.schedule([caller, &early, &wrong](){
+            if(Global::GetThreadId() != caller)
+            {
+                ++wrong;
+            }
+            ++early;
+        }, caller);
+    }
+    sc.start();
+    tids = sc.threadIds();
+
+    std::vector<std::thread> threads;
+    for(int t = 0; t < producers; t++)
+    {
+        threads.emplace_back([&sc, &tids, &done, &wrong, t](){
+            for(int i = 0; i < tasks; i++)
+            {
+                int tid = tids[(i + t) % tids.size()];
+                sc.schedule([&sc, tid, &done, &wrong](){
+                    if(Global::GetThreadId() != tid)
+                    {
+                        ++wrong;
+                    }
+                    ++done;
+                    sc.schedule([tid, &done, &wrong](){
+                        if(Global::GetThreadId() != tid)
+                        {
+                            ++wrong;
+                        }
+                        ++done;
+                    }, tid);
+                    sc.schedule([&done](){ ++done; });
+                }, tid);
+            }
+        });
+    }
+    for(auto& t : threads)
+    {
+        t.join();
+    }
+    sc.stop();
+    std::cout << "test_mailbox " << name << " threads=" << tids.size()
+              << " done=" << done << " expect=" << producers * tasks * 3
+              << " early=" << early << " expect=100 wrong=" << wrong << " expect=0" << std::endl;
+}
+
+int main()
+{
+    test_mailbox<Global::Scheduler>("scheduler");
+    // IOManager按线程的eventfd定向唤醒
+    test_mailbox<Global::IOManager>("iomanager");
+    return 0;
+}
@@ -0,0 +1,277 @@
+#include "task_group.h"
+#include "iomanager.h"
+#include "fd_manager.h"
+#include "hook.h"
+
+#include <errno.h>
+#include <iostream>
+#include <stdexcept>
+#include <string.h>
+#include <system_error>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+static uint64_t GetCurrentMs()
+{
+    struct timeval t;
+    gettimeofday(&t, NULL);
+    return t.tv_sec * 1000ul + t.tv_usec / 1000;
+}
+
+// socketpair没有hook, 手动登记使其走协程IO
+static void NewPair(int sv[2])
+{
+    if(socketpair(AF_UNIX, SOCK_STREAM, 0, sv))
+    {
+        perror("socketpair");
+        exit(1);
+    }
+    Global::FdMgr::GetInstance()->get(sv[0], true);
+    Global::FdMgr::GetInstance()->get(sv[1], true);
+}
+
+void test_wait_group(Global::IOManager& iom)
+{
+    Global::WaitGroup wg;
+    std::atomic<int> count{0};
+    for(int i = 0; i < 100; i++)
+    {
+        wg.add();
+        iom.schedule([&wg, &count, i](){
+            usleep((i % 10) * 1000);
+            ++count;
+            wg.done();
+        });
+    }
+    wg.wait();
+    std::cout << "test_wait_group count=" << count << " expect=100" << std::endl;
+}
+
+// 扇出到多个后端, 全部回复后汇总
+void test_fan_out(Global::IOManager& iom)
+{
+    const int backends = 8;
+    int sv[backends][2];
+    for(int i = 0; i < backends; i++)
+    {
+        NewPair(sv[i]);
+        int fd = sv[i][1];
+        // 后端: 收到请求后延迟回复
+        iom.schedule([fd, i](){
+            char c;
+            if(read(fd, &c, 1) == 1)
+            {
+                usleep(i * 2000);
+                c += 1;
+                write(fd, &c, 1);
+            }
+        });
+    }
+    int replies[backends] = {0};
+    uint64_t begin = GetCurrentMs();
+    {
+        Global::TaskGroup group(&iom);
+        for(int i = 0; i < backends; i++)
+        {
+            int fd = sv[i][0];
+            int* reply = &replies[i];
+            group.spawn([fd, i, reply](){
+                char c = 'a' + i;
+                write(fd, &c, 1);
+                if(read(fd, &c, 1) != 1)
+                {
+                    throw std::runtime_error("backend read failed");
+                }
+                *reply = c;
+            });
+        }
+        group.wait();
+    }
+    int sum = 0;
+    for(int i = 0; i < backends; i++)
+    {
+        sum += replies[i] - ('a' + i);
+    }
+    std::cout << "test_fan_out replies=" << sum << " expect=" << backends
+              << " " << (GetCurrentMs() - begin) << "ms" << std::endl;
+    for(int i = 0; i < backends; i++)
+    {
+        close(sv[i][0]);
+        close(sv[i][1]);
+    }
+}
+
+// 一个子任务失败, 阻塞在socket上的其他子任务立即以ECANCELED返回
+void test_fail_cancels(Global::IOManager& iom)
+{
+    int sv[4][2];
+    std::atomic<int> cancelled{0};
+    uint64_t begin = GetCurrentMs();
+    try
+    {
+        Global::TaskGroup group(&iom);
+        for(int i = 0; i < 4; i++)
+        {
+            NewPair(sv[i]);
+            int fd = sv[i][0];
+            group.spawn([fd, &cancelled](){
+                char c;
+                if(read(fd, &c, 1) == -1 && errno == ECANCELED)
+                {
+                    ++cancelled;
+                }
+            });
+        }
+        // 嵌套的组随外层一起取消
+        group.spawn([&iom, &cancelled](){
+            Global::TaskGroup inner(&iom);
+            inner.spawn([&cancelled](){
+                while(!Global::TaskGroup::IsCancelled())
+                {
+                    usleep(1000);
+                }
+                ++cancelled;
+            });
+            inner.wait();
+        });
+        group.spawn([](){
+            usleep(10 * 1000);
+            throw std::runtime_error("backend error");
+        });
+        group.wait();
+        std::cout << "test_fail_cancels no exception" << std::endl;
+    }
+    catch(std::runtime_error& e)
+    {
+        std::cout << "test_fail_cancels caught=" << e.what() << " cancelled=" << cancelled
+                  << " expect=5 " << (GetCurrentMs() - begin) << "ms" << std::endl;
+    }
+    for(int i = 0; i < 4; i++)
+    {
+        close(sv[i][0]);
+        close(sv[i][1]);
+    }
+}
+
+void test_deadline(Global::IOManager& iom)
+{
+    int sv[2];
+    NewPair(sv);
+    uint64_t begin = GetCurrentMs();
+    try
+    {
+        Global::TaskGroup group(&iom, 30);
+        int fd = sv[0];
+        group.spawn([fd](){
+            char c;
+            if(read(fd, &c, 1) == -1)
+            {
+                throw std::system_error(errno, std::generic_category(), "read");
+            }
+        });
+        group.wait();
+        std::cout << "test_deadline no exception" << std::endl;
+    }
+    catch(std::system_error& e)
+    {
+        // 到期取消的IO以ETIMEDOUT返回, 组的失败是截止时间而不是子任务的异常
+        std::cout << "test_deadline caught=" << strerror(e.code().value())
+                  << " " << (GetCurrentMs() - begin) << "ms expect~30ms" << std::endl;
+    }
+    close(sv[0]);
+    close(sv[1]);
+
+    try
+    {
+        begin = GetCurrentMs();
+        Global::TaskGroup group(&iom, 30);
+        group.spawn([](){
+            while(!Global::TaskGroup::IsCancelled())
+            {
+                usleep(1000);
+            }
+        });
+        group.wait();
+        std::cout << "test_deadline no exception" << std::endl;
+    }
+    catch(std::system_error& e)
+    {
+        std::cout << "test_deadline caught=" << strerror(e.code().value())
+                  << " " << (GetCurrentMs() - begin) << "ms expect~30ms" << std::endl;
+    }
+}
+
+// 组和子任务都在共享栈协程上: 挂起期间栈被覆盖, 登记到取消域的节点不能在栈上
+void test_shared_stack(Global::IOManager& iom)
+{
+    int sv[4][2];
+    std::atomic<int> cancelled{0};
+    std::atomic<bool> caught{false};
+    Global::WaitGroup done(1);
+    iom.schedule([&](){
+        try
+        {
+            Global::TaskGroup group(&iom);
+            for(int i = 0; i < 4; i++)
+            {
+                NewPair(sv[i]);
+                int fd = sv[i][0];
+                group.spawn([fd, &cancelled](){
+                    char c;
+                    if(read(fd, &c, 1) == -1 && errno == ECANCELED)
+                    {
+                        ++cancelled;
+                    }
+                }, true);
+            }
+            group.spawn([&iom, &cancelled](){
+                Global::TaskGroup inner(&iom);
+                inner.spawn([&cancelled](){
+                    while(!Global::TaskGroup::IsCancelled())
+                    {
+                        usleep(1000);
+                    }
+                    ++cancelled;
+                }, true);
+                inner.wait();
+            }, true);
+            group.spawn([](){
+                usleep(10 * 1000);
+                throw std::runtime_error("backend error");
+            }, true);
+            group.wait();
+        }
+        catch(std::runtime_error& e)
+        {
+            caught = true;
+        }
+        for(int i = 0; i < 4; i++)
+        {
+            close(sv[i][0]);
+            close(sv[i][1]);
+        }
+        done.done();
+    }, -1, true);
+    done.wait();
+    std::cout << "test_shared_stack caught=" << caught << " cancelled=" << cancelled
+              << " expect=1 5" << std::endl;
+}
+
+int main()
+{
+    Global::Fiber::SetSharedStack(1, 128 * 1024);
+    Global::IOManager iom(2, false, "group");
+    Global::WaitGroup done(1);
+    iom.schedule([&iom, &done](){
+        test_wait_group(iom);
+        test_fan_out(iom);
+        test_fail_cancels(iom);
+        test_deadline(iom);
+        test_shared_stack(iom);
+        done.done();
+    });
+    // 普通线程中等待时阻塞线程
+    done.wait();
+    return 0;
+}
@@ -0,0 +1,516 @@
+#include "timer.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <set>
+#include <vector>
+#include <unistd.h>
+
+#ifdef GLOBAL_TIMER_SET
+static const char* s_impl = "std::set";
+#else
+static const char* s_impl = "timing wheel";
+#endif
+
+namespace Global
+{
+
+struct TimerStoreTest
+{
+    static Timer::ptr New(uint64_t next) { return Timer::ptr(new Timer(next)); }
+    static uint64_t Next(const Timer::ptr& timer) { return timer->m_next; }
+};
+
+} // namespace Global
+
+using Global::TimerStoreTest;
+
+// 统计堆分配次数, 检查等待路径上是否分配内存
+static std::atomic<size_t> s_allocs = {0};
+
+void* operator new(size_t size)
+{
+    ++s_allocs;
+    void* p = malloc(size ? size : 1);
+    if(!p)
+    {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void* p) noexcept
+{
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+    free(p);
+}
+
+static uint32_t s_seed = 2463534242u;
+
+static uint32_t Rand()
+{
+    s_seed ^= s_seed << 13;
+    s_seed ^= s_seed >> 17;
+    s_seed ^= s_seed << 5;
+    return s_seed;
+}
+
+/**
+ * 用显式的时间驱动存储结构, 与按到期时间排序的模型对比:
+ * 每次expire恰好取出所有到期时间不晚于now的定时器且按到期时间有序,
+ * nextExpire()任何时候都不晚于最早的到期时间
+ */
+template<class Store>
+class StoreChecker
+{
+public:
+    StoreChecker(const char* name)
+        : m_name(name)
+    {
+        // 时间轮的起点取构造时的时钟, 推进一次后起点确定为m_now + 1
+        m_now = Global::GetMonotonicUs();
+        std::vector<Global::Timer::ptr> out;
+        m_store.expire(m_now, out);
+    }
+
+    ~StoreChecker()
+    {
+        std::vector<Global::Timer::ptr> out;
+        m_store.expire(~0ull - 1, out);
+    }
+
+    uint64_t now() const { return m_now; }
+    int errors() const { return m_errors; }
+
+    Global::Timer::ptr add(uint64_t next)
+    {
+        Global::Timer::ptr timer = TimerStoreTest::New(next);
+        m_store.insert(timer);
+        m_pending.push_back(timer);
+        checkNext("add");
+        return timer;
+    }
+
+    void cancel(const Global::Timer::ptr& timer)
+    {
+        if(!m_store.erase(timer.get()) || m_store.contains(timer.get()))
+        {
+            error("cancel", TimerStoreTest::Next(timer));
+        }
+        m_pending.erase(std::find(m_pending.begin(), m_pending.end(), timer));
+        checkNext("cancel");
+    }
+
+    void advance(uint64_t to)
+    {
+        std::vector<Global::Timer::ptr> out;
+        m_store.expire(to, out);
+        uint64_t last = 0;
+        for(auto& i : out)
+        {
+            uint64_t next = TimerStoreTest::Next(i);
+            auto it = std::find(m_pending.begin(), m_pending.end(), i);
+            if(next > to || it == m_pending.end())
+            {
+                error("expired early or twice", next);
+                continue;
+            }
+            if(next < last)
+            {
+                error("out of order", next);
+            }
+            last = next;
+            m_pending.erase(it);
+        }
+        for(auto& i : m_pending)
+        {
+            if(TimerStoreTest::Next(i) <= to)
+            {
+                error("missed", TimerStoreTest::Next(i));
+            }
+        }
+        m_now = std::max(m_now, to);
+        checkNext("advance");
+    }
+
+    /// 像事件循环一样每次睡到nextExpire()再推进, 直到until
+    void drive(uint64_t until)
+    {
+        size_t limit = m_pending.size() * 8 + 1000;
+        size_t wakeups = 0;
+        while(true)
+        {
+            uint64_t next = m_store.nextExpire();
+            if(next == ~0ull || next > until)
+            {
+                break;
+            }
+            advance(std::max(next, m_now));
+            if(++wakeups > limit)
+            {
+                error("drive does not progress", next);
+                break;
+            }
+        }
+        advance(until);
+    }
+
+    size_t pending() const { return m_pending.size(); }
+    const std::vector<Global::Timer::ptr>& timers() const { return m_pending; }
+
+private:
+    void checkNext(const char* op)
+    {
+        uint64_t earliest = ~0ull;
+        for(auto& i : m_pending)
+        {
+            earliest = std::min(earliest, TimerStoreTest::Next(i));
+        }
+        // 已经过去的到期时间只要求nextExpire()也已到期
+        earliest = std::max(earliest, m_now);
+        uint64_t next = m_store.nextExpire();
+        if(next != ~0ull && next > earliest)
+        {
+            error(op, next);
+            std::cout << "    nextExpire overshoots by " << next - earliest << "us" << std::endl;
+        }
+    }
+
+    void error(const char* what, uint64_t value)
+    {
+        if(++m_errors <= 10)
+        {
+            std::cout << "    " << m_name << " " << what << " at now" << (value >= m_now ? "+" : "-")
+                      << (value >= m_now ? value - m_now : m_now - value) << std::endl;
+        }
+    }
+
+private:
+    const char* m_name;
+    Store m_store;
+    std::vector<Global::Timer::ptr> m_pending;
+    uint64_t m_now;
+    int m_errors = 0;
+};
+
+// 第0层与各层之间的边界: 相对起点的255/256us, 64^k倍的层宽, 按绝对时间对齐的槽位边界, 以及已经过去的时间
+template<class Store>
+void test_boundaries(const char* name)
+{
+    StoreChecker<Store> c(name);
+    uint64_t b = c.now() + 1;
+    uint64_t deltas[] = {0, 1, 255, 256, 257, 511, 512};
+    for(uint64_t d : deltas)
+    {
+        c.add(b + d);
+    }
+    for(int shift = 14; shift <= 32; shift += 6)
+    {
+        c.add(b + (1ull << shift) - 1);
+        c.add(b + (1ull << shift));
+        c.add(b + (1ull << shift) + 1);
+    }
+    for(int shift = 8; shift <= 26; shift += 6)
+    {
+        uint64_t aligned = ((b >> shift) + 1) << shift;
+        c.add(aligned - 1);
+        c.add(aligned);
+        c.add(aligned + 1);
+    }
+    c.add(b + (1ull << 33));
+    c.add(b - 1);
+    c.add(b - 100);
+    // 已过去的定时器在下一次推进时立即取出
+    c.advance(c.now());
+    // 第0层逐微秒推进
+    for(uint64_t t = b; t < b + 600; t++)
+    {
+        c.advance(t);
+    }
+    c.drive(b + (1ull << 34));
+    std::cout << "test_boundaries " << name << " pending=" << c.pending()
+              << " errors=" << c.errors() << " expect=0 0" << std::endl;
+}
+
+// 长时间空闲后一次推进很远, 中间的降层必须全部完成; 之后再加入的定时器相对新的起点放置
+template<class Store>
+void test_idle_gap(const char* name)
+{
+    StoreChecker<Store> c(name);
+    for(int round = 0; round < 3; round++)
+    {
+        uint64_t b = c.now() + 1;
+        for(int i = 0; i < 500; i++)
+        {
+            c.add(b + Rand() % (1ull << (8 + Rand() % 22)));
+        }
+        // 推进到中间的某一点, 部分定时器已降层但未到期
+        c.advance(b + (1ull << 22) + 12345);
+        c.add(c.now() - 10);
+        c.add(c.now() + 256);
+        c.advance(b + (1ull << 31));
+    }
+    std::cout << "test_idle_gap " << name << " pending=" << c.pending()
+              << " errors=" << c.errors() << " expect=0 0" << std::endl;
+}
+
+// 在高层时取消, 以及降到低层之后取消, 取消的定时器不再取出
+template<class Store>
+void test_cancel(const char* name)
+{
+    StoreChecker<Store> c(name);
+    uint64_t b = c.now() + 1;
+    Global::Timer::ptr before = c.add(b + 100000);
+    Global::Timer::ptr after = c.add(b + 100000);
+    Global::Timer::ptr last = c.add(b + 100000 + 300);
+    Global::Timer::ptr keep = c.add(b + 100000 + 1);
+    c.cancel(before);
+    // 推进到到期前几微秒, 这时已经降到第0层
+    c.advance(b + 100000 - 5);
+    c.cancel(after);
+    c.advance(b + 100000 + 1);
+    // 同一槽位中的另一个定时器降层之后取消
+    c.cancel(last);
+    c.drive(b + 200000);
+
+    for(int i = 0; i < 2000; i++)
+    {
+        c.add(c.now() + 1 + Rand() % (1ull << (8 + Rand() % 20)));
+    }
+    for(int step = 0; step < 200; step++)
+    {
+        c.advance(c.now() + Rand() % (1ull << (Rand() % 18)));
+        std::vector<Global::Timer::ptr> timers = c.timers();
+        for(size_t i = 0; i < timers.size(); i += 7 + Rand() % 7)
+        {
+            c.cancel(timers[i]);
+        }
+    }
+    c.drive(c.now() + (1ull << 29));
+    std::cout << "test_cancel " << name << " pending=" << c.pending()
+              << " errors=" << c.errors() << " expect=0 0" << std::endl;
+}
+
+// 随机的加入/取消/推进, 包括过去的到期时间和超出时间轮范围的
+template<class Store>
+void test_random(const char* name)
+{
+    StoreChecker<Store> c(name);
+    for(int step = 0; step < 3000; step++)
+    {
+        uint32_t op = Rand() % 10;
+        if(op < 5)
+        {
+            uint64_t delta = Rand() % (1ull << (Rand() % 30));
+            if(Rand() % 50 == 0)
+            {
+                delta = (1ull << 32) + Rand();
+            }
+            c.add(Rand() % 20 == 0 ? c.now() - Rand() % 1000 : c.now() + delta);
+        }
+        else if(op < 7 && c.pending())
+        {
+            c.cancel(c.timers()[Rand() % c.pending()]);
+        }
+        else if(op < 9)
+        {
+            c.advance(c.now() + Rand() % (1ull << (Rand() % 24)));
+        }
+        else
+        {
+            c.drive(c.now() + Rand() % (1ull << (Rand() % 28)));
+        }
+    }
+    c.drive(c.now() + (1ull << 34));
+    std::cout << "test_random " << name << " pending=" << c.pending()
+              << " errors=" << c.errors() << " expect=0 0" << std::endl;
+}
+
+// 单线程使用, 调用线程拥有唯一的队列
+class TestTimerManager : public Global::TimerManager
+{
+protected:
+    void onTimerInsertedAtFront(size_t queue) override { }
+    int getTimerQueue() override { return 0; }
+};
+
+// 按事件循环的方式等待并执行到期回调, 直到until
+static void RunUntil(TestTimerManager& tm, uint64_t until)
+{
+    while(true)
+    {
+        uint64_t now = Global::GetMonotonicUs();
+        if(now >= until)
+        {
+            break;
+        }
+        uint64_t next = tm.getNextTimerUs();
+        usleep(std::min(next, until - now));
+        std::vector<Global::Task> cbs;
+        tm.listExpiredCb(cbs);
+        for(auto& cb : cbs)
+        {
+            cb();
+        }
+    }
+}
+
+// TimerManager按到期时间顺序执行, 不早于到期时间; 循环定时器按周期重复, 取消后停止
+void test_manager()
+{
+    TestTimerManager tm;
+    std::vector<int> order;
+    int early = 0;
+    int delays[] = {5, 1, 3, 2, 4};
+    for(int d : delays)
+    {
+        uint64_t deadline = Global::GetMonotonicUs() + d * 1000;
+        tm.addTimer(d, [d, deadline, &order, &early](){
+            if(Global::GetMonotonicUs() < deadline)
+            {
+                ++early;
+            }
+            order.push_back(d);
+        });
+    }
+    RunUntil(tm, Global::GetMonotonicUs() + 10 * 1000);
+    bool sorted = order.size() == 5 && std::is_sorted(order.begin(), order.end());
+    std::cout << "test_manager " << s_impl << " fired=" << order.size() << " sorted=" << sorted
+              << " early=" << early << " expect=5 1 0" << std::endl;
+
+    std::vector<uint64_t> stamps;
+    Global::Timer::ptr recurring = tm.addTimerUs(2000, [&stamps](){
+        stamps.push_back(Global::GetMonotonicUs());
+    }, true);
+    RunUntil(tm, Global::GetMonotonicUs() + 21 * 1000);
+    size_t fired = stamps.size();
+    uint64_t min_gap = ~0ull;
+    for(size_t i = 1; i < stamps.size(); i++)
+    {
+        min_gap = std::min(min_gap, stamps[i] - stamps[i - 1]);
+    }
+    recurring->cancel();
+    RunUntil(tm, Global::GetMonotonicUs() + 10 * 1000);
+    std::cout << "test_manager recurring fired=" << fired << " expect~10 min_gap=" << min_gap
+              << "us expect>=2000us after_cancel=" << stamps.size() - fired
+              << " expect=0 has_timer=" << tm.hasTimer() << " expect=0" << std::endl;
+}
+
+// 两个队列, 由current模拟协程在哪个线程上运行
+class MigrateTimerManager : public Global::TimerManager
+{
+public:
+    MigrateTimerManager() : Global::TimerManager(2) { }
+    int current = 0;
+    /// 被唤醒的队列, 由测试模拟其线程的事件循环
+    bool tickled[2] = {false, false};
+
+    void loop()
+    {
+        int saved = current;
+        for(int q = 0; q < 2; q++)
+        {
+            if(tickled[q])
+            {
+                tickled[q] = false;
+                current = q;
+                getNextTimerUs();
+            }
+        }
+        current = saved;
+    }
+protected:
+    void onTimerInsertedAtFront(size_t queue) override { tickled[queue] = true; }
+    int getTimerQueue() override { return current; }
+};
+
+// 像do_io一样反复等待: 在一个队列上armTimer, 被偷到另一个队列上恢复并取消.
+// 原队列的线程被唤醒后移除; 还没来得及移除时用备用的, 稳定后只在两个定时器之间轮换, 不再分配
+void test_migrate()
+{
+    MigrateTimerManager tm;
+    Global::Timer::ptr timer;
+    Global::Timer::ptr spare;
+    int fired = 0;
+    int step = 0;
+    auto wait = [&](int arm_on, int resume_on, uint64_t us) {
+        tm.current = arm_on;
+        tm.armTimer(timer, us, [&fired](){ ++fired; }, &spare);
+        tm.current = resume_on;
+        timer->cancel();
+        // 一半的等待在原队列移除之前就开始下一次
+        if(++step % 2 == 0)
+        {
+            tm.loop();
+        }
+    };
+    // 预热: 创建两个定时器, inbox扩容
+    for(int i = 0; i < 4; i++)
+    {
+        wait(i % 2, 1 - i % 2, 1000000);
+    }
+    // std::set插入会分配, 预先放入预热后的两个定时器
+    std::set<Global::Timer*> objects = {timer.get(), spare.get()};
+    size_t allocs = s_allocs;
+    for(int i = 0; i < 10000; i++)
+    {
+        wait(i % 2, 1 - i % 2, 1000000);
+        objects.insert(timer.get());
+        // 偶尔在同一个队列上恢复
+        if(i % 7 == 0)
+        {
+            wait(i % 2, i % 2, 1000000);
+        }
+    }
+    allocs = s_allocs - allocs;
+    tm.loop();
+    bool has_timer = tm.hasTimer();
+
+    // 迁移后的定时器在新队列上按时触发
+    tm.current = 1;
+    tm.armTimer(timer, 1000, [&fired](){ ++fired; }, &spare);
+    bool reused = objects.count(timer.get()) > 0;
+    uint64_t until = Global::GetMonotonicUs() + 5 * 1000;
+    while(Global::GetMonotonicUs() < until)
+    {
+        usleep(100);
+        std::vector<Global::Task> cbs;
+        tm.listExpiredCb(cbs);
+        for(auto& cb : cbs)
+        {
+            cb();
+        }
+    }
+    std::cout << "test_migrate " << s_impl << " timers=" << objects.size()
+              << " expect<=2 allocs=" << allocs
+#ifdef GLOBAL_TIMER_SET
+              << " (std::set nodes)"
+#else
+              << " expect=0"
+#endif
+              << " has_timer=" << has_timer << " expect=0 reused=" << reused
+              << " expect=1 fired=" << fired << " expect=1" << std::endl;
+}
+
+int main()
+{
+    test_boundaries<Global::TimingWheel>("wheel");
+    test_boundaries<Global::TimerSet>("set");
+    test_idle_gap<Global::TimingWheel>("wheel");
+    test_idle_gap<Global::TimerSet>("set");
+    test_cancel<Global::TimingWheel>("wheel");
+    test_cancel<Global::TimerSet>("set");
+    test_random<Global::TimingWheel>("wheel");
+    test_random<Global::TimerSet>("set");
+    test_manager();
+    test_migrate();
+    return 0;
+}
@@ -0,0 +1,178 @@
+#include "iomanager.h"
+#include "fd_manager.h"
+#include "hook.h"
+#include "utils.h"
+
+#include <atomic>
+#include <iostream>
+#include <thread>
+#include <vector>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// socketpair没有hook, 手动登记使其走协程IO
+static void NewPair(int sv[2])
+{
+    if(socketpair(AF_UNIX, SOCK_STREAM, 0, sv))
+    {
+        perror("socketpair");
+        exit(1);
+    }
+    Global::FdMgr::GetInstance()->get(sv[0], true);
+    Global::FdMgr::GetInstance()->get(sv[1], true);
+}
+
+// 主线程没有hook, 关闭时手动移除fd上下文, 以免之后复用该fd时沿用旧的上下文
+static void ClosePlain(int fd)
+{
+    Global::FdMgr::GetInstance()->del(fd);
+    close(fd);
+}
+
+static void Spin(uint64_t us)
+{
+    uint64_t begin = Global::GetMonotonicUs();
+    while(Global::GetMonotonicUs() - begin < us);
+}
+
+// 外部线程间隔投递, 每次投递时工作线程都已挂起; 丢失唤醒时要等到3s的空闲超时
+void test_tickle()
+{
+    Global::IOManager iom(4, false, "tickle");
+    uint64_t max_us = 0;
+    for(int i = 0; i < 200; i++)
+    {
+        usleep(1000);
+        std::atomic<uint64_t> ran{0};
+        uint64_t begin = Global::GetMonotonicUs();
+        iom.schedule([&ran](){ ran = Global::GetMonotonicUs(); });
+        while(!ran)
+        {
+            usleep(100);
+        }
+        if(ran - begin > max_us)
+        {
+            max_us = ran - begin;
+        }
+    }
+    std::cout << "test_tickle max_latency=" << max_us / 1000 << "ms expect<100ms" << std::endl;
+}
+
+// 多对协程在socketpair上来回传递, 任何一次丢失的唤醒都会让这一对卡住
+void test_ping_pong()
+{
+    const int pairs = 16;
+    const int rounds = 2000;
+    std::atomic<int> finished{0};
+    uint64_t begin = Global::GetMonotonicUs();
+    {
+        Global::IOManager iom(4, false, "pingpong");
+        for(int i = 0; i < pairs; i++)
+        {
+            int sv[2];
+            NewPair(sv);
+            for(int side = 0; side < 2; side++)
+            {
+                int fd = sv[side];
+                iom.schedule([fd, side, &finished](){
+                    char c = 'x';
+                    for(int r = 0; r < rounds; r++)
+                    {
+                        if(side == 0 && write(fd, &c, 1) != 1)
+                        {
+                            return;
+                        }
+                        if(read(fd, &c, 1) != 1)
+                        {
+                            return;
+                        }
+                        if(side == 1 && write(fd, &c, 1) != 1)
+                        {
+                            return;
+                        }
+                    }
+                    ++finished;
+                    close(fd);
+                });
+            }
+        }
+    }
+    std::cout << "test_ping_pong finished=" << finished << " expect=" << pairs * 2
+              << " " << (Global::GetMonotonicUs() - begin) / 1000 << "ms" << std::endl;
+}
+
+// 轮询线程醒来去运行只属于它的任务时, 挂起的线程要接手共享epoll
+void test_poller_handoff()
+{
+    Global::Fiber::SetSharedStack(1, 128 * 1024);
+    int busy[2][2];
+    int sv[2];
+    NewPair(busy[0]);
+    NewPair(busy[1]);
+    NewPair(sv);
+    std::atomic<uint64_t> woke{0};
+    uint64_t max_us = 0;
+    {
+        Global::IOManager iom(2, false, "handoff");
+        // 共享栈协程绑定在第一次运行的线程上, 被唤醒后只在该线程上忙100ms
+        for(int i = 0; i < 2; i++)
+        {
+            int fd = busy[i][0];
+            iom.schedule([fd](){
+                char c;
+                while(read(fd, &c, 1) == 1)
+                {
+                    Spin(100 * 1000);
+                }
+                close(fd);
+            }, -1, true);
+        }
+        iom.schedule([&sv, &woke](){
+            char c;
+            while(read(sv[0], &c, 1) == 1)
+            {
+                woke = Global::GetMonotonicUs();
+            }
+            close(sv[0]);
+        });
+        usleep(50 * 1000);
+        // 轮流让两个线程忙, 总有一轮是轮询线程自己去运行
+        for(int r = 0; r < 6; r++)
+        {
+            write(busy[r % 2][1], "x", 1);
+            usleep(20 * 1000);
+            uint64_t sent = Global::GetMonotonicUs();
+            write(sv[1], "x", 1);
+            usleep(150 * 1000);
+            if(woke - sent > max_us)
+            {
+                max_us = woke - sent;
+            }
+        }
+        ClosePlain(busy[0][1]);
+        ClosePlain(busy[1][1]);
+        ClosePlain(sv[1]);
+    }
+    std::cout << "test_poller_handoff max_latency=" << max_us / 1000 << "ms expect<20ms" << std::endl;
+}
+
+// 最后一个任务结束时挂起的线程要被唤醒退出, 不等空闲超时
+void test_stop()
+{
+    uint64_t begin = Global::GetMonotonicUs();
+    {
+        Global::IOManager iom(4, false, "stop");
+        iom.schedule([](){ usleep(10 * 1000); });
+    }
+    std::cout << "test_stop " << (Global::GetMonotonicUs() - begin) / 1000
+              << "ms expect<1000ms" << std::endl;
+}
+
+int main()
+{
+    test_tickle();
+    test_ping_pong();
+    test_poller_handoff();
+    test_stop();
+    return 0;
+}
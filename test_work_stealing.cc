@@ -0,0 +1,185 @@
+#include "work_stealing_queue.h"
+#include "scheduler.h"
+
+#include <atomic>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+// 所属线程小批量push后pop到空, 每批最后一个元素都要和窃取者竞争; 每个值必须恰好取出一次
+void test_steal_vs_pop()
+{
+    const int total = 200000;
+    const int thieves = 3;
+    Global::WorkStealingQueue<int> queue(64);
+    std::vector<std::atomic<uint8_t> > taken(total);
+    std::atomic<bool> finished{false};
+    std::atomic<int> stolen{0};
+
+    std::vector<std::thread> threads;
+    for(int i = 0; i < thieves; i++)
+    {
+        threads.emplace_back([&](){
+            int v;
+            while(!finished.load(std::memory_order_acquire))
+            {
+                if(queue.steal(v))
+                {
+                    ++taken[v];
+                    ++stolen;
+                }
+            }
+        });
+    }
+
+    int next = 0;
+    int rounds = 0;
+    int v;
+    while(next < total)
+    {
+        int batch = 1 + next % 8;
+        for(int i = 0; i < batch && next < total; i++)
+        {
+            while(!queue.push(next))
+            {
+                if(queue.pop(v))
+                {
+                    ++taken[v];
+                }
+            }
+            ++next;
+        }
+        if(++rounds % 16 == 0)
+        {
+            // 单核上也让窃取者在队列非空时运行
+            std::this_thread::yield();
+        }
+        while(queue.pop(v))
+        {
+            ++taken[v];
+        }
+    }
+    finished = true;
+    for(auto& t : threads)
+    {
+        t.join();
+    }
+    while(queue.steal(v))
+    {
+        ++taken[v];
+    }
+
+    int lost = 0;
+    int twice = 0;
+    for(int i = 0; i < total; i++)
+    {
+        if(taken[i] == 0)
+        {
+            ++lost;
+        }
+        else if(taken[i] > 1)
+        {
+            ++twice;
+        }
+    }
+    std::cout << "test_steal_vs_pop lost=" << lost << " twice=" << twice
+              << " expect=0 0 stolen=" << stolen << std::endl;
+}
+
+// 容量用满后push失败, 不会覆盖未取出的元素
+void test_bounded()
+{
+    Global::WorkStealingQueue<int> queue(16);
+    int pushed = 0;
+    while(queue.push(pushed))
+    {
+        ++pushed;
+    }
+    int v = -1;
+    bool fifo = queue.steal(v) && v == 0;
+    bool lifo = queue.pop(v) && v == pushed - 1;
+    std::cout << "test_bounded pushed=" << pushed << " expect=16 fifo=" << fifo
+              << " lifo=" << lifo << std::endl;
+}
+
+// 外部线程投递 + 工作线程内再投递 + 让出, 本地队列/全局队列/窃取都会经过
+void test_scheduler()
+{
+    const int producers = 3;
+    const int tasks = 20000;
+    std::atomic<int> done{0};
+    Global::Scheduler sc(4, false, "steal");
+    sc.start();
+    std::vector<std::thread> threads;
+    for(int i = 0; i < producers; i++)
+    {
+        threads.emplace_back([&sc, &done](){
+            for(int j = 0; j < tasks; j++)
+            {
+                sc.schedule([&sc, &done](){
+                    for(int k = 0; k < 3; k++)
+                    {
+                        sc.schedule([&done](){ ++done; });
+                    }
+                    Global::Fiber::YieldToReady();
+                    ++done;
+                });
+            }
+        });
+    }
+    for(auto& t : threads)
+    {
+        t.join();
+    }
+    sc.stop();
+    std::cout << "test_scheduler done=" << done << " expect=" << producers * tasks * 4 << std::endl;
+}
+
+// 唤醒方在协程切出之前就把它放回调度器(其他线程上的任务, 或者协程自己),
+// 由执行它的线程切出后再放入队列, 局部变量在恢复后必须完好
+void test_wake_before_switch()
+{
+    const int fibers = 8;
+    const int rounds = 5000;
+    std::atomic<int> done{0};
+    std::atomic<int> bad{0};
+    Global::Scheduler sc(4, false, "wake");
+    sc.start();
+    for(int i = 0; i < fibers; i++)
+    {
+        sc.schedule([&sc, &done, &bad](){
+            uint64_t sum = 0;
+            for(int r = 0; r < rounds; r++)
+            {
+                Global::Fiber::ptr self = Global::Fiber::GetThis();
+                if(r % 2)
+                {
+                    sc.schedule([&sc, self](){ sc.schedule(self); });
+                }
+                else
+                {
+                    sc.schedule(self);
+                }
+                sum += r;
+                Global::Fiber::YieldToHold();
+            }
+            if(sum != (uint64_t)rounds * (rounds - 1) / 2)
+            {
+                ++bad;
+            }
+            ++done;
+        });
+    }
+    sc.stop();
+    std::cout << "test_wake_before_switch done=" << done << " expect=" << fibers
+              << " bad=" << bad << " expect=0" << std::endl;
+}
+
+int main()
+{
+    test_steal_vs_pop();
+    test_bounded();
+    test_scheduler();
+    test_wake_before_switch();
+    return 0;
+}
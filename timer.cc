@@ -1,9 +1,14 @@
 #include "timer.h"
 #include "utils.h"
-#include <iostream>
+#include "macro.h"
+#include <algorithm>
+#include <string.h>
 
 namespace Global
 {
+
+static Logger::ptr g_logger = GLOBAL_LOG_NAME("system");
+
     
 bool Timer::Comparator::operator()(const Timer::ptr& left, const Timer::ptr& right) const
 {
@@ -15,18 +20,26 @@ bool Timer::Comparator::operator()(const Timer::ptr& left, const Timer::ptr& rig
         return false;
     if(left->m_next < right->m_next)
         return true;
-    if(left->m_next >= right->m_next)
+    if(left->m_next > right->m_next)
         return false;
     return left.get() < right.get();
 }
 
-Timer::Timer(uint64_t ms, std::function<void()> cb, bool recurring, TimerManager* manager)
+Timer::Timer(uint64_t us, Task cb, bool recurring, TimerManager* manager)
     : m_recurring(recurring)
-    , m_ms(ms)
-    , m_cb(cb)
+    , m_us(us)
     , m_manager(manager)
 {
-    m_next = Global::GetCurrentMs() + m_ms;
+    if(recurring)
+    {
+        m_recurringCb = std::make_shared<Task>(std::move(cb));
+    }
+    else
+    {
+        m_cb = std::move(cb);
+    }
+    // 缓存的时间可能是一个长任务之前的, 新的到期时间必须从当前时间算起
+    m_next = Global::GetMonotonicUs() + m_us;
 }
 
 Timer::Timer(uint64_t next)
@@ -35,62 +48,394 @@ Timer::Timer(uint64_t next)
 
 bool Timer::cancel()
 {
-    TimerManager::TMutexType::LockGuard Lock(m_manager->m_Tmutex);
-    // TimerManager::TRWMutexType::WriteLock Lock(m_manager->m_Tmutex);
-    if(m_cb)
+    int expected = PENDING;
+    if(!m_state.compare_exchange_strong(expected, CANCELED))
     {
+        return false;
+    }
+    --m_manager->m_count;
+    int current = m_manager->getTimerQueue();
+    if(current == m_queue)
+    {
+        // 所属线程立即移除, inbox中先于取消的操作要先执行
+        TimerManager::TimerQueue& queue = *m_manager->m_queues[m_queue];
+        m_manager->drainInbox(queue);
+        queue.timers.erase(this);
         m_cb = nullptr;
-        auto it = m_manager->m_timers.find(shared_from_this());
-        m_manager->m_timers.erase(it);
+        m_recurringCb.reset();
+        m_attached.store(false, std::memory_order_release);
         return true;
     }
-    return false;
+    // 其他线程交给所属线程尽快移除, 不等到期, 之后可以被armTimer复用
+    TimerManager::TimerOp op;
+    op.timer = shared_from_this();
+    op.remove = true;
+    m_manager->dispatch(std::move(op), current);
+    return true;
 }
 
 bool Timer::refresh()
 {
-    TimerManager::TMutexType::LockGuard lock(m_manager->m_Tmutex);
-    // TimerManager::TRWMutexType::WriteLock lock(m_manager->m_Tmutex);
-    if(!m_cb) return false;
+    if(!isActive()) return false;
 
-    auto it = m_manager->m_timers.find(shared_from_this());
-    if(it == m_manager->m_timers.end()) return false;
-    m_manager->m_timers.erase(it);
-    m_next = Global::GetCurrentMs() + m_ms;
-    m_manager->m_timers.insert(shared_from_this());
+    TimerManager::TimerOp op;
+    op.timer = shared_from_this();
+    op.reset = true;
+    op.from_now = true;
+    m_manager->dispatch(std::move(op), m_manager->getTimerQueue());
     return true;
 }
 
 bool Timer::reset(uint64_t ms, bool from_now)
 {
-    if(ms == m_ms && !from_now) {
+    return resetUs(ms * 1000, from_now);
+}
+
+bool Timer::resetUs(uint64_t us, bool from_now)
+{
+    if(!isActive()) {
+        return false;
+    }
+    TimerManager::TimerOp op;
+    op.timer = shared_from_this();
+    op.reset = true;
+    op.us = us;
+    op.from_now = from_now;
+    m_manager->dispatch(std::move(op), m_manager->getTimerQueue());
+    return true;
+}
+
+bool TimerSet::insert(const Timer::ptr& timer)
+{
+    return m_timers.insert(timer).first == m_timers.begin();
+}
+
+bool TimerSet::erase(Timer* timer)
+{
+    return m_timers.erase(timer->shared_from_this()) > 0;
+}
+
+bool TimerSet::contains(Timer* timer) const
+{
+    return m_timers.count(timer->shared_from_this()) > 0;
+}
+
+uint64_t TimerSet::nextExpire()
+{
+    return m_timers.empty() ? ~0ull : (*m_timers.begin())->m_next;
+}
+
+void TimerSet::expire(uint64_t now, std::vector<Timer::ptr>& expireds)
+{
+    Timer::ptr now_timer(new Timer(now));
+    auto it = m_timers.lower_bound(now_timer);
+    while (it != m_timers.end() && (*it)->m_next == now)
+    {
+        ++it;
+    }
+    expireds.insert(expireds.end(), m_timers.begin(), it);
+    m_timers.erase(m_timers.begin(), it);
+}
+
+TimingWheel::TimingWheel()
+    : m_base(Global::GetMonotonicUs())
+{
+    m_overdue = nullptr;
+    memset(m_root, 0, sizeof(m_root));
+    memset(m_nodes, 0, sizeof(m_nodes));
+    memset(m_rootBits, 0, sizeof(m_rootBits));
+    memset(m_nodeBits, 0, sizeof(m_nodeBits));
+}
+
+TimingWheel::~TimingWheel()
+{
+    // 释放定时器对自身的引用
+    std::vector<Timer::ptr> timers;
+    drainAll(timers);
+}
+
+bool TimingWheel::insert(const Timer::ptr& timer)
+{
+    GLOBAL_ASSERT(!timer->m_slot);
+    timer->m_self = timer;
+    place(timer.get());
+    ++m_size;
+    if(!m_nextValid)
+    {
+        // 不知道当前最早时间, 按可能提前处理
         return true;
     }
-    TimerManager::TMutexType::LockGuard lock(m_manager->m_Tmutex);
-    // TimerManager::TRWMutexType::WriteLock lock(m_manager->m_Tmutex);
-    if(!m_cb) {
+    if(timer->m_next >= m_next)
+    {
         return false;
     }
-    auto it = m_manager->m_timers.find(shared_from_this());
-    if(it == m_manager->m_timers.end()) {
+    m_next = timer->m_next;
+    return true;
+}
+
+bool TimingWheel::erase(Timer* timer)
+{
+    if(!timer->m_slot)
+    {
         return false;
     }
-    m_manager->m_timers.erase(it);
-    uint64_t start = 0;
-    if(from_now) {
-        start = Global::GetCurrentMs();
-    } else {
-        start = m_next - m_ms;
+    if(timer->m_prevNode)
+    {
+        timer->m_prevNode->m_nextNode = timer->m_nextNode;
+    }
+    else
+    {
+        *timer->m_slot = timer->m_nextNode;
+    }
+    if(timer->m_nextNode)
+    {
+        timer->m_nextNode->m_prevNode = timer->m_prevNode;
     }
-    m_ms = ms;
-    m_next = start + m_ms;
-    m_manager->addTimer(shared_from_this(), lock);
+    updateBit(timer->m_slot);
+    timer->m_prevNode = timer->m_nextNode = nullptr;
+    timer->m_slot = nullptr;
+    --m_size;
+    // 调用方持有timer, 这里释放自身引用是安全的
+    timer->m_self.reset();
     return true;
 }
 
-TimerManager::TimerManager()
+void TimingWheel::place(Timer* timer)
+{
+    uint64_t expires = timer->m_next;
+    uint64_t delta = expires - m_base;
+    Timer** slot = nullptr;
+    if(expires < m_base)
+    {
+        // 到期时间已经推进过, 下一次expire直接取出
+        slot = &m_overdue;
+    }
+    else if(delta < ROOT_SIZE)
+    {
+        slot = &m_root[expires & ROOT_MASK];
+    }
+    else
+    {
+        if(delta >= MAX_DELTA)
+        {
+            expires = m_base + MAX_DELTA - 1;
+            delta = MAX_DELTA - 1;
+        }
+        for(int level = 0; level < NODE_LEVELS; level++)
+        {
+            int shift = ROOT_BITS + level * NODE_BITS;
+            if(delta < (1ull << (shift + NODE_BITS)))
+            {
+                slot = &m_nodes[level][(expires >> shift) & NODE_MASK];
+                break;
+            }
+        }
+    }
+    timer->m_slot = slot;
+    timer->m_prevNode = nullptr;
+    timer->m_nextNode = *slot;
+    if(*slot)
+    {
+        (*slot)->m_prevNode = timer;
+    }
+    *slot = timer;
+    updateBit(slot);
+}
+
+void TimingWheel::cascade(int level, size_t index)
+{
+    Timer* timer = m_nodes[level][index];
+    m_nodes[level][index] = nullptr;
+    m_nodeBits[level] &= ~(1ull << index);
+    while(timer)
+    {
+        Timer* next = timer->m_nextNode;
+        place(timer);
+        timer = next;
+    }
+}
+
+void TimingWheel::drain(Timer** slot, std::vector<Timer::ptr>& timers)
+{
+    Timer* timer = *slot;
+    *slot = nullptr;
+    updateBit(slot);
+    while(timer)
+    {
+        Timer* next = timer->m_nextNode;
+        timer->m_prevNode = timer->m_nextNode = nullptr;
+        timer->m_slot = nullptr;
+        timers.push_back(std::move(timer->m_self));
+        --m_size;
+        timer = next;
+    }
+}
+
+void TimingWheel::updateBit(Timer** slot)
+{
+    uint64_t* word;
+    size_t bit;
+    if(slot >= m_root && slot < m_root + ROOT_SIZE)
+    {
+        size_t index = slot - m_root;
+        word = &m_rootBits[index / 64];
+        bit = index % 64;
+    }
+    else if(slot != &m_overdue)
+    {
+        size_t offset = slot - &m_nodes[0][0];
+        word = &m_nodeBits[offset / NODE_SIZE];
+        bit = offset % NODE_SIZE;
+    }
+    else
+    {
+        return;
+    }
+    if(*slot)
+    {
+        *word |= 1ull << bit;
+    }
+    else
+    {
+        *word &= ~(1ull << bit);
+    }
+}
+
+uint64_t TimingWheel::nextTick() const
+{
+    uint64_t next = ~0ull;
+    // 第0层从m_base所在槽位开始环形查找, 最后一轮补上起始字中m_base之前的位
+    size_t start = m_base & ROOT_MASK;
+    for(size_t n = 0; n <= ROOT_WORDS; n++)
+    {
+        size_t word = ((start / 64) + n) % ROOT_WORDS;
+        uint64_t bits = m_rootBits[word];
+        if(n == 0)
+        {
+            bits &= ~0ull << (start % 64);
+        }
+        else if(n == ROOT_WORDS)
+        {
+            bits &= (1ull << (start % 64)) - 1;
+        }
+        if(bits)
+        {
+            size_t index = word * 64 + __builtin_ctzll(bits);
+            next = m_base + ((index - start) & ROOT_MASK);
+            break;
+        }
+    }
+    for(int level = 0; level < NODE_LEVELS; level++)
+    {
+        uint64_t bits = m_nodeBits[level];
+        if(!bits)
+        {
+            continue;
+        }
+        int shift = ROOT_BITS + level * NODE_BITS;
+        uint64_t current = m_base >> shift;
+        size_t cur = current & NODE_MASK;
+        // 旋转到当前槽位为第0位
+        uint64_t rotated = cur ? ((bits >> cur) | (bits << (NODE_SIZE - cur))) : bits;
+        size_t offset;
+        if((m_base & ((1ull << shift) - 1)) && (rotated & 1))
+        {
+            // 不在边界上时当前槽位已降过层, 其中的定时器要等转完一圈
+            rotated &= ~1ull;
+            offset = rotated ? __builtin_ctzll(rotated) : NODE_SIZE;
+        }
+        else
+        {
+            offset = __builtin_ctzll(rotated);
+        }
+        uint64_t cascade_at = (current + offset) << shift;
+        if(cascade_at < next)
+        {
+            next = cascade_at;
+        }
+    }
+    return next;
+}
+
+uint64_t TimingWheel::nextExpire()
 {
-    m_previousTime = Global::GetCurrentMs();
+    if(m_size == 0)
+    {
+        return ~0ull;
+    }
+    if(!m_nextValid)
+    {
+        m_next = m_overdue ? m_base - 1 : nextTick();
+        m_nextValid = true;
+    }
+    return m_next;
+}
+
+void TimingWheel::expire(uint64_t now, std::vector<Timer::ptr>& expireds)
+{
+    // 过期链表按插入顺序排列, 取出后按到期时间排序, 它们都早于之后各槽位中的定时器
+    size_t overdue = expireds.size();
+    drain(&m_overdue, expireds);
+    if(expireds.size() - overdue > 1)
+    {
+        std::sort(expireds.begin() + overdue, expireds.end(), Timer::Comparator());
+    }
+    while(m_base <= now)
+    {
+        // 中间的空槽位和空的降层都可以跳过
+        uint64_t tick = m_size ? nextTick() : ~0ull;
+        if(tick > now)
+        {
+            m_base = now + 1;
+            break;
+        }
+        m_base = tick;
+        size_t index = m_base & ROOT_MASK;
+        if(index == 0)
+        {
+            // 第0层转完一圈, 逐层降层直到某一层没有进位
+            for(int level = 0; level < NODE_LEVELS; level++)
+            {
+                size_t node = (m_base >> (ROOT_BITS + level * NODE_BITS)) & NODE_MASK;
+                cascade(level, node);
+                if(node != 0)
+                {
+                    break;
+                }
+            }
+        }
+        drain(&m_root[index], expireds);
+        ++m_base;
+    }
+    if(m_nextValid && m_next <= now)
+    {
+        m_nextValid = false;
+    }
+}
+
+void TimingWheel::drainAll(std::vector<Timer::ptr>& timers)
+{
+    drain(&m_overdue, timers);
+    for(size_t i = 0; i < ROOT_SIZE; i++)
+    {
+        drain(&m_root[i], timers);
+    }
+    for(int level = 0; level < NODE_LEVELS; level++)
+    {
+        for(size_t i = 0; i < NODE_SIZE; i++)
+        {
+            drain(&m_nodes[level][i], timers);
+        }
+    }
+    m_nextValid = false;
+}
+
+TimerManager::TimerManager(size_t queues)
+{
+    for(size_t i = 0; i < queues; i++)
+    {
+        m_queues.emplace_back(new TimerQueue);
+    }
 }
 
 TimerManager::~TimerManager()
@@ -98,131 +443,298 @@ TimerManager::~TimerManager()
 
 }
 
-Timer::ptr TimerManager::addTimer(uint64_t ms, std::function<void()> cb, bool recurring)
+Timer::ptr TimerManager::addTimer(uint64_t ms, Task cb, bool recurring)
+{
+    Timer::ptr t = addTimer(new Timer(ms * 1000, std::move(cb), recurring, this));
+    GLOBAL_LOG_DEBUG(g_logger) << "add timer";
+    return t;
+}
+
+Timer::ptr TimerManager::addTimerUs(uint64_t us, Task cb, bool recurring)
+{
+    return addTimer(new Timer(us, std::move(cb), recurring, this));
+}
+
+Timer::ptr TimerManager::addTimer(Timer* timer)
 {
-    Timer::ptr t(new Timer(ms, cb, recurring, this));
-    TMutexType::LockGuard Lock(m_Tmutex);
-    // TRWMutexType::WriteLock Lock(m_Tmutex);
-    addTimer(t, Lock);
-    std::cout << "add timer\n";
+    Timer::ptr t(timer);
+    int current = getTimerQueue();
+    t->m_queue = current >= 0 ? current : (int)(m_nextQueue++ % m_queues.size());
+    ++m_count;
+    t->m_attached.store(true, std::memory_order_relaxed);
+    TimerOp op;
+    op.timer = t;
+    dispatch(std::move(op), current);
     return t;
 }
 
-void TimerManager::addTimer(Timer::ptr val, TMutexType::LockGuard& Lock)
-// void TimerManager::addTimer(Timer::ptr val, TRWMutexType::WriteLock& Lock)
+void TimerManager::dispatch(TimerOp&& op, int current)
+{
+    int index = op.timer->m_queue;
+    TimerQueue& queue = *m_queues[index];
+    if(current == index)
+    {
+        // 所属线程正在运行, 下次等待前会重新计算超时, 不需要唤醒
+        apply(queue, op);
+        return;
+    }
+    {
+        TMutexType::LockGuard lock(queue.mutex);
+        queue.inbox.push_back(std::move(op));
+        queue.hasInbox.store(true, std::memory_order_release);
+    }
+    onTimerInsertedAtFront(index);
+}
 
+void TimerManager::apply(TimerQueue& queue, TimerOp& op)
 {
-    auto it = m_timers.insert(val).first;
-    bool at_front = (it == m_timers.begin()) && !m_tickled;
-    if(at_front) m_tickled = true;
-    Lock.unlock();
-    if(at_front)
+    Timer* timer = op.timer.get();
+    if(op.remove)
     {
-        onTimerInsertedAtFront();
+        queue.timers.erase(timer);
+        timer->m_cb = nullptr;
+        timer->m_recurringCb.reset();
+        // 之后所属线程不再访问它
+        timer->m_attached.store(false, std::memory_order_release);
+        return;
+    }
+    if(!timer->isActive())
+    {
+        // 已被取消, 由取消时的移除操作处理
+        return;
     }
-        
+    // 新加入的定时器不在队列中, erase返回false
+    queue.timers.erase(timer);
+    if(op.reset)
+    {
+        uint64_t us = op.us == ~0ull ? timer->m_us : op.us;
+        uint64_t start = op.from_now ? Global::GetMonotonicUs() : timer->m_next - timer->m_us;
+        timer->m_us = us;
+        timer->m_next = start + us;
+    }
+    queue.timers.insert(op.timer);
 }
 
-static void OnTimer(std::weak_ptr<void> weak_cond, std::function<void()> cb)
+void TimerManager::drainInbox(TimerQueue& queue)
 {
-    std::shared_ptr<void> tmp = weak_cond.lock();
-    if(tmp)
+    if(!queue.hasInbox.load(std::memory_order_acquire))
+    {
+        return;
+    }
+    std::vector<TimerOp> ops;
+    {
+        TMutexType::LockGuard lock(queue.mutex);
+        ops.swap(queue.inbox);
+        queue.hasInbox.store(false, std::memory_order_relaxed);
+    }
+    for(auto& op : ops)
     {
-        cb();
+        apply(queue, op);
     }
+    ops.clear();
+    TMutexType::LockGuard lock(queue.mutex);
+    if(queue.inbox.empty())
+    {
+        // 把容量还给inbox, 之后放入操作不再分配内存
+        queue.inbox.swap(ops);
+    }
+}
+
+/**
+ * @brief 包装条件定时器的回调
+ * @details 条件在回调执行时才lock, 执行期间一直持有, 不会在条件对象析构之后运行
+ */
+static Task OnTimer(std::weak_ptr<void> weak_cond, Task cb)
+{
+    return [weak_cond, cb = std::move(cb)]() mutable {
+        std::shared_ptr<void> tmp = weak_cond.lock();
+        if(tmp)
+        {
+            cb();
+        }
+    };
+}
+
+Timer::ptr TimerManager::addConditionTimer(uint64_t ms, Task cb,
+                                    std::weak_ptr<void> weak_cond, bool recurring)
+{
+    return addConditionTimerUs(ms * 1000, std::move(cb), std::move(weak_cond), recurring);
 }
 
-Timer::ptr TimerManager::addConditionTimer(uint64_t ms, std::function<void()> cb,
+Timer::ptr TimerManager::addConditionTimerUs(uint64_t us, Task cb,
                                     std::weak_ptr<void> weak_cond, bool recurring)
 {
-    return addTimer(ms, std::bind(&OnTimer ,weak_cond, cb), recurring);
+    // 条件保存在定时器上, 到期时先检查一次, 派发时才包装回调
+    Timer* t = new Timer(us, std::move(cb), recurring, this);
+    t->m_cond = std::move(weak_cond);
+    t->m_hasCond = true;
+    return addTimer(t);
+}
+
+bool TimerManager::canRearm(Timer* timer, int current)
+{
+    if(!timer || timer->m_recurring || timer->isActive())
+    {
+        return false;
+    }
+    if(timer->m_queue == current)
+    {
+        // 其他线程的取消可能还在自己的inbox中
+        drainInbox(*m_queues[current]);
+    }
+    return !timer->m_attached.load(std::memory_order_acquire);
+}
+
+void TimerManager::armTimer(Timer::ptr& timer, uint64_t us, Task cb, Timer::ptr* spare)
+{
+    int current = getTimerQueue();
+    if(current < 0)
+    {
+        timer = addTimerUs(us, std::move(cb));
+        return;
+    }
+    if(!canRearm(timer.get(), current))
+    {
+        if(!spare || !canRearm(spare->get(), current))
+        {
+            // 原队列还没有移除, 新建; 没有备用的时候把它留作备用
+            if(spare && !*spare)
+            {
+                *spare = std::move(timer);
+            }
+            timer = addTimerUs(us, std::move(cb));
+            return;
+        }
+        timer.swap(*spare);
+    }
+    // 原队列不再访问它, 迁移到调用线程的队列
+    TimerQueue& queue = *m_queues[current];
+    timer->m_queue = current;
+    timer->m_us = us;
+    timer->m_next = Global::GetMonotonicUs() + us;
+    timer->m_cb = std::move(cb);
+    timer->m_hasCond = false;
+    timer->m_cond.reset();
+    timer->m_attached.store(true, std::memory_order_relaxed);
+    timer->m_state.store(Timer::PENDING, std::memory_order_release);
+    ++m_count;
+    queue.timers.insert(timer);
 }
 
 uint64_t TimerManager::getNextTimer()
 {
-    TMutexType::LockGuard Lock(m_Tmutex);
-    // TRWMutexType::ReadLock Lock(m_Tmutex);
-    m_tickled = false;
-    if(m_timers.empty())
+    uint64_t next = getNextTimerUs();
+    if(next == ~0ull)
+    {
+        return ~0ull;
+    }
+    // 向上取整, 避免毫秒超时的调用方提前醒来后空转
+    return (next + 999) / 1000;
+}
+
+uint64_t TimerManager::getNextTimerUs()
+{
+    int index = getTimerQueue();
+    if(index < 0)
+    {
+        return ~0ull;
+    }
+    TimerQueue& queue = *m_queues[index];
+    drainInbox(queue);
+    uint64_t next = queue.timers.nextExpire();
+    if(next == ~0ull)
     {
         return ~0ull;       // unsigned long long
     }
-    const Timer::ptr& next = *m_timers.begin();
-    uint64_t now_ms = Global::GetCurrentMs();
-    if(now_ms >= next->m_next)
+    uint64_t now_us = Global::GetCachedUs();
+    if(now_us >= next)
     {
         return 0;
     }
     else{
-        return next->m_next - now_ms;
+        return next - now_us;
     }
 }
 
-void TimerManager::listExpiredCb(std::vector<std::function<void()> >& cbs)
+void TimerManager::listExpiredCb(std::vector<Task>& cbs)
 {
-    uint64_t now = Global::GetCurrentMs();
-    std::vector<Timer::ptr> expireds;
-
+    int index = getTimerQueue();
+    if(index < 0)
     {
-        TMutexType::LockGuard Lock(m_Tmutex);
-        // TRWMutexType::WriteLock Lock(m_Tmutex);
-        if(m_timers.empty()) return;
+        return;
     }
+    TimerQueue& queue = *m_queues[index];
+    drainInbox(queue);
+    if(queue.timers.empty()) return;
 
-    // std::cout << "m_timers: " <<m_timers.size() << std::endl;
-
-    TMutexType::LockGuard Lock(m_Tmutex);
-    // TRWMutexType::WriteLock Lock(m_Tmutex);
-    if(m_timers.empty()) return;
-    bool rollover = detectClockRollover(now);
-    if(!rollover && (*m_timers.begin())->m_next > now)
+    uint64_t now = Global::GetCachedUs();
+    if(queue.timers.nextExpire() > now)
     {
         return;
     }
-    Timer::ptr now_timer(new Timer(now));
-    auto it = rollover ? m_timers.end() : m_timers.lower_bound(now_timer);
-    while (it != m_timers.end() && (*it)->m_next == now)
-    {
-        ++it;
-    }
-    expireds.insert(expireds.begin(), m_timers.begin(), it);
-    m_timers.erase(m_timers.begin(), it);
-    cbs.reserve(expireds.size());
+    std::vector<Timer::ptr> expireds;
+    queue.timers.expire(now, expireds);
+    cbs.reserve(cbs.size() + expireds.size());
     
     for(auto& timer : expireds)
     {
-        cbs.push_back(timer->m_cb);
+        // 条件已失效的不再派发; 派发的回调执行时还要再检查一次, 见OnTimer
+        bool fire = !timer->m_hasCond || !timer->m_cond.expired();
         if(timer->m_recurring)
         {
-            timer->m_next = now + timer->m_ms;
-            m_timers.insert(timer);
+            if(!timer->isActive())
+            {
+                // 在取出inbox之后被其他线程取消, 不再放回
+                timer->m_recurringCb.reset();
+                continue;
+            }
+            if(fire)
+            {
+                std::shared_ptr<Task> cb = timer->m_recurringCb;
+                if(timer->m_hasCond)
+                {
+                    std::weak_ptr<void> cond = timer->m_cond;
+                    cbs.push_back([cond, cb](){
+                        std::shared_ptr<void> tmp = cond.lock();
+                        if(tmp)
+                        {
+                            (*cb)();
+                        }
+                    });
+                }
+                else
+                {
+                    cbs.push_back([cb](){ (*cb)(); });
+                }
+            }
+            timer->m_next = now + timer->m_us;
+            queue.timers.insert(timer);
+            continue;
         }
-        else
+        int expected = Timer::PENDING;
+        if(timer->m_state.compare_exchange_strong(expected, Timer::FIRED))
         {
+            --m_count;
+            if(fire)
+            {
+                cbs.push_back(timer->m_hasCond
+                        ? OnTimer(timer->m_cond, std::move(timer->m_cb))
+                        : std::move(timer->m_cb));
+            }
             timer->m_cb = nullptr;
+            // 触发后取消不会成功, inbox中不会再有它的移除操作
+            timer->m_attached.store(false, std::memory_order_release);
+            continue;
         }
+        // 其他线程取消的, 由inbox中的移除操作清除m_attached
+        timer->m_cb = nullptr;
     }
     
 }
 
-bool TimerManager::detectClockRollover(uint64_t now_ms)
-{
-    bool rollover = false;
-    if(now_ms < m_previousTime &&
-        now_ms < (m_previousTime - 60 * 60 * 1000))
-    {
-        rollover = true;
-    }
-    m_previousTime = now_ms;
-    return rollover;
-}
-
 bool TimerManager::hasTimer()
 {
-    // 多线程访问 
-    TMutexType::LockGuard Lock(m_Tmutex);
-    // TRWMutexType::ReadLock Lock(m_Tmutex);
-    return !m_timers.empty();
+    return m_count > 0;
 }
 
 
@@ -2,6 +2,8 @@
 #define __TIMER_H__
 
 #include "thread.h"
+#include "task.h"
+#include <atomic>
 #include <set>
 #include <memory>
 #include <vector>
@@ -14,22 +16,70 @@ class TimerManager;
 class Timer : public std::enable_shared_from_this<Timer>
 {
 friend class TimerManager;
+friend class TimerSet;
+friend class TimingWheel;
+/// test_timer中直接构造到期时间确定的定时器
+friend struct TimerStoreTest;
 public:
     typedef std::shared_ptr<Timer> ptr;
+    /**
+     * @brief 取消定时器, 任意线程可调用
+     * @details 在所属线程上立即移除; 其他线程设置取消标记后放入所属队列的inbox,
+     *          由所属线程下一次处理inbox时移除
+     */
     bool cancel();
+    /// 其他线程调用时由所属线程异步完成
     bool refresh();
+    /// 其他线程调用时由所属线程异步完成
     bool reset(uint64_t ms, bool from_now);
+    /// 同reset, 周期为微秒
+    bool resetUs(uint64_t us, bool from_now);
 
 private:
-    Timer(uint64_t ms, std::function<void()> cb, bool recurring, TimerManager* tm);
+    Timer(uint64_t us, Task cb, bool recurring, TimerManager* tm);
     Timer(uint64_t next);
 
+    enum State
+    {
+        PENDING  = 0,
+        CANCELED = 1,
+        FIRED    = 2
+    };
+
+    /// 定时器是否仍有效(未触发且未取消)
+    bool isActive() const { return m_state.load(std::memory_order_acquire) == PENDING; }
+
 private:
     bool m_recurring = false;
-    uint64_t m_ms = 0;
+    bool m_hasCond = false;
+    /// 周期(微秒)
+    uint64_t m_us = 0;
+    /// 到期时间(单调时钟微秒)
     uint64_t m_next;
-    std::function<void()> m_cb;
+    /// 一次性定时器的回调, 到期时直接移出, 不再拷贝
+    Task m_cb;
+    /// 循环定时器的回调, 每次到期派发一个持有它的轻量任务
+    std::shared_ptr<Task> m_recurringCb;
+    /// 条件定时器的条件, 到期时和回调执行时已失效则丢弃回调
+    std::weak_ptr<void> m_cond;
     TimerManager* m_manager = nullptr;
+    /// 取消和一次性定时器到期通过CAS竞争, 只有一方成功
+    std::atomic<int> m_state = {PENDING};
+    /// 所属队列下标, 回调和存储位置只由该队列的线程访问
+    int m_queue = -1;
+    /**
+     * 所属队列是否还引用它: 在存储结构中, 或其他线程的取消还在inbox中.
+     * 所属线程移除后以release写入false, 之后armTimer可以把它迁移到任意队列
+     */
+    std::atomic<bool> m_attached = {false};
+
+    /// 时间轮槽位中的双向链表
+    Timer* m_prevNode = nullptr;
+    Timer* m_nextNode = nullptr;
+    /// 所在槽位的表头, 不在时间轮中时为nullptr
+    Timer** m_slot = nullptr;
+    /// 在时间轮中时持有自身, 调用方丢弃Timer::ptr后仍会到期
+    Timer::ptr m_self;
 
 private:
     struct Comparator
@@ -38,7 +88,103 @@ private:
     };
 }; 
 
+/**
+ * @brief 按到期时间排序的std::set, 插入和删除O(log n)
+ */
+class TimerSet
+{
+public:
+    /// @return 是否成为最早到期的定时器
+    bool insert(const Timer::ptr& timer);
+    /// @return 定时器不在集合中时返回false
+    bool erase(Timer* timer);
+    bool empty() const { return m_timers.empty(); }
+    bool contains(Timer* timer) const;
+    /// 最早到期时间, 为空时返回~0ull
+    uint64_t nextExpire();
+    /// 取出所有到期时间不晚于now的定时器
+    void expire(uint64_t now, std::vector<Timer::ptr>& expireds);
+
+private:
+    std::set<Timer::ptr, Timer::Comparator> m_timers;
+};
+
+/**
+ * @brief 微秒精度的分层时间轮, 插入和删除O(1)
+ * @details 第0层256个槽位每个1us, 之上4层每层64个槽位, 共覆盖2^32us(约71分钟),
+ *          更远的定时器先放在最高层, 降层时按真实到期时间重新放置.
+ *          槽位是侵入式双向链表, 插入和删除不分配内存.
+ *          推进时第0层转完一圈, 把上一层当前槽位的定时器降到下一层.
+ *          每层用位图记录非空槽位, 推进时直接跳到下一个非空槽位或降层时间
+ */
+class TimingWheel
+{
+public:
+    TimingWheel();
+    ~TimingWheel();
+
+    /// @return 是否可能早于之前计算的最早到期时间
+    bool insert(const Timer::ptr& timer);
+    /// @return 定时器不在时间轮中时返回false
+    bool erase(Timer* timer);
+    bool empty() const { return m_size == 0; }
+    bool contains(Timer* timer) const { return timer->m_slot != nullptr; }
+    /**
+     * @brief 最早到期时间的下界, 为空时返回~0ull
+     * @details 只有高层有定时器时返回其降层时间, 到时唤醒一次完成降层
+     */
+    uint64_t nextExpire();
+    /// 推进到now, 取出所有到期时间不晚于now的定时器
+    void expire(uint64_t now, std::vector<Timer::ptr>& expireds);
+
+private:
+    static const int ROOT_BITS = 8;
+    static const int NODE_BITS = 6;
+    static const int NODE_LEVELS = 4;
+    static const size_t ROOT_SIZE = 1 << ROOT_BITS;
+    static const size_t NODE_SIZE = 1 << NODE_BITS;
+    static const uint64_t ROOT_MASK = ROOT_SIZE - 1;
+    static const uint64_t NODE_MASK = NODE_SIZE - 1;
+    /// 可直接表示的最大时间差
+    static const uint64_t MAX_DELTA = 1ull << (ROOT_BITS + NODE_LEVELS * NODE_BITS);
+    static const size_t ROOT_WORDS = ROOT_SIZE / 64;
+
+    /// 按到期时间放入对应层的槽位
+    void place(Timer* timer);
+    /// 把第level层index槽位的定时器重新放置
+    void cascade(int level, size_t index);
+    /// 取出槽位中的全部定时器
+    void drain(Timer** slot, std::vector<Timer::ptr>& timers);
+    void drainAll(std::vector<Timer::ptr>& timers);
+    /// 按槽位是否为空更新位图
+    void updateBit(Timer** slot);
+    /// 不早于m_base的第一个需要处理的时刻(非空的第0层槽位或降层), 不含m_overdue
+    uint64_t nextTick() const;
+
+private:
+    /// 到期时间早于m_base的定时器
+    Timer* m_overdue;
+    Timer* m_root[ROOT_SIZE];
+    Timer* m_nodes[NODE_LEVELS][NODE_SIZE];
+    /// 非空槽位的位图
+    uint64_t m_rootBits[ROOT_WORDS];
+    uint64_t m_nodeBits[NODE_LEVELS];
+    /// 下一个要处理的微秒
+    uint64_t m_base;
+    size_t m_size = 0;
+    /// 缓存的最早到期时间下界
+    uint64_t m_next = 0;
+    bool m_nextValid = false;
+};
+
 
+/**
+ * @brief 定时器管理
+ * @details 每个线程一个定时器队列, 定时器归创建它的线程所有, 所属线程增删不加锁.
+ *          其他线程的添加/refresh/reset/取消放入所属队列的inbox, 由所属线程下一次
+ *          getNextTimer/listExpiredCb时取出.
+ *          getNextTimer和listExpiredCb只处理调用线程自己的队列
+ */
 class TimerManager
 {
 friend Timer;
@@ -46,36 +192,115 @@ public:
     typedef Global::Mutex TMutexType;
     typedef Global::RWMutex TRWMutexType;
     
-    TimerManager();
+    /**
+     * @param[in] queues 定时器队列数, 一般等于工作线程数
+     */
+    TimerManager(size_t queues = 1);
     virtual ~TimerManager();
 
-    Timer::ptr addTimer(uint64_t ms, std::function<void()> cb,
+    Timer::ptr addTimer(uint64_t ms, Task cb,
                         bool recurring = false);
 
-    Timer::ptr addConditionTimer(uint64_t ms, std::function<void()> cb,
+    Timer::ptr addConditionTimer(uint64_t ms, Task cb,
                                  std::weak_ptr<void> weak_cond,
                                  bool recurring = false);
+
+    /// 微秒精度的定时器
+    Timer::ptr addTimerUs(uint64_t us, Task cb,
+                          bool recurring = false);
+
+    Timer::ptr addConditionTimerUs(uint64_t us, Task cb,
+                                   std::weak_ptr<void> weak_cond,
+                                   bool recurring = false);
+
+    /**
+     * @brief us微秒后执行cb, 尽量复用timer原来的对象
+     * @details timer已触发或已取消, 且原队列不再引用它时, 迁移到调用线程的队列重新加入
+     *          (时间轮下不分配内存). 原队列还没处理其他线程的取消时改用spare并与timer交换,
+     *          都不能复用才新建一次性定时器. 用于等待路径上反复设置的超时,
+     *          timer和spare只能由armTimer设置, 不能refresh/reset
+     * @param[in, out] spare 备用定时器, 协程在线程间迁移后上一个定时器可能还在原队列中
+     */
+    void armTimer(Timer::ptr& timer, uint64_t us, Task cb, Timer::ptr* spare = nullptr);
     
+    /**
+     * @brief 调用线程队列中最近的到期时间
+     * @return 距离现在的毫秒数(向上取整), 没有定时器或调用线程没有队列时返回~0ull
+     */
     uint64_t getNextTimer();
 
-    void listExpiredCb(std::vector<std::function<void()> >& cbs);
+    /// 同getNextTimer, 返回微秒数
+    uint64_t getNextTimerUs();
+
+    /// 取出调用线程队列中已到期的回调
+    void listExpiredCb(std::vector<Task>& cbs);
 
+    /// 所有队列中是否还有未触发且未取消的定时器
     bool hasTimer();
 
 protected:
-    virtual void onTimerInsertedAtFront() = 0;
-    void addTimer(Timer::ptr val, TMutexType::LockGuard& lock);
-    void addTimer(Timer::ptr val, TRWMutexType::WriteLock& lock);
+    /**
+     * @brief 其他线程向queue放入了定时器操作, 需要唤醒其所属线程重新计算超时
+     */
+    virtual void onTimerInsertedAtFront(size_t queue) = 0;
+    /**
+     * @brief 调用线程拥有的队列下标, 不拥有队列时返回-1
+     */
+    virtual int getTimerQueue() = 0;
     
 private:
-    bool detectClockRollover(uint64_t now_ms);
+    /**
+     * @brief 待所属线程执行的操作: 把定时器放到新的到期时间, 或移除已取消的定时器
+     */
+    struct TimerOp
+    {
+        Timer::ptr timer;
+        /// false为新加入, true为refresh/reset
+        bool reset = false;
+        /// 其他线程取消, 移除后不再引用
+        bool remove = false;
+        /// 新的周期(微秒), ~0ull为保持不变
+        uint64_t us = ~0ull;
+        bool from_now = false;
+    };
+
+    struct TimerQueue;
+
+    /**
+     * @brief 在定时器所属线程上直接执行, 其他线程放入所属队列的inbox
+     * @param[in] current 调用线程的队列下标
+     */
+    void dispatch(TimerOp&& op, int current);
+    /// 由所属线程执行
+    void apply(TimerQueue& queue, TimerOp& op);
+    void drainInbox(TimerQueue& queue);
+    Timer::ptr addTimer(Timer* timer);
+    /// timer能否由调用线程的队列current复用
+    bool canRearm(Timer* timer, int current);
 
 private:
-    TMutexType m_Tmutex;
+    /// 定义GLOBAL_TIMER_SET时使用std::set, 默认使用时间轮
+#ifdef GLOBAL_TIMER_SET
+    typedef TimerSet TimerStore;
+#else
+    typedef TimingWheel TimerStore;
+#endif
 
-    bool m_tickled = false;         /// 是否触发onTimerInsertedAtFront
-    uint64_t m_previousTime = 0;
-    std::set<Timer::ptr, Timer::Comparator> m_timers;
+    struct TimerQueue
+    {
+        /// 只由所属线程访问
+        TimerStore timers;
+        /// 保护inbox
+        TMutexType mutex;
+        std::vector<TimerOp> inbox;
+        std::atomic<bool> hasInbox = {false};
+    };
+
+    std::vector<std::unique_ptr<TimerQueue> > m_queues;
+    /// 没有队列的线程添加定时器时轮转选择队列
+    std::atomic<size_t> m_nextQueue = {0};
+    /// 未触发且未取消的定时器数
+    std::atomic<size_t> m_count = {0};
 };
 
 
@@ -0,0 +1,95 @@
+#ifndef __URING_H__
+#define __URING_H__
+
+#include "noncopyable.h"
+
+#include <linux/io_uring.h>
+#include <stddef.h>
+#include <stdint.h>
+
+namespace Global
+{
+
+/**
+ * @brief io_uring提交/完成队列的最小封装
+ * @details 直接使用io_uring_setup/io_uring_enter系统调用, 不依赖liburing.
+ *          非线程安全, 由调用方加锁. 内核不支持时init()返回false, 调用方回退到epoll
+ */
+class IoUring : Noncopyable
+{
+public:
+    IoUring();
+    ~IoUring();
+
+    /**
+     * @brief 创建ring并映射队列
+     * @param[in] entries 提交队列长度
+     * @return 内核不支持或被禁用时返回false
+     */
+    bool init(unsigned entries);
+
+    int getFd() const { return m_fd; }
+
+    /// 剩余可用的sqe数量
+    unsigned space() const;
+
+    /**
+     * @brief 取一个已清零的sqe, 调用submit()后才对内核可见
+     * @return 提交队列已满时返回nullptr
+     */
+    io_uring_sqe* getSqe();
+
+    /// 已取出但尚未被内核接收的sqe数量
+    unsigned pending() const;
+
+    /**
+     * @brief 提交所有已取出的sqe
+     * @return 内核接收的sqe数量, 失败返回-errno
+     */
+    int submit();
+
+    /**
+     * @brief 取出所有已完成的cqe
+     * @param[in] cb 对每个cqe调用cb(const io_uring_cqe&)
+     * @return 处理的cqe数量
+     */
+    template<class Func>
+    unsigned reap(Func cb)
+    {
+        unsigned head = *m_cqHead;
+        unsigned tail = __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE);
+        unsigned count = 0;
+        for(; head != tail; ++head, ++count)
+        {
+            cb(m_cqes[head & *m_cqMask]);
+        }
+        __atomic_store_n(m_cqHead, head, __ATOMIC_RELEASE);
+        return count;
+    }
+
+private:
+    int m_fd;
+    void* m_sqRing;
+    void* m_cqRing;
+    size_t m_sqRingSize;
+    size_t m_cqRingSize;
+    io_uring_sqe* m_sqes;
+    size_t m_sqesSize;
+
+    unsigned* m_sqHead;
+    unsigned* m_sqTail;
+    unsigned* m_sqMask;
+    unsigned* m_sqArray;
+    unsigned m_sqEntries;
+    /// 本地尾指针, submit()时发布给内核
+    unsigned m_sqeTail;
+
+    unsigned* m_cqHead;
+    unsigned* m_cqTail;
+    unsigned* m_cqMask;
+    io_uring_cqe* m_cqes;
+};
+
+} // namespace Global
+
+#endif
@@ -1,6 +1,8 @@
 #include "utils.h"
 
+#include <errno.h>
 #include <sys/time.h>
+#include <time.h>
 #include <sstream>
 #include <execinfo.h>
 
@@ -19,6 +21,109 @@ uint64_t GetCurrentMs()
     return t.tv_sec * 1000ul + t.tv_usec / 1000;
 }
 
+#if defined(GLOBAL_CLOCK_TSC) && (defined(__x86_64__) || defined(__i386__))
+static inline uint64_t ReadTsc()
+{
+    uint32_t lo, hi;
+    asm volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+static uint64_t MonotonicNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ul + ts.tv_nsec;
+}
+
+/**
+ * @brief 以CLOCK_MONOTONIC为基准校准的TSC时钟, 要求CPU支持invariant TSC
+ */
+struct TscClock
+{
+    TscClock()
+    {
+        // 忙等校准, 此时hook可能尚未初始化, 不能sleep
+        uint64_t ns = MonotonicNs();
+        uint64_t tsc = ReadTsc();
+        uint64_t end_ns = ns;
+        while(end_ns - ns < 5000000)
+        {
+            end_ns = MonotonicNs();
+        }
+        uint64_t end_tsc = ReadTsc();
+        usPerTick = (end_ns - ns) / 1000.0 / (end_tsc - tsc);
+        baseUs = end_ns / 1000;
+        baseTsc = end_tsc;
+    }
+
+    uint64_t now() const
+    {
+        return baseUs + (uint64_t)((ReadTsc() - baseTsc) * usPerTick);
+    }
+
+    double usPerTick;
+    uint64_t baseUs;
+    uint64_t baseTsc;
+};
+#endif
+
+uint64_t GetMonotonicUs()
+{
+#if defined(GLOBAL_CLOCK_TSC) && (defined(__x86_64__) || defined(__i386__))
+    static TscClock s_clock;
+    return s_clock.now();
+#else
+#ifdef GLOBAL_CLOCK_COARSE
+    const clockid_t clock = CLOCK_MONOTONIC_COARSE;
+#else
+    // 非x86上GLOBAL_CLOCK_TSC也回退到这里
+    const clockid_t clock = CLOCK_MONOTONIC;
+#endif
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return ts.tv_sec * 1000000ul + ts.tv_nsec / 1000;
+#endif
+}
+
+uint64_t GetMonotonicMs()
+{
+    return GetMonotonicUs() / 1000;
+}
+
+static thread_local uint64_t t_cached_us = 0;
+
+uint64_t GetCachedUs()
+{
+    return t_cached_us ? t_cached_us : GetMonotonicUs();
+}
+
+uint64_t GetCachedMs()
+{
+    return GetCachedUs() / 1000;
+}
+
+uint64_t RefreshCachedTime()
+{
+    t_cached_us = GetMonotonicUs();
+    return t_cached_us;
+}
+
+void ResetCachedTime()
+{
+    t_cached_us = 0;
+}
+
+int GetErrno()
+{
+    return errno;
+}
+
+void SetErrno(int err)
+{
+    errno = err;
+}
+
 // size = 层数 skip = 起点
 void Backtrace(std::vector<std::string>& bt, int size, int skip)
 {
@@ -22,6 +22,40 @@ void Backtrace(std::vector<std::string>& bt, int size, int skip);
 std::string BacktraceToString(int size, int skip, const std::string& prefix="");
 
 uint64_t GetCurrentMs();
+
+/**
+ * @brief 单调时钟微秒数, 不受系统时间调整影响
+ * @details 默认CLOCK_MONOTONIC; 定义GLOBAL_CLOCK_COARSE时用CLOCK_MONOTONIC_COARSE(精度为一个tick),
+ *          定义GLOBAL_CLOCK_TSC时用校准过的rdtsc
+ */
+uint64_t GetMonotonicUs();
+
+/// 单调时钟毫秒数
+uint64_t GetMonotonicMs();
+
+/**
+ * @brief 当前线程缓存的单调时间(微秒), 事件循环每轮刷新; 线程没有刷新过时直接读时钟
+ * @details 与libuv的uv_now相同, 长时间运行的任务中读到的是本轮开始时的时间.
+ *          只用于事件循环中的到期扫描, 计算新的到期时间要用GetMonotonicUs
+ */
+uint64_t GetCachedUs();
+
+/// 当前线程缓存的单调时间(毫秒)
+uint64_t GetCachedMs();
+
+/// 刷新当前线程缓存的时间, 返回微秒数
+uint64_t RefreshCachedTime();
+
+/// 当前线程退出事件循环后停止使用缓存
+void ResetCachedTime();
+
+/**
+ * @brief 读写当前线程的errno
+ * @details __errno_location声明为const, 编译器会把协程挂起前取到的errno地址沿用到挂起之后,
+ *          而协程可能在另一个工作线程上恢复. 挂起之后经由这两个不内联的函数访问errno
+ */
+int GetErrno();
+void SetErrno(int err);
 } // namespace sylar
 
 
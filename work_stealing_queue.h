@@ -0,0 +1,123 @@
+#ifndef __WORK_STEALING_QUEUE_H__
+#define __WORK_STEALING_QUEUE_H__
+
+#include <atomic>
+#include <memory>
+#include <type_traits>
+#include <stdint.h>
+
+namespace Global
+{
+
+/**
+ * @brief 有界Chase-Lev工作窃取队列
+ * @details 只有所属线程可以push, 任意线程都可以steal. 元素必须可平凡拷贝(一般为指针),
+ *          因为窃取者在CAS成功前会读到可能被覆盖的槽位.
+ */
+template<class T>
+class WorkStealingQueue
+{
+    static_assert(std::is_trivially_copyable<T>::value, "T must be trivially copyable");
+public:
+    /**
+     * @param[in] capacity 容量, 向上取整为2的幂
+     */
+    explicit WorkStealingQueue(size_t capacity = 256)
+        : m_top(0)
+        , m_bottom(0)
+    {
+        m_capacity = 1;
+        while(m_capacity < capacity)
+        {
+            m_capacity <<= 1;
+        }
+        m_mask = m_capacity - 1;
+        m_buffer.reset(new std::atomic<T>[m_capacity]);
+    }
+
+    WorkStealingQueue(const WorkStealingQueue&) = delete;
+    WorkStealingQueue& operator=(const WorkStealingQueue&) = delete;
+
+    /**
+     * @brief 所属线程放入尾部
+     * @return 队列已满返回false
+     */
+    bool push(T v)
+    {
+        int64_t b = m_bottom.load(std::memory_order_relaxed);
+        int64_t t = m_top.load(std::memory_order_acquire);
+        if(b - t >= (int64_t)m_capacity)
+        {
+            return false;
+        }
+        m_buffer[b & m_mask].store(v, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        m_bottom.store(b + 1, std::memory_order_relaxed);
+        return true;
+    }
+
+    /**
+     * @brief 所属线程从尾部取出(LIFO)
+     */
+    bool pop(T& v)
+    {
+        int64_t b = m_bottom.load(std::memory_order_relaxed) - 1;
+        m_bottom.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t t = m_top.load(std::memory_order_relaxed);
+        if(t > b)
+        {
+            m_bottom.store(b + 1, std::memory_order_relaxed);
+            return false;
+        }
+        v = m_buffer[b & m_mask].load(std::memory_order_relaxed);
+        if(t == b)
+        {
+            // 只剩最后一个元素, 与窃取者竞争
+            bool ok = m_top.compare_exchange_strong(t, t + 1
+                        , std::memory_order_seq_cst, std::memory_order_relaxed);
+            m_bottom.store(b + 1, std::memory_order_relaxed);
+            return ok;
+        }
+        return true;
+    }
+
+    /**
+     * @brief 从头部取出(FIFO), 任意线程可调用
+     */
+    bool steal(T& v)
+    {
+        int64_t t = m_top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t b = m_bottom.load(std::memory_order_acquire);
+        if(t >= b)
+        {
+            return false;
+        }
+        v = m_buffer[t & m_mask].load(std::memory_order_relaxed);
+        return m_top.compare_exchange_strong(t, t + 1
+                    , std::memory_order_seq_cst, std::memory_order_relaxed);
+    }
+
+    /// 近似长度
+    size_t size() const
+    {
+        int64_t b = m_bottom.load(std::memory_order_relaxed);
+        int64_t t = m_top.load(std::memory_order_relaxed);
+        return b > t ? (size_t)(b - t) : 0;
+    }
+
+    bool empty() const { return size() == 0; }
+    size_t capacity() const { return m_capacity; }
+
+private:
+    alignas(64) std::atomic<int64_t> m_top;
+    alignas(64) std::atomic<int64_t> m_bottom;
+    alignas(64) size_t m_capacity;
+    size_t m_mask;
+    std::unique_ptr<std::atomic<T>[]> m_buffer;
+};
+
+} // namespace Global
+
+#endif